@@ -21,6 +21,9 @@ uniform mediump mat3      u_normal_tex_transf;
 uniform lowp    vec3      u_light_emit;
 uniform lowp    float     u_min_brightness;
 uniform mediump mat4      u_mv;  // Model view matrix.
+uniform highp   mat4      u_model_view; // Model to view (with fake scaling).
+uniform highp   mat4      u_model;      // Model to frame (no fake scaling).
+uniform highp   mat3      u_normal_mat; // Model to frame for the normals.
 uniform lowp    int       u_has_normal_tex;
 uniform lowp    int       u_material; // 0: Oren Nayar, 1: generic, 2: ring
 uniform lowp    int       u_is_moon; // Set to 1 for the Moon only.
@@ -47,24 +50,23 @@ varying highp   vec3 v_bitangent;
 
 #includes "projections.glsl"
 
-attribute highp   vec3 a_pos;     // View position (with fake scaling).
-attribute highp   vec3 a_mpos;    // Model position (without fake scaling).
+attribute highp   vec3 a_pos;     // Model position.
 attribute mediump vec2 a_tex_pos;
-attribute lowp    vec3 a_color;
-attribute highp   vec3 a_normal;
-attribute highp   vec3 a_tangent;
 
 void main()
 {
-    gl_Position = proj(a_pos);
+    gl_Position = proj((u_model_view * vec4(a_pos, 1.0)).xyz);
 
-    v_mpos = a_mpos;
+    v_mpos = (u_model * vec4(a_pos, 1.0)).xyz;
     v_tex_pos = (u_tex_transf * vec3(a_tex_pos, 1.0)).xy;
     v_normal_tex_pos = (u_normal_tex_transf * vec3(a_tex_pos, 1.0)).xy;
-    v_color = vec4(a_color, 1.0) * u_color;
+    v_color = u_color;
 
-    v_normal = normalize(a_normal);
-    v_tangent = normalize(a_tangent);
+    v_normal = normalize(u_normal_mat * a_pos);
+    // XXX: the tangent should follow the normal map texture projection,
+    // but the one we use for the Moon doesn't follow the healpix
+    // projection.
+    v_tangent = normalize(cross(vec3(0.0, 0.0, 1.0), v_normal));
     v_bitangent = normalize(cross(v_normal, v_tangent));
 }
 
@@ -12,6 +12,7 @@ uniform mediump sampler2D   u_tex;
 uniform lowp    vec2        u_win_size;
 
 varying highp   vec2        v_tex_pos;
+varying lowp    vec4        v_color;
 
 #ifdef VERTEX_SHADER
 
@@ -22,17 +23,35 @@ varying highp   vec2        v_tex_pos;
 
 attribute highp     vec2    a_wpos;
 attribute mediump   vec2    a_tex_pos;
+attribute lowp      vec4    a_color;
+
+#ifdef INSTANCED
+// Instanced rendering: a_corner is the corner of a static unit quad, and
+// all the other attributes are per instance.  The quads are given by their
+// first corner and two axes.
+attribute mediump   vec2    a_corner;
+attribute highp     vec4    a_wpos_axes;
+attribute mediump   vec4    a_tex_axes;
+#endif
 
 void main()
 {
+    highp vec2 wpos = a_wpos;
+    mediump vec2 tex_pos = a_tex_pos;
+    #ifdef INSTANCED
+        wpos += a_corner.x * a_wpos_axes.xy + a_corner.y * a_wpos_axes.zw;
+        tex_pos += a_corner.x * a_tex_axes.xy + a_corner.y * a_tex_axes.zw;
+    #endif
+
     #ifdef HAS_VIEW_POS
         gl_Position = proj(a_pos);
     #else
         gl_Position = vec4(0.0, 0.0, 0.0, 1.0);
     #endif
-    gl_Position.xy = (a_wpos / u_win_size - 0.5) * vec2(2.0, -2.0);
+    gl_Position.xy = (wpos / u_win_size - 0.5) * vec2(2.0, -2.0);
     gl_Position.xy *= gl_Position.w;
-    v_tex_pos = a_tex_pos;
+    v_tex_pos = tex_pos;
+    v_color = a_color;
 }
 
 #endif
@@ -41,10 +60,10 @@ void main()
 void main()
 {
 #ifndef TEXTURE_LUMINANCE
-    gl_FragColor = texture2D(u_tex, v_tex_pos) * u_color;
+    gl_FragColor = texture2D(u_tex, v_tex_pos) * u_color * v_color;
 #else
     // Luminance mode: the texture only applies to the alpha channel.
-    gl_FragColor = u_color;
+    gl_FragColor = u_color * v_color;
     gl_FragColor.a *= texture2D(u_tex, v_tex_pos).r;
 #endif
 }
@@ -0,0 +1,225 @@
+// Stellarium Web - Copyright (c) 2021 - Stellarium Labs SAS
+//
+// This program is licensed under the terms of the GNU AGPL v3, or
+// alternatively under a commercial licence.
+//
+// The terms of the AGPL v3 license can be found in the main directory of this
+// repository.
+//
+// This file is part of the Survey Monitoring Tool plugin, which received
+// funding from the Centre national d'études spatiales (CNES).
+
+// Encoder for the 'geobin' HiPS tile format, a binary equivalent of the
+// geojson tiles which can be loaded by the engine without parsing json or
+// tesselating polygons.
+//
+// All values are little endian:
+//   header:     magic ('GEOB'), version, children_mask, nb_features,
+//               nb_vertices, nb_indices, properties_size, reserved
+//               (uint32 each)
+//   features:   for each feature, the number of vertices, triangles indices,
+//               lines indices and points indices (uint32 each)
+//   vertices:   nb_vertices ICRF unit vectors (3 float32 each)
+//   indices:    for each feature its triangles, lines and points indices
+//               (uint16, relative to the feature first vertex), padded to a
+//               multiple of 4 bytes
+//   properties: the features properties stored per column as a json
+//               document, nul terminated
+//
+// The format must be kept in sync with src/modules/geojson.c in the engine.
+
+import earcut from 'earcut'
+import geo_utils from './geojson-utils.mjs'
+
+const MAGIC = 0x424f4547 // 'GEOB'
+const VERSION = 1
+const HEADER_SIZE = 8 * 4
+const FEATURE_SIZE = 4 * 4
+const MAX_VERTICES = 65536
+
+const dot = function (a, b) {
+  return a[0] * b[0] + a[1] * b[1] + a[2] * b[2]
+}
+
+const cross = function (a, b) {
+  return [a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]]
+}
+
+const normalize = function (v) {
+  const l = Math.sqrt(dot(v, v))
+  return [v[0] / l, v[1] / l, v[2] / l]
+}
+
+// Return the 2d coordinates of the unit vectors used for the triangulation.
+// We use a gnomonic projection centered on the polygon so that the edges
+// stay straight lines, or fallback to the lon/lat coordinates if the
+// polygon is too large for it.
+const projectPolygon = function (verts, rings) {
+  let c = [0, 0, 0]
+  for (const v of verts) c = [c[0] + v[0], c[1] + v[1], c[2] + v[2]]
+  c = normalize(c)
+  if (isNaN(c[0]) || verts.some(v => dot(v, c) < 0.01)) {
+    return rings.flat(2)
+  }
+  const e1 = normalize(cross(Math.abs(c[2]) < 0.9 ? [0, 0, 1] : [1, 0, 0], c))
+  const e2 = cross(c, e1)
+  const ret = []
+  for (const v of verts) {
+    const d = dot(v, c)
+    ret.push(dot(v, e1) / d, dot(v, e2) / d)
+  }
+  return ret
+}
+
+const newMesh = function () {
+  return { vertices: [], triangles: [], lines: [], points: [] }
+}
+
+// Return the last mesh of a feature if it still has room for n vertices,
+// or start a new one, since the indices are stored on 16 bits.
+const meshReserve = function (meshes, n) {
+  const mesh = meshes[meshes.length - 1]
+  if (mesh.vertices.length + n <= MAX_VERTICES) return mesh
+  meshes.push(newMesh())
+  return meshes[meshes.length - 1]
+}
+
+// Triangulate a geojson polygon and add it to the feature meshes
+const meshAddPolygon = function (meshes, rings) {
+  // Skip the closing point of each ring
+  rings = rings.map(r => r.slice(0, r.length - 1)).filter(r => r.length >= 3)
+  if (!rings.length) return
+  const verts = rings.flat().map(p => geo_utils.geojsonPointToVec3(p))
+  if (verts.length > MAX_VERTICES) {
+    console.log('Too many vertices in tile feature, skip polygon')
+    return
+  }
+  const mesh = meshReserve(meshes, verts.length)
+  const ofs = mesh.vertices.length
+  const holes = []
+  let n = 0
+  for (const r of rings) {
+    if (n) holes.push(n)
+    for (let i = 0; i < r.length; i++) {
+      mesh.lines.push(ofs + n + i, ofs + n + (i + 1) % r.length)
+    }
+    n += r.length
+  }
+  const triangles = earcut(projectPolygon(verts, rings), holes, 2)
+  for (let i = 0; i < triangles.length; i += 3) {
+    const a = triangles[i]
+    let b = triangles[i + 1]
+    let c = triangles[i + 2]
+    // Same culling as in the engine tesselator
+    if (dot(cross(verts[a], verts[b]), verts[c]) > 0) [b, c] = [c, b]
+    mesh.triangles.push(ofs + a, ofs + b, ofs + c)
+  }
+  mesh.vertices.push(...verts)
+}
+
+// Add a geojson line string to the feature meshes.  Long lines are split
+// in several parts sharing their end points.
+const meshAddLine = function (meshes, coords) {
+  for (let start = 0; start < coords.length - 1; start += MAX_VERTICES - 1) {
+    const part = coords.slice(start, start + MAX_VERTICES)
+    const mesh = meshReserve(meshes, part.length)
+    const ofs = mesh.vertices.length
+    for (let i = 0; i < part.length - 1; i++) {
+      mesh.lines.push(ofs + i, ofs + i + 1)
+    }
+    mesh.vertices.push(...part.map(p => geo_utils.geojsonPointToVec3(p)))
+  }
+}
+
+const meshAddGeometry = function (meshes, geometry) {
+  const coords = geometry.coordinates
+  let mesh
+  switch (geometry.type) {
+    case 'Polygon':
+      meshAddPolygon(meshes, coords)
+      break
+    case 'MultiPolygon':
+      for (const poly of coords) meshAddPolygon(meshes, poly)
+      break
+    case 'LineString':
+      meshAddLine(meshes, coords)
+      break
+    case 'Point':
+      mesh = meshReserve(meshes, 1)
+      mesh.points.push(mesh.vertices.length)
+      mesh.vertices.push(geo_utils.geojsonPointToVec3(coords))
+      break
+    default:
+      console.log('Unsupported geometry type in tile: ' + geometry.type)
+  }
+}
+
+// Return the features properties as columns, so that the keys are not
+// repeated for each feature.
+const propertiesColumns = function (features) {
+  const ret = { properties: {}, geogroup_id: [], healpix_index: [], geogroup_size: [] }
+  for (const f of features) {
+    for (const k in f.properties) ret.properties[k] = []
+  }
+  for (const f of features) {
+    for (const k in ret.properties) {
+      const v = f.properties[k]
+      ret.properties[k].push(v === undefined ? null : v)
+    }
+    ret.geogroup_id.push(f.geogroup_id === undefined ? null : f.geogroup_id)
+    ret.healpix_index.push(f.healpix_index)
+    ret.geogroup_size.push(f.geogroup_size)
+  }
+  return ret
+}
+
+// Encode the features of a geojson tile into a 'geobin' tile buffer
+// If a feature needs more than MAX_VERTICES vertices, it is split into
+// several features with the same properties.
+export function encodeBinaryTile (features, childrenMask) {
+  const meshes = []
+  const meshesFeatures = []
+  for (const f of features) {
+    const fmeshes = [newMesh()]
+    meshAddGeometry(fmeshes, f.geometry)
+    for (const m of fmeshes) {
+      meshes.push(m)
+      meshesFeatures.push(f)
+    }
+  }
+  const nbVertices = meshes.reduce((n, m) => n + m.vertices.length, 0)
+  const nbIndices = meshes.reduce((n, m) => n + m.triangles.length + m.lines.length + m.points.length, 0)
+  const props = Buffer.from(JSON.stringify(propertiesColumns(meshesFeatures)) + '\0', 'utf-8')
+  const indicesSize = (nbIndices * 2 + 3) & ~3
+  const buf = Buffer.alloc(HEADER_SIZE + meshes.length * FEATURE_SIZE +
+      nbVertices * 12 + indicesSize + props.length)
+
+  let ofs = 0
+  const header = [MAGIC, VERSION, childrenMask === undefined ? 15 : childrenMask,
+    meshes.length, nbVertices, nbIndices, props.length, 0]
+  for (const v of header) ofs = buf.writeUInt32LE(v, ofs)
+  for (const m of meshes) {
+    ofs = buf.writeUInt32LE(m.vertices.length, ofs)
+    ofs = buf.writeUInt32LE(m.triangles.length, ofs)
+    ofs = buf.writeUInt32LE(m.lines.length, ofs)
+    ofs = buf.writeUInt32LE(m.points.length, ofs)
+  }
+  for (const m of meshes) {
+    for (const v of m.vertices) {
+      ofs = buf.writeFloatLE(v[0], ofs)
+      ofs = buf.writeFloatLE(v[1], ofs)
+      ofs = buf.writeFloatLE(v[2], ofs)
+    }
+  }
+  const indicesStart = ofs
+  for (const m of meshes) {
+    for (const i of m.triangles) ofs = buf.writeUInt16LE(i, ofs)
+    for (const i of m.lines) ofs = buf.writeUInt16LE(i, ofs)
+    for (const i of m.points) ofs = buf.writeUInt16LE(i, ofs)
+  }
+  ofs = indicesStart + indicesSize
+  props.copy(buf, ofs)
+  return buf
+}
+
+export default { encodeBinaryTile }
@@ -0,0 +1,313 @@
+// Stellarium Web - Copyright (c) 2021 - Stellarium Labs SAS
+//
+// This program is licensed under the terms of the GNU AGPL v3, or
+// alternatively under a commercial licence.
+//
+// The terms of the AGPL v3 license can be found in the main directory of this
+// repository.
+//
+// This file is part of the Survey Monitoring Tool plugin, which received
+// funding from the Centre national d'études spatiales (CNES).
+
+// In-memory columnar copy of the features table, used to answer the simple
+// filter/aggregation queries sent by the UI panels without going through SQL.
+//
+// Numeric (number, int, date) fields are stored as Float64Array with NaN for
+// undefined values. String fields are dictionary-encoded in an Int32Array,
+// with -1 for undefined values.
+// Constraints are evaluated as bitmaps, and all the aggregations of a query
+// are computed together while iterating the selected rows.
+//
+// The results are identical to the SQL path of the QueryEngine. Queries using
+// features not supported here (GROUP_BY, geo aggregations, projections...)
+// make query() return undefined so that the caller falls back to SQL.
+
+const NUMERIC_TYPES = ['number', 'int', 'date']
+
+// Return the number of 32 bits words needed for a bitmap of n rows
+const bitmapSize = function (n) {
+  return (n + 31) >>> 5
+}
+
+// Call f(i) for each index i set in the bitmap
+const bitmapForEach = function (bits, f) {
+  for (let w = 0; w < bits.length; w++) {
+    let word = bits[w]
+    while (word) {
+      const t = word & -word
+      f((w << 5) + 31 - Math.clz32(t))
+      word ^= t
+    }
+  }
+}
+
+// Same as SQLite ROUND(x): round half away from zero
+const sqlRound = function (x) {
+  return x < 0 ? -Math.round(-x) : Math.round(x)
+}
+
+// Same as the SQL sqlDateBin(v, step) in query-engine.mjs
+export const formatDateBin = function (v, step) {
+  const len = { '%Y': 4, '%Y-%m': 7, '%Y-%m-%d': 10 }[step]
+  return new Date(sqlRound(v / 1000) * 1000).toISOString().slice(0, len)
+}
+
+// Accumulator with the exact same semantic as the VALUES_AND_COUNT SQL
+// aggregate: only the first limit distinct values are kept, subsequent rows
+// with other values are counted in __overflow.
+class ValuesAndCount {
+  constructor (limit) {
+    this.limit = limit
+    this.acc = undefined
+  }
+
+  step (value) {
+    if (!this.acc) this.acc = {}
+    const acc = this.acc
+    if (value === null) value = '__undefined'
+    const prevValue = acc[value]
+    if (prevValue === undefined) {
+      if (acc.__overflow) {
+        acc.__overflow++
+        return
+      }
+      acc[value] = 1
+      if (Object.keys(acc).length >= this.limit) acc.__overflow = 1
+    } else {
+      acc[value]++
+    }
+  }
+
+  result () {
+    return this.acc ? this.acc : null
+  }
+}
+
+export default class ColumnarTable {
+  // Number of rows
+  length = 0
+  // Map of sql field id -> { type, values, dict }
+  columns = {}
+
+  // Load the given fields of the features table.
+  // fields is a list of { sqlId, type } objects.
+  constructor (db, fields) {
+    fields = fields.filter(f => NUMERIC_TYPES.includes(f.type) || f.type === 'string')
+    const n = db.prepare('SELECT COUNT(*) as c FROM features').get().c
+    this.length = n
+    for (const f of fields) {
+      const col = { type: f.type }
+      if (f.type === 'string') {
+        col.values = new Int32Array(n)
+        col.dict = []
+        col.dictIndex = new Map()
+      } else {
+        col.values = new Float64Array(n)
+      }
+      this.columns[f.sqlId] = col
+    }
+    if (!fields.length) return
+    const cols = fields.map(f => this.columns[f.sqlId])
+    const stmt = db.prepare('SELECT ' + fields.map(f => f.sqlId).join(', ') + ' FROM features ORDER BY rowid')
+    let i = 0
+    for (const row of stmt.raw(true).iterate()) {
+      for (let j = 0; j < cols.length; j++) {
+        const col = cols[j]
+        const v = row[j]
+        if (col.dict) {
+          if (v === null || v === undefined) {
+            col.values[i] = -1
+            continue
+          }
+          const s = '' + v
+          let code = col.dictIndex.get(s)
+          if (code === undefined) {
+            code = col.dict.length
+            col.dict.push(s)
+            col.dictIndex.set(s, code)
+          }
+          col.values[i] = code
+        } else {
+          col.values[i] = (v === null || v === undefined) ? NaN : v
+        }
+      }
+      i++
+    }
+  }
+
+  // Return the bitmap of the rows matching one constraint, or undefined
+  // if the constraint is not supported.
+  #constraintBitmap (c, sqlId) {
+    const col = this.columns[sqlId]
+    if (!col) return undefined
+    const n = this.length
+    const bits = new Uint32Array(bitmapSize(n))
+    const vals = col.values
+    let pred
+    if (c.operation === 'IS_UNDEFINED') {
+      pred = col.dict ? (i => vals[i] === -1) : (i => isNaN(vals[i]))
+    } else if (col.dict) {
+      let codes
+      if (c.operation === 'STRING_EQUAL') codes = [c.expression]
+      else if (c.operation === 'IN') codes = c.expression
+      else return undefined
+      codes = new Set(codes.map(e => col.dictIndex.get('' + e)).filter(e => e !== undefined))
+      if (codes.size === 1) {
+        const code = codes.values().next().value
+        pred = i => vals[i] === code
+      } else {
+        pred = i => codes.has(vals[i])
+      }
+    } else {
+      if (c.operation === 'DATE_RANGE' || c.operation === 'NUMBER_RANGE') {
+        const min = c.expression[0]
+        const max = c.expression[1]
+        if (typeof min !== 'number' || typeof max !== 'number') return undefined
+        pred = i => vals[i] >= min && vals[i] <= max
+      } else if (c.operation === 'INT_EQUAL' || c.operation === 'IN') {
+        const exprs = c.operation === 'IN' ? c.expression : [c.expression]
+        if (exprs.some(e => typeof e !== 'number')) return undefined
+        const set = new Set(exprs)
+        pred = i => set.has(vals[i])
+      } else {
+        return undefined
+      }
+    }
+    for (let i = 0; i < n; i++) {
+      if (pred(i)) bits[i >>> 5] |= (1 << (i & 31))
+    }
+    return bits
+  }
+
+  // Return the bitmap of the rows matching all the constraints, or undefined
+  // if one of the constraints is not supported.
+  // Like in the SQL path, constraints on the same field are OR-ed, and
+  // AND-ed otherwise.
+  filter (constraints, fId2SqlId) {
+    const n = this.length
+    const res = new Uint32Array(bitmapSize(n)).fill(0xffffffff)
+    if (n & 31) res[res.length - 1] = (1 << (n & 31)) - 1
+    const grouped = {}
+    for (const c of (constraints || [])) {
+      if (!(c.fieldId in grouped)) grouped[c.fieldId] = []
+      grouped[c.fieldId].push(c)
+    }
+    for (const fieldId in grouped) {
+      const groupBits = new Uint32Array(res.length)
+      for (const c of grouped[fieldId]) {
+        const bits = this.#constraintBitmap(c, fId2SqlId(fieldId))
+        if (!bits) return undefined
+        for (let w = 0; w < groupBits.length; w++) groupBits[w] |= bits[w]
+      }
+      for (let w = 0; w < res.length; w++) res[w] &= groupBits[w]
+    }
+    return res
+  }
+
+  // Check that a query only uses supported aggregations on known columns
+  canRunAggregations (q, fId2SqlId) {
+    if (!q.aggregationOptions || q.projectOptions || q.limit || q.skip) return false
+    if (q.groupingOptions && q.groupingOptions.length &&
+        !(q.groupingOptions.length === 1 && q.groupingOptions[0].operation === 'GROUP_ALL')) {
+      return false
+    }
+    for (const agOpt of q.aggregationOptions) {
+      if (agOpt.operation === 'COUNT') continue
+      const col = this.columns[fId2SqlId(agOpt.fieldId || '')]
+      if (!col) return false
+      if (agOpt.operation === 'VALUES_AND_COUNT') continue
+      // Other operations are only supported on numeric columns
+      if (col.dict) return false
+      if (['MIN', 'MAX', 'MIN_MAX', 'NUMBER_HISTOGRAM'].includes(agOpt.operation)) continue
+      if (agOpt.operation === 'DATE_HISTOGRAM' && col.type === 'date') continue
+      return false
+    }
+    return true
+  }
+
+  // Compute the aggregations of the query on the rows selected by bits.
+  // Return the raw result line (same as the SQL path before post processing)
+  // The histogram min/max/step are computed by calling the passed functions
+  // once the min/max values of each field are known.
+  aggregate (q, bits, fId2SqlId, dateMinMaxStep, numberMinMaxStep) {
+    const line = {}
+    const minMax = {}
+    const tags = []
+    let count = 0
+
+    // First pass: count, min/max, and tags
+    for (const agOpt of q.aggregationOptions) {
+      const sqlId = fId2SqlId(agOpt.fieldId || '')
+      if (agOpt.operation === 'VALUES_AND_COUNT') {
+        const col = this.columns[sqlId]
+        tags.push({ agOpt, col, acc: new ValuesAndCount(agOpt.limit || 20) })
+      } else if (agOpt.operation !== 'COUNT') {
+        minMax[sqlId] = { col: this.columns[sqlId], min: null, max: null }
+      }
+    }
+    const minMaxList = Object.values(minMax)
+    bitmapForEach(bits, i => {
+      count++
+      for (const mm of minMaxList) {
+        const v = mm.col.values[i]
+        if (isNaN(v)) continue
+        if (mm.min === null || v < mm.min) mm.min = v
+        if (mm.max === null || v > mm.max) mm.max = v
+      }
+      for (const t of tags) {
+        const code = t.col.values[i]
+        if (t.col.dict) t.acc.step(code === -1 ? null : t.col.dict[code])
+        else t.acc.step(isNaN(code) ? null : code)
+      }
+    })
+
+    // Second pass: histograms, which bins depend on the min/max
+    const histos = []
+    for (const agOpt of q.aggregationOptions) {
+      const sqlId = fId2SqlId(agOpt.fieldId || '')
+      const mm = minMax[sqlId]
+      if (agOpt.operation === 'COUNT') {
+        line[agOpt.out] = count
+      } else if (agOpt.operation === 'MIN') {
+        line[agOpt.out] = mm.min
+      } else if (agOpt.operation === 'MAX') {
+        line[agOpt.out] = mm.max
+      } else if (agOpt.operation === 'MIN_MAX') {
+        line[agOpt.out] = mm.min === null ? null : [mm.min, mm.max]
+      } else if (agOpt.operation === 'DATE_HISTOGRAM') {
+        const res = dateMinMaxStep(mm.min, mm.max, 3)
+        res.table = [['Date', 'Count']]
+        agOpt.postProcessData = res
+        histos.push({ agOpt, col: mm.col, acc: new ValuesAndCount(200),
+          bin: v => formatDateBin(v, res.step) })
+      } else if (agOpt.operation === 'NUMBER_HISTOGRAM') {
+        const res = numberMinMaxStep(mm.min, mm.max, 10)
+        const qmin = res.min !== undefined ? res.min : 0
+        const step = res.step
+        res.noval = 0
+        res.table = [['Value', 'Count']]
+        agOpt.postProcessData = res
+        // SQLite uses an integer division when all operands are integers
+        const intDiv = Number.isInteger(qmin) && Number.isInteger(step)
+        histos.push({ agOpt, col: mm.col, acc: new ValuesAndCount(200),
+          bin: v => {
+            const d = (intDiv && Number.isInteger(v)) ? Math.trunc((v - qmin) / step) : (v - qmin) / step
+            return sqlRound(d) * step + qmin
+          }
+        })
+      }
+    }
+    if (histos.length) {
+      bitmapForEach(bits, i => {
+        for (const h of histos) {
+          const v = h.col.values[i]
+          h.acc.step(isNaN(v) ? null : h.bin(v))
+        }
+      })
+    }
+    for (const t of tags.concat(histos)) {
+      line[t.agOpt.out] = t.acc.result()
+    }
+    return line
+  }
+}
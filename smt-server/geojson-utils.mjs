@@ -206,6 +206,45 @@ export default {
     return area
   },
 
+  // Return the sum of the turf areas (see getHealpixTurfArea) of all the
+  // sub-pixels at order maxOrder of the healpix pixel (order, pix)
+  getHealpixCellTurfArea: function (order, pix, maxOrder) {
+    if (order >= maxOrder) return this.getHealpixTurfArea(order, pix)
+    const cacheKey = '' + order + '_' + pix + '_' + maxOrder
+    if (cacheKey in healpixAreaCache)
+      return healpixAreaCache[cacheKey]
+    let area = 0
+    for (let i = 0; i < 4; ++i) {
+      area += this.getHealpixCellTurfArea(order + 1, pix * 4 + i, maxOrder)
+    }
+    healpixAreaCache[cacheKey] = area
+    return area
+  },
+
+  // Convert a list of healpix pixels at the given order into the equivalent
+  // list of [order, pix] cells, where each group of 4 sibling pixels is
+  // recursively replaced by their parent cell (MOC normal form).
+  healpixPixelsToMoc: function (order, pixels) {
+    const ret = []
+    let current = new Set(pixels)
+    for (let o = order; o > 0; --o) {
+      const parents = new Set()
+      for (const pix of current) {
+        const parent = Math.floor(pix / 4)
+        if (parents.has(parent)) continue
+        const base = parent * 4
+        if (current.has(base) && current.has(base + 1) && current.has(base + 2) && current.has(base + 3))
+          parents.add(parent)
+      }
+      for (const pix of current) {
+        if (!parents.has(Math.floor(pix / 4))) ret.push([o, pix])
+      }
+      current = parents
+    }
+    for (const pix of current) ret.push([0, pix])
+    return ret
+  },
+
   rotationMatsForShiftCenter: function (center) {
     let q = glMatrix.quat.create()
     glMatrix.quat.rotationTo(q, glMatrix.vec3.fromValues(center[0], center[1], center[2]), glMatrix.vec3.fromValues(1, 0, 0))
@@ -0,0 +1,231 @@
+// Stellarium Web - Copyright (c) 2021 - Stellarium Labs SAS
+//
+// This program is licensed under the terms of the GNU AGPL v3, or
+// alternatively under a commercial licence.
+//
+// The terms of the AGPL v3 license can be found in the main directory of this
+// repository.
+//
+// This file is part of the Survey Monitoring Tool plugin, which received
+// funding from the Centre national d'études spatiales (CNES).
+
+import fs from 'fs'
+import fsp from 'fs/promises'
+import crypto from 'crypto'
+
+// Serialize a JSON value with sorted object keys, so that two queries
+// differing only by their keys order give the same string.
+const canonicalStringify = function (v) {
+  if (v === null || typeof v !== 'object') {
+    return JSON.stringify(v === undefined ? null : v)
+  }
+  if (Array.isArray(v)) {
+    return '[' + v.map(e => canonicalStringify(e)).join(',') + ']'
+  }
+  const keys = Object.keys(v).filter(k => v[k] !== undefined).sort()
+  return '{' + keys.map(k => JSON.stringify(k) + ':' + canonicalStringify(v[k])).join(',') + '}'
+}
+
+const sha1 = function (s) {
+  return crypto.createHash('sha1').update(s).digest('hex')
+}
+
+// Simple in-memory LRU cache, limited both in number of entries and in total
+// cost (e.g. the size in bytes of the serialized values).
+// If set, onEvict(key, value) is called for the entries removed to respect
+// the limits.
+export class LRUCache {
+  #map = new Map()
+  #cost = 0
+
+  constructor (maxEntries, maxCost, onEvict) {
+    this.maxEntries = maxEntries
+    this.maxCost = maxCost || Infinity
+    this.onEvict = onEvict
+  }
+
+  get size () {
+    return this.#map.size
+  }
+
+  get cost () {
+    return this.#cost
+  }
+
+  get (key) {
+    const e = this.#map.get(key)
+    if (e === undefined) return undefined
+    // Move the entry at the end of the list (most recently used)
+    this.#map.delete(key)
+    this.#map.set(key, e)
+    return e.value
+  }
+
+  has (key) {
+    return this.#map.has(key)
+  }
+
+  set (key, value, cost) {
+    cost = cost || 1
+    this.delete(key)
+    // Items bigger than the whole cache are never stored
+    if (cost > this.maxCost) return
+    this.#map.set(key, { value: value, cost: cost })
+    this.#cost += cost
+    // Evict least recently used entries (at the beginning of the list)
+    for (const [k, e] of this.#map) {
+      if (this.#map.size <= this.maxEntries && this.#cost <= this.maxCost) break
+      this.#map.delete(k)
+      this.#cost -= e.cost
+      if (this.onEvict) this.onEvict(k, e.value)
+    }
+  }
+
+  delete (key) {
+    const e = this.#map.get(key)
+    if (e === undefined) return
+    this.#map.delete(key)
+    this.#cost -= e.cost
+  }
+
+  clear () {
+    this.#map.clear()
+    this.#cost = 0
+  }
+}
+
+// Two tiers cache for query results: a memory LRU backed by a disk directory.
+// Keys are computed from the base hash key of the data and the canonical
+// form of the query, so that a new version of the data never reuses results
+// computed on a previous one.
+// Concurrent requests for the same key share a single computation.
+// The disk tier is also limited, the least recently used files are removed
+// first.  On startup we use the files modification time to know their order.
+export class QueryCache {
+  #memory = undefined
+  #disk = undefined
+  #pending = new Map()
+  #diskDir = undefined
+  #baseHashKey = ''
+  stats = { memoryHits: 0, diskHits: 0, sharedHits: 0, misses: 0 }
+
+  // Parameters:
+  //   cacheDir   - directory where the disk tier is stored, or undefined to
+  //                only cache in memory.
+  //   maxEntries - maximum number of entries kept in memory.
+  //   maxBytes   - maximum size of the serialized entries kept in memory.
+  //   maxDiskEntries - maximum number of files kept on disk.
+  //   maxDiskBytes   - maximum size of the files kept on disk.
+  constructor (cacheDir, maxEntries, maxBytes, maxDiskEntries, maxDiskBytes) {
+    this.cacheDir = cacheDir
+    this.#memory = new LRUCache(maxEntries || 2000, maxBytes || 256 * 1024 * 1024)
+    this.#disk = new LRUCache(maxDiskEntries || 100000,
+      maxDiskBytes || 2 * 1024 * 1024 * 1024, (key, fileName) => {
+        fsp.rm(fileName, { force: true }).catch(err =>
+          console.log('Cannot remove query cache file: ' + err))
+      })
+  }
+
+  // Change the base hash key of the data. All previously cached results
+  // (in memory and on disk) are dropped.
+  setBaseHashKey (baseHashKey) {
+    if (baseHashKey === this.#baseHashKey) return
+    this.#baseHashKey = baseHashKey
+    this.#memory.clear()
+    this.#disk.clear()
+    this.#pending.clear()
+    this.#diskDir = undefined
+    if (!this.cacheDir) return
+    fs.mkdirSync(this.cacheDir, { recursive: true })
+    for (const d of fs.readdirSync(this.cacheDir)) {
+      if (d === baseHashKey) continue
+      fs.rmSync(this.cacheDir + '/' + d, { recursive: true, force: true })
+    }
+    this.#diskDir = this.cacheDir + '/' + baseHashKey
+    fs.mkdirSync(this.#diskDir, { recursive: true })
+    // Index the files already there, oldest first, so that they are the
+    // first ones removed.
+    const files = []
+    for (const f of fs.readdirSync(this.#diskDir)) {
+      const fileName = this.#diskDir + '/' + f
+      if (!f.endsWith('.json')) {
+        fs.rmSync(fileName, { force: true }) // Interrupted write.
+        continue
+      }
+      const st = fs.statSync(fileName)
+      files.push({ key: f.slice(0, -5), fileName: fileName, size: st.size, mtime: st.mtimeMs })
+    }
+    files.sort((a, b) => a.mtime - b.mtime)
+    for (const f of files) this.#disk.set(f.key, f.fileName, f.size)
+  }
+
+  // Return the cache key for a given kind of request and its parameters
+  key (kind, ...params) {
+    return sha1(this.#baseHashKey + ':' + kind + ':' + canonicalStringify(params))
+  }
+
+  // Return the cached value for key, or call computeFn() to compute it.
+  // computeFn must return a promise of a JSON serializable value.
+  async getOrCompute (key, computeFn) {
+    const v = this.#memory.get(key)
+    if (v !== undefined) {
+      this.stats.memoryHits++
+      return JSON.parse(v)
+    }
+    // Another request is already computing this value: wait for it
+    if (this.#pending.has(key)) {
+      this.stats.sharedHits++
+      return JSON.parse(await this.#pending.get(key))
+    }
+    const baseHashKey = this.#baseHashKey
+    const p = this.#load(key, computeFn)
+    this.#pending.set(key, p)
+    try {
+      const str = await p
+      // Only keep the result if the data didn't change in the meantime
+      if (baseHashKey === this.#baseHashKey) {
+        this.#memory.set(key, str, str.length)
+      }
+      return JSON.parse(str)
+    } finally {
+      if (this.#pending.get(key) === p) this.#pending.delete(key)
+    }
+  }
+
+  // Look in the disk tier, or compute and store the value as a string
+  async #load (key, computeFn) {
+    const diskDir = this.#diskDir
+    const fileName = diskDir ? diskDir + '/' + key + '.json' : undefined
+    if (fileName) {
+      try {
+        const str = await fsp.readFile(fileName, 'utf-8')
+        this.stats.diskHits++
+        // Mark the file as recently used.
+        if (this.#disk.get(key) !== undefined) {
+          const now = new Date()
+          fsp.utimes(fileName, now, now).catch(() => {})
+        }
+        return str
+      } catch (err) {}
+    }
+    this.stats.misses++
+    const res = await computeFn()
+    // undefined can't be serialized in JSON, we store it as null
+    const str = JSON.stringify(res === undefined ? null : res)
+    if (fileName && str.length <= this.#disk.maxCost) {
+      // Write in a tmp file first so that a partially written file is
+      // never read by another request.
+      const tmpFileName = fileName + '.' + process.pid + '.tmp'
+      fsp.writeFile(tmpFileName, str)
+        .then(() => fsp.rename(tmpFileName, fileName))
+        .then(() => {
+          // The directory has been removed if the data changed meanwhile.
+          if (this.#diskDir === diskDir) this.#disk.set(key, fileName, str.length)
+        })
+        .catch(err => console.log('Cannot write query cache file: ' + err))
+    }
+    return str
+  }
+}
+
+export default { canonicalStringify, sha1 }
@@ -19,6 +19,9 @@ import fs from 'fs'
 import workerpool from 'workerpool'
 import os from 'os'
 import healpix from '@hscmap/healpix'
+import qcUtils, { LRUCache } from './query-cache.mjs'
+import ColumnarTable from './columnar-engine.mjs'
+import { encodeBinaryTile } from './binary-tile.mjs'
 
 const HEALPIX_ORDER = 5
 const HEALPIX_PIXEL_AREA = healpix.nside2pixarea(1 << HEALPIX_ORDER)
@@ -46,11 +49,91 @@ const postProcessSQLiteResult = function (res) {
   }
 }
 
+// Return the date histogram min, max and step for a date field whose values
+// range from dmin to dmax, so that there are at least minSteps bins.
+const dateMinMaxStep = function (dmin, dmax, minSteps) {
+  let start = new Date(dmin)
+  start.setUTCHours(0, 0, 0, 0)
+  // Switch to next day and truncate
+  let stop = new Date(dmax + 1000 * 60 * 60 * 24)
+  stop.setUTCHours(23, 59, 59, 0)
+  // Range in days
+  let range = (stop - start) / (1000 * 60 * 60 * 24)
+  let step = '%Y-%m-%d'
+  if (range > minSteps * 365) {
+    step = '%Y'
+  } else if (range > minSteps * 30) {
+    step = '%Y-%m'
+  }
+
+  // Adjust min max so that they fall on an integer number of month/year
+  if (step === '%Y-%m-%d') {
+    // Min max already OK
+  } else if (step === '%Y-%m') {
+    start.setUTCDate(1)
+    stop.setUTCMonth(stop.getUTCMonth() + 1, 0)
+  } else if (step === '%Y') {
+    start.setUTCDate(1)
+    start.setUTCMonth(0)
+    stop.setUTCFullYear(stop.getUTCFullYear(), 11, 31)
+  }
+  if (dmin === dmax) stop = start
+
+  return {
+    min: start,
+    max: stop,
+    step: step
+  }
+}
+
+// Return the number histogram min, max and step for a number field whose
+// values range from dmin to dmax, for nbCol bins.
+const numberMinMaxStep = function (dmin, dmax, nbCol) {
+  let step = 1
+  if (dmin === dmax) {
+    if (dmin === null) dmin = undefined
+    if (dmax === null) dmax = undefined
+  } else {
+    step = (dmax - dmin) / nbCol
+  }
+
+  return {
+    min: dmin,
+    max: dmax,
+    step: step
+  }
+}
+
+// Return the key identifying the set of subfeatures selected in a healpix
+// pixel, from the comma-separated list of their rowid.
+const healpixSubsetKey = function (healpixIndex, ids) {
+  ids = ids.split(',').map(i => parseInt(i)).sort((a, b) => a - b)
+  return healpixIndex + ':' + qcUtils.sha1(ids.join(','))
+}
+
+// SQL expression of the date bin of a date field (in ms) for a STRFTIME step.
+// Dates are stored as INT so divide by 1000.0: an integer division would
+// truncate instead of rounding to the closest second.
+export const sqlDateBin = function (fid, step) {
+  return 'STRFTIME(\'' + step + '\', ROUND(' + fid + ' / 1000.0), \'unixepoch\')'
+}
+
 export default class QueryEngine {
   // Private attributes
   #fieldsList = undefined
   #fieldsMap = undefined
   #db = undefined
+  // Union areas per healpix pixel, keyed by the pixel index and the exact set
+  // of subfeatures selected in it (see healpixSubsetKey). Queries which only
+  // differ by constraints not changing the selection inside a pixel reuse
+  // the area computed for this pixel.
+  #healpixAreaCache = new LRUCache(500000)
+  // Columnar copy of the features table, loaded on first use
+  #columnar = undefined
+  // Whether the DB contains the coverage and healpix_areas tables. They are
+  // missing in DBs generated by previous versions of the server.
+  #hasCoverageIndex = false
+  #hasHealpixAreas = false
   dbFileName = undefined
   smtConfig = undefined
 
@@ -271,9 +354,18 @@ export default class QueryEngine {
       }
     })
 
+    const hasTable = name => db.prepare('SELECT name FROM sqlite_master WHERE type = \'table\' AND name = ?').get(name) !== undefined
+    that.#hasCoverageIndex = hasTable('coverage')
+    that.#hasHealpixAreas = hasTable('healpix_areas') &&
+        db.prepare('SELECT COUNT(*) as c FROM healpix_areas').get().c > 0
+
     that.#db = db
   }
 
+  close () {
+    this.#db.close()
+  }
+
   queryAsync (...parameters) {
     return QueryEngine.pool.exec('query', [this.dbFileName].concat(parameters))
   }
@@ -365,7 +457,7 @@ export default class QueryEngine {
         'month': '%Y-%m',
         'day': '%Y-%m-%d'
       }[groupingOptions[0].step]
-      return 'GROUP BY STRFTIME(\'' + step + '\', ROUND(' + fid + '/1000), \'unixepoch\')'
+      return 'GROUP BY ' + sqlDateBin(fid, step)
     } else {
       throw new Error('Unsupported grouping operation: ' + groupingOptions[0].operation)
     }
@@ -379,38 +471,7 @@ export default class QueryEngine {
     const req = 'SELECT MIN(' + fid + ') AS dmin, MAX(' + fid + ') AS dmax FROM features ' + wc
     const res = this.#db.prepare(req).get()
     postProcessSQLiteResult(res)
-    let start = new Date(res.dmin)
-    start.setUTCHours(0, 0, 0, 0)
-    // Switch to next day and truncate
-    let stop = new Date(res.dmax + 1000 * 60 * 60 * 24)
-    stop.setUTCHours(23, 59, 59, 0)
-    // Range in days
-    let range = (stop - start) / (1000 * 60 * 60 * 24)
-    let step = '%Y-%m-%d'
-    if (range > minSteps * 365) {
-      step = '%Y'
-    } else if (range > minSteps * 30) {
-      step = '%Y-%m'
-    }
-
-    // Adjust min max so that they fall on an integer number of month/year
-    if (step === '%Y-%m-%d') {
-      // Min max already OK
-    } else if (step === '%Y-%m') {
-      start.setUTCDate(1)
-      stop.setUTCMonth(stop.getUTCMonth() + 1, 0)
-    } else if (step === '%Y') {
-      start.setUTCDate(1)
-      start.setUTCMonth(0)
-      stop.setUTCFullYear(stop.getUTCFullYear(), 11, 31)
-    }
-    if (res.dmin === res.dmax) stop = start
-
-    return {
-      min: start,
-      max: stop,
-      step: step
-    }
+    return dateMinMaxStep(res.dmin, res.dmax, minSteps)
   }
 
   getNumberMinMaxStep (q, fieldId, nbCol) {
@@ -420,24 +481,29 @@ export default class QueryEngine {
     const req = 'SELECT MIN(' + fid + ') AS dmin, MAX(' + fid + ') AS dmax FROM features ' + wc
     const res = this.#db.prepare(req).get()
     postProcessSQLiteResult(res)
-    let step = 1
-    if (res.dmin === res.dmax) {
-      if (res.dmin === null) res.dmin = undefined
-      if (res.dmax === null) res.dmax = undefined
-    } else {
-      step = (res.dmax - res.dmin) / nbCol
-    }
+    return numberMinMaxStep(res.dmin, res.dmax, nbCol)
+  }
 
-    return {
-      min: res.dmin,
-      max: res.dmax,
-      step: step
+  // Try to run the query on the in-memory columnar copy of the features.
+  // Return the raw aggregation result line, or undefined if the query is not
+  // supported by the columnar engine.
+  queryColumnar (q) {
+    if (!this.#columnar) {
+      if (!q.aggregationOptions) return undefined
+      const fields = this.#fieldsList.map(f => ({ sqlId: fId2SqlId(f.id), type: f.type }))
+      this.#columnar = new ColumnarTable(this.#db, fields)
     }
+    const table = this.#columnar
+    if (!table.canRunAggregations(q, fId2SqlId)) return undefined
+    const bits = table.filter(q.constraints, fId2SqlId)
+    if (!bits) return undefined
+    return table.aggregate(q, bits, fId2SqlId, dateMinMaxStep, numberMinMaxStep)
   }
 
   // Query the engine
   query (q) {
     let that = this
+    const columnarLine = this.queryColumnar(q)
     let whereClause = this.constraints2SQLWhereClause(q.constraints)
 
     if (q.limit && Number.isInteger(q.limit)) {
@@ -455,7 +521,7 @@ export default class QueryEngine {
 
     let fromClause = ' FROM features'
 
-    if (q.aggregationOptions) {
+    if (q.aggregationOptions && !columnarLine) {
       assert(!q.projectOptions)
 
       whereClause += ' ' + this.groupingOptions2SQLGroupByClause(q.groupingOptions)
@@ -484,7 +550,7 @@ export default class QueryEngine {
         } else if (agOpt.operation === 'DATE_HISTOGRAM') {
           const res = that.getDateMinMaxStep(q, agOpt.fieldId, 3)
           const fid = fId2SqlId(agOpt.fieldId)
-          selectClause.push('VALUES_AND_COUNT(' + 'STRFTIME(\'' + res.step + '\', ROUND(' + fid + '/1000), \'unixepoch\')' + ', 200) AS ' + agOpt.out)
+          selectClause.push('VALUES_AND_COUNT(' + sqlDateBin(fid, res.step) + ', 200) AS ' + agOpt.out)
           res.table = [['Date', 'Count']]
           agOpt.postProcessData = res
         } else if (agOpt.operation === 'NUMBER_HISTOGRAM') {
@@ -570,7 +636,9 @@ export default class QueryEngine {
     }
 
     let res = [{}]
-    if (selectClause.length) {
+    if (columnarLine) {
+      res = [columnarLine]
+    } else if (selectClause.length) {
       const sqlStatement = 'SELECT ' + selectClause.join(', ') + ' ' + fromClause + whereClause
       res = that.#db.prepare(sqlStatement).all()
     }
@@ -583,11 +651,14 @@ export default class QueryEngine {
   }
 
   getHipsProperties () {
-    return `hips_tile_format = geojson\nhips_order = 2\nhips_order_min = 1` +
+    // Clients supporting the binary format will use it instead of geojson
+    return `hips_tile_format = geobin geojson\nhips_order = 2\nhips_order_min = 1` +
         '\nhips_tile_width = 400\nobs_title = SMT Geojson'
   }
 
-  getHipsTile (q, order, tileId) {
+  // Return the tile as a geojson object, or for the 'geobin' format as a
+  // base64 encoded binary tile (see binary-tile.mjs).
+  getHipsTile (q, order, tileId, format) {
     const that = this
     // Can be 0: lowest details, only plain healpix tiles shapes
     //        1: medium details, the union of all footprints per tile
@@ -648,14 +719,119 @@ export default class QueryEngine {
       delete feature.properties.c
       geojson.features.push(feature)
     }
-    return geojson.features.length ? geojson : undefined
+    if (!geojson.features.length) return undefined
+    if (format === 'geobin') return encodeBinaryTile(geojson.features).toString('base64')
+    return geojson
+  }
+
+  // Return the list of healpix pixels containing subfeatures matching the
+  // given WHERE clause, with the cache key of the selected subset.
+  getHealpixSubsets (whereClause, keyPrefix) {
+    const sqlStatement = 'SELECT healpix_index, GROUP_CONCAT(rowid) as ids FROM subfeatures ' + whereClause + ' GROUP BY healpix_index'
+    return this.#db.prepare(sqlStatement).all().map(line => ({
+      healpixIndex: line.healpix_index,
+      key: keyPrefix + healpixSubsetKey(line.healpix_index, line.ids)
+    }))
+  }
+
+  // Run the per-healpix aggregation sqlAggregate only for the pixels whose
+  // result is not already in cache, and return the results for all pixels
+  // as a list of { healpixIndex, v } objects.
+  // Pixels for which skipPixel(healpixIndex) returns true are ignored.
+  runHealpixAggregateCached (whereClause, sqlAggregate, keyPrefix, postProcess, skipPixel) {
+    const cache = this.#healpixAreaCache
+    const subsets = this.getHealpixSubsets(whereClause, keyPrefix)
+    const missing = {}
+    const res = []
+    for (const subset of subsets) {
+      if (skipPixel && skipPixel(subset.healpixIndex)) continue
+      const v = cache.get(subset.key)
+      if (v === undefined) missing[subset.healpixIndex] = subset.key
+      else res.push({ healpixIndex: subset.healpixIndex, v: v })
+    }
+    const missingPix = Object.keys(missing)
+    if (missingPix.length) {
+      const wc = (whereClause === '' ? ' WHERE ' : whereClause + ' AND ') + 'healpix_index IN (' + missingPix.join(', ') + ')'
+      const sqlStatement = 'SELECT healpix_index, ' + sqlAggregate + ' as v FROM subfeatures ' + wc + ' GROUP BY healpix_index'
+      for (const line of this.#db.prepare(sqlStatement).all()) {
+        const v = postProcess ? postProcess(line.v) : line.v
+        cache.set(missing[line.healpix_index], v)
+        res.push({ healpixIndex: line.healpix_index, v: v })
+      }
+    }
+    return res
+  }
+
+  // Return the cells of the coverage index fully covered by at least one of
+  // the features matching the given WHERE clause, in MOC normal form.
+  getFullyCoveredCells (whereClause) {
+    if (!this.#hasCoverageIndex) return []
+    let sqlStatement = 'SELECT DISTINCT healpix_order, healpix_index FROM coverage'
+    if (whereClause !== '') sqlStatement += ' WHERE id IN (SELECT rowid FROM features ' + whereClause + ')'
+    const cells = this.#db.prepare(sqlStatement).all()
+    // Cells of different features can overlap: remove the ones already
+    // contained in a larger cell.
+    const cellsSet = new Set(cells.map(c => c.healpix_order + '_' + c.healpix_index))
+    const hasParentCell = function (order, pix) {
+      for (let o = order - 1; o >= 0; --o) {
+        pix = Math.floor(pix / 4)
+        if (cellsSet.has(o + '_' + pix)) return true
+      }
+      return false
+    }
+    return cells.filter(c => !hasParentCell(c.healpix_order, c.healpix_index)).map(c => [c.healpix_order, c.healpix_index])
+  }
+
+  // Compute the union area of the features matching the given WHERE clause,
+  // returned as a list of [order, pix, area] cells.
+  // Cells fully covered by a feature are returned directly from the coverage
+  // index, geometric unions are only computed for the other order
+  // HEALPIX_ORDER pixels.
+  // If pix0 is set, only the cells inside this order 0 pixel are returned.
+  computeHealpixUnionAreas (whereClause, pix0) {
+    const inCell0 = function (order, pix) {
+      return pix0 === undefined || Math.floor(pix / Math.pow(4, order)) === pix0
+    }
+    const fullCells = this.getFullyCoveredCells(whereClause).filter(c => inCell0(c[0], c[1]))
+    const fullCellsSet = new Set(fullCells.map(c => c[0] + '_' + c[1]))
+    const skipPixel = function (pix) {
+      if (!inCell0(HEALPIX_ORDER, pix)) return true
+      for (let o = HEALPIX_ORDER; o >= 0; --o) {
+        if (fullCellsSet.has(o + '_' + pix)) return true
+        pix = Math.floor(pix / 4)
+      }
+      return false
+    }
+    const res = fullCells.map(c => [c[0], c[1], geo_utils.getHealpixCellTurfArea(c[0], c[1], HEALPIX_ORDER)])
+    const unions = this.runHealpixAggregateCached(whereClause,
+        'GEO_UNION_AREA_ON_HEALPIX(healpix_index, geometry_rot, area)', 'area:',
+        undefined, (fullCells.length || pix0 !== undefined) ? skipPixel : undefined)
+    for (const u of unions) res.push([HEALPIX_ORDER, u.healpixIndex, u.v])
+    return res
+  }
+
+  // Compute the union area of all features inside an order 0 healpix cell,
+  // or null if no feature intersects it.
+  // Used to fill the healpix_areas table at ingestion time, one call per
+  // cell so that they can run in parallel in the workers.
+  computeHealpixCellArea (pix0) {
+    const cells = this.computeHealpixUnionAreas('', pix0)
+    if (!cells.length) return null
+    return cells.reduce((acc, c) => acc + c[2], 0)
   }
 
   computeArea (q) {
     let whereClause = this.constraints2SQLWhereClause(q.constraints)
-    let sqlStatement = 'SELECT SUM(area) as area FROM (SELECT GEO_UNION_AREA_ON_HEALPIX(healpix_index, geometry_rot, area) as area FROM subfeatures ' + whereClause + ' GROUP BY healpix_index)'
-    let res = this.#db.prepare(sqlStatement).get()
-    return res.area
+    let res
+    if (whereClause === '' && this.#hasHealpixAreas) {
+      // Use the precomputed areas of the unconstrained dataset
+      res = this.#db.prepare('SELECT area FROM healpix_areas WHERE healpix_order = 0').all().map(l => l.area)
+    } else {
+      res = this.computeHealpixUnionAreas(whereClause).map(c => c[2])
+    }
+    // Same as SQL SUM: null when there is no matching pixel
+    if (!res.length) return null
+    return res.reduce((acc, a) => acc + a, 0)
   }
 
   computeAreaCumulatedDateHistogram (q, agOpt) {
@@ -672,11 +848,13 @@ export default class QueryEngine {
       'month': '%Y-%m',
       'day': '%Y-%m-%d'
     }[agOpt.step]
-    const binFunc = 'STRFTIME(\'' + step + '\', ROUND(' + dateFid + '/1000), \'unixepoch\')'
-    let sqlStatement = 'SELECT GEO_UNION_AREA_ON_HEALPIX_CUMULATED_HISTOGRAM(healpix_index, geometry_rot, area, ' + binFunc + ') as areaHisto FROM subfeatures ' + whereClause + ' GROUP BY healpix_index'
-    let res = this.#db.prepare(sqlStatement).all()
+    const binFunc = sqlDateBin(dateFid, step)
+    // The bins of a given subset of subfeatures only depend on the date field
+    // and the step, so they are part of the cache key.
+    let res = this.runHealpixAggregateCached(whereClause,
+        'GEO_UNION_AREA_ON_HEALPIX_CUMULATED_HISTOGRAM(healpix_index, geometry_rot, area, ' + binFunc + ')',
+        'histo:' + dateFid + ':' + step + ':', v => JSON.parse(v.substring(6))).map(e => e.v)
     // Combine the cumulated histograms of all healpix pixels
-    res = res.map(line => JSON.parse(line.areaHisto.substring(6)))
     let allKeys = new Set()
     res.forEach(line => Object.keys(line).forEach(k => allKeys.add(k)))
     allKeys = Array.from(allKeys)
@@ -738,6 +916,17 @@ export default class QueryEngine {
     db.prepare('CREATE INDEX idxsub_geogroup_id ON subfeatures(geogroup_id)').run()
     db.prepare('CREATE INDEX idxsub_healpix_index ON subfeatures(healpix_index)').run()
 
+    // Multi-order coverage index: for each feature, the healpix cells of
+    // orders 0 to HEALPIX_ORDER fully covered by its footprint, in MOC normal
+    // form. The partially covered cells are the ones of the subfeatures.
+    db.prepare('CREATE TABLE coverage (id INT, healpix_order INT, healpix_index INT)').run()
+    db.prepare('CREATE INDEX idxcov_id ON coverage(id)').run()
+
+    // Union area of all the features per order 0 healpix cell (only
+    // healpix_order = 0 rows). Filled once all the data is ingested.
+    db.prepare('CREATE TABLE healpix_areas (healpix_order INT, healpix_index INT, area REAL)').run()
+    db.prepare('CREATE INDEX idxareas_order ON healpix_areas(healpix_order)').run()
+
     // Create an index on each field
     for (let i in sqlFields) {
       const field = sqlFields[i]
@@ -751,12 +940,24 @@ export default class QueryEngine {
     const pool = workerpool.pool('./worker.mjs')
     const allPromise = smtConfig.sources.map(url => pool.exec('ingestGeoJson', [dbFileName, dataDir + '/' + url]))
     return Promise.all(allPromise).then((logs) => {
-      pool.terminate()
-      const db2 = new Database(dbFileName)
-      // Add ingestion logs into the DB
-      extraInfo.ingestionLogs = logs
-      db2.prepare('UPDATE smt_meta_data SET extra_info = ?').run(JSON.stringify(extraInfo))
-      db2.close()
+      // Precompute the union areas of all features per order 0 healpix cell
+      console.log('Compute healpix areas')
+      const areaPromises = []
+      for (let pix = 0; pix < 12; ++pix) {
+        areaPromises.push(pool.exec('computeHealpixCellArea', [dbFileName, pix]))
+      }
+      return Promise.all(areaPromises).then((areas) => {
+        pool.terminate()
+        const db2 = new Database(dbFileName)
+        const insertArea = db2.prepare('INSERT INTO healpix_areas VALUES (0, ?, ?)')
+        db2.transaction(() => {
+          areas.forEach((area, pix) => { if (area !== null) insertArea.run(pix, area) })
+        })()
+        // Add ingestion logs into the DB
+        extraInfo.ingestionLogs = logs
+        db2.prepare('UPDATE smt_meta_data SET extra_info = ?').run(JSON.stringify(extraInfo))
+        db2.close()
+      })
     })
   }
 
@@ -825,6 +1026,7 @@ export default class QueryEngine {
         turf.truncate(feature, {precision: 6, coordinates: 2, mutate: true})
         const newSubs = geo_utils.splitOnHealpixGrid(feature, HEALPIX_ORDER)
         let area = 0
+        const fullPixels = []
         for (let j = 0; j < newSubs.length; ++j) {
           const subF = newSubs[j]
           assert(subF.geometry)
@@ -833,6 +1035,9 @@ export default class QueryEngine {
           geo_utils.rotateGeojsonFeature(subFrot, rotationMats.m)
           subF.area = geo_utils.featureArea(subFrot)
           area += subF.area
+          // Same criteria as the one used when computing unions
+          const maxArea = geo_utils.getHealpixTurfArea(HEALPIX_ORDER, subF.healpix_index) - AREA_TOLERANCE
+          if (subF.area >= maxArea) fullPixels.push(subF.healpix_index)
           turf.truncate(subF, {precision: 6, coordinates: 2, mutate: true})
           subF.geometry = '__JSON' + JSON.stringify(subF.geometry)
           turf.truncate(subFrot, {precision: 6, coordinates: 2, mutate: true})
@@ -855,17 +1060,19 @@ export default class QueryEngine {
         }
         _.assign(f, sqlValues)
 
-        allFeatures.push([f, newSubs])
+        allFeatures.push([f, newSubs, geo_utils.healpixPixelsToMoc(HEALPIX_ORDER, fullPixels)])
       })
 
       // Prepare SQL insertion commands
       const insertOne = db.prepare('INSERT INTO features VALUES (@geometry, @geogroup_id, @area, @geocap_x, @geocap_y, @geocap_z, @geocap_cosa, @properties, ' + sqlFields.map(f => '@' + f).join(',') + ')')
       const insertSub = db.prepare('INSERT INTO subfeatures VALUES (@id, @geometry, @geometry_rot, @healpix_index, @geogroup_id, @area, ' + sqlFields.map(f => '@' + f).join(',') + ')')
+      const insertCoverage = db.prepare('INSERT INTO coverage VALUES (?, ?, ?)')
       // Perform SQL transaction
       const insertMany = db.transaction(function (allF) {
         for (const i in allF) {
           const f = allF[i][0]
           const subFs = allF[i][1]
+          const coverageCells = allF[i][2]
           // Insert one feature and get the unique rowid to assign it to the
           // id field of the subfeatures
           let info
@@ -882,6 +1089,9 @@ export default class QueryEngine {
             subF.id = info.lastInsertRowid
             insertSub.run(subF)
           }
+          for (const cell of coverageCells) {
+            insertCoverage.run(info.lastInsertRowid, cell[0], cell[1])
+          }
         }
       })
       insertMany(allFeatures)
@@ -15,6 +15,7 @@ import fsp from 'fs/promises'
 import fs from 'fs'
 import _ from 'lodash'
 import QueryEngine from './query-engine.mjs'
+import { QueryCache } from './query-cache.mjs'
 import bodyParser from 'body-parser'
 import NodeGit from 'nodegit'
 import hash_sum from 'hash-sum'
@@ -134,7 +135,9 @@ for (let b of DATA_GIT_BRANCHES) {
     // Global storage of hash -> query for later lookup
     hashToQuery: {},
     // Logs of the last ingestion
-    ingestionLogs: ''
+    ingestionLogs: '',
+    // Cache of query and tile results for the current version of the data
+    queryCache: new QueryCache(__dirname + '/query-cache/' + b)
   }
 }
 
@@ -183,6 +186,7 @@ const reSyncDataForBranch = async function (branch) {
   if (!reloadGeojson) {
     console.log('Data was not changed, no need to reload DB')
     if (!branchData.qe) branchData.qe = new QueryEngine(branchData.dbFileName)
+    branchData.queryCache.setBaseHashKey(branchData.qe.extraInfo.baseHashKey)
     branchData.status = 'ready'
     return
   }
@@ -208,6 +212,7 @@ const reSyncDataForBranch = async function (branch) {
 
   // Initialize the read-only engine
   branchData.qe = new QueryEngine(branchData.dbFileName)
+  branchData.queryCache.setBaseHashKey(branchData.qe.extraInfo.baseHashKey)
   branchData.status = 'ready'
   console.log('Base hash key for branch ' + branch + ': ' + branchData.BASE_HASH_KEY)
   console.log('*** Data Sync for branch ' + branch + ' completed ***')
@@ -277,7 +282,9 @@ app.get('/api/v1/:branch/:serverHash/query', async (req, res) => {
   }
   const q = JSON.parse(decodeURIComponent(req.query.q))
   res.set('Cache-Control', 'public, max-age=31536000')
-  const queryResp = await branchData.qe.queryAsync(q)
+  const cache = branchData.queryCache
+  const queryResp = await cache.getOrCompute(cache.key('query', q),
+      () => branchData.qe.queryAsync(q))
   res.send(queryResp)
 })
 
@@ -312,7 +319,21 @@ app.get('/api/v1/:branch/hips/:queryHash/properties', (req, res) => {
   res.send(branchData.qe.getHipsProperties())
 })
 
-app.get('/api/v1/:branch/hips/:queryHash/:order(Norder\\d+)/:dir/:pix.geojson', async (req, res) => {
+// Send a tile returned by the query engine in the requested format
+const sendHipsTile = function (res, format, tileResp) {
+  if (!tileResp) {
+    res.status(404).send()
+    return
+  }
+  if (format === 'geobin') {
+    res.type('application/octet-stream')
+    res.send(Buffer.from(tileResp, 'base64'))
+    return
+  }
+  res.send(tileResp)
+}
+
+app.get('/api/v1/:branch/hips/:queryHash/:order(Norder\\d+)/:dir/:pix.:format(geojson|geobin)', async (req, res) => {
   const branchData = BRANCH_DATA[req.params.branch]
   if (!branchData) {
     res.status(404).send()
@@ -326,15 +347,14 @@ app.get('/api/v1/:branch/hips/:queryHash/:order(Norder\\d+)/:dir/:pix.geojson',
     res.status(404).send()
     return
   }
-  const tileResp = await branchData.qe.getHipsTileAsync(q, order, pix)
-  if (!tileResp) {
-    res.status(404).send()
-    return
-  }
-  res.send(tileResp)
+  const cache = branchData.queryCache
+  const format = req.params.format
+  const tileResp = await cache.getOrCompute(cache.key('tile', q, order, pix, format),
+      () => branchData.qe.getHipsTileAsync(q, order, pix, format))
+  sendHipsTile(res, format, tileResp)
 })
 
-app.get('/api/v1/:branch/hips/:queryHash/Allsky.geojson', async (req, res) => {
+app.get('/api/v1/:branch/hips/:queryHash/Allsky.:format(geojson|geobin)', async (req, res) => {
   const branchData = BRANCH_DATA[req.params.branch]
   if (!branchData) {
     res.status(404).send()
@@ -346,11 +366,10 @@ app.get('/api/v1/:branch/hips/:queryHash/Allsky.geojson', async (req, res) => {
     res.status(404).send()
     return
   }
-  const tileResp = await branchData.qe.getHipsTileAsync(q, -1, 0)
-  if (!tileResp) {
-    res.status(404).send()
-    return
-  }
-  res.send(tileResp)
+  const cache = branchData.queryCache
+  const format = req.params.format
+  const tileResp = await cache.getOrCompute(cache.key('tile', q, -1, 0, format),
+      () => branchData.qe.getHipsTileAsync(q, -1, 0, format))
+  sendHipsTile(res, format, tileResp)
 })
 
@@ -10,8 +10,12 @@
 // funding from the Centre national d'études spatiales (CNES).
 
 
-import QueryEngine from './query-engine.mjs'
+import assert from 'assert'
+import Database from 'better-sqlite3'
+import QueryEngine, { sqlDateBin } from './query-engine.mjs'
+import { formatDateBin } from './columnar-engine.mjs'
 import geo_utils from './geojson-utils.mjs'
+import { encodeBinaryTile } from './binary-tile.mjs'
 
 // Allow to catch CTRL+C when runnning inside a docker
 process.on('SIGINT', () => {
@@ -19,6 +23,43 @@ process.on('SIGINT', () => {
   process.exit(0)
 })
 
+// A line with more vertices than the 16 bits indices allow must be split
+// into several features with the same properties.
+{
+  const coords = []
+  for (let i = 0; i < 70000; i++) coords.push([i / 1000, 0])
+  const tile = encodeBinaryTile([
+    { geometry: { type: 'LineString', coordinates: coords }, properties: { id: 1 } },
+    { geometry: { type: 'Point', coordinates: [0, 0] }, properties: { id: 2 } }
+  ])
+  const nbFeatures = tile.readUInt32LE(12)
+  assert.strictEqual(nbFeatures, 3)
+  const counts = []
+  for (let i = 0; i < nbFeatures; i++) {
+    counts.push([0, 1, 2, 3].map(j => tile.readUInt32LE(32 + i * 16 + j * 4)))
+  }
+  assert.deepStrictEqual(counts, [[65536, 0, 65535 * 2, 0], [4465, 0, 4464 * 2, 0], [1, 0, 0, 1]])
+  const props = tile.toString('utf-8', tile.length - tile.readUInt32LE(24), tile.length - 1)
+  assert.deepStrictEqual(JSON.parse(props).properties.id, [1, 1, 2])
+}
+
+// The columnar engine must put dates in the same bins as SQL, including
+// fractional seconds >= .5 that round to the next day or year.
+{
+  const db = new Database(':memory:')
+  db.exec('CREATE TABLE features (date INT)')
+  const dates = [0, 499, 500, 86399499, 86399500, 1609459199500, -1500, -500]
+  const insert = db.prepare('INSERT INTO features VALUES (?)')
+  for (const d of dates) insert.run(d)
+  for (const step of ['%Y', '%Y-%m', '%Y-%m-%d']) {
+    const sql = db.prepare('SELECT ' + sqlDateBin('date', step) + ' AS bin FROM features ORDER BY rowid')
+    const sqlBins = sql.all().map(r => r.bin)
+    assert.deepStrictEqual(dates.map(d => formatDateBin(d, step)), sqlBins)
+  }
+  assert.strictEqual(formatDateBin(1609459199500, '%Y'), '2021')
+  db.close()
+}
+
 const __dirname = process.cwd()
 const dbFileName = __dirname + '/qe.db'
 
@@ -26,4 +26,5 @@ workerpool.worker({
   ingestGeoJson: function (...params) { return QueryEngine.ingestGeoJson(...params) },
   query: function (...params) { lasyInit(params.shift()); return qe.query(...params) },
   getHipsTile: function (...params) { lasyInit(params.shift()); return qe.getHipsTile(...params) },
+  computeHealpixCellArea: function (...params) { lasyInit(params.shift()); return qe.computeHealpixCellArea(...params) },
 })
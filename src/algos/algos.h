@@ -68,6 +68,60 @@ void healpix_get_boundaries(int nside, int pix, double out[4][3]);
  */
 void healpix_get_bounding_cap(int nside, int pix, double out[4]);
 
+/*
+ * Function: healpix_get_geometry
+ * Return the bounding cap and the four corners of a healpix nest pixel
+ *
+ * Same as healpix_get_bounding_cap and healpix_get_boundaries, but the
+ * values are precomputed for the low orders.
+ *
+ * Parameters:
+ *   order      - Healpix order.
+ *   pix        - Healpix nest index.
+ *   cap        - Output bounding cap, or NULL.
+ *   corners    - Output corners unit vectors, or NULL.
+ */
+void healpix_get_geometry(int order, int pix, double cap[4],
+                          double corners[4][3]);
+
+/*
+ * Function: healpix_query_disc
+ * Return all the pixels of a given order that intersect a cap.
+ *
+ * The test is done on the pixels bounding caps, so a few pixels outside
+ * of the cap can also be returned.
+ *
+ * Parameters:
+ *   order  - Healpix order of the returned pixels.
+ *   cap    - The cap to test.
+ *   out    - Allocated array of the pixels nest index, sorted.  To be
+ *            released by the caller.
+ *
+ * Return:
+ *   The number of pixels.
+ */
+int healpix_query_disc(int order, const double cap[4], int **out);
+
+/*
+ * Function: healpix_query_polygon
+ * Return all the pixels of a given order that intersect a convex polygon.
+ *
+ * Like for <healpix_query_disc>, the result can contains a few pixels
+ * outside of the polygon.
+ *
+ * Parameters:
+ *   order  - Healpix order of the returned pixels.
+ *   n      - Number of vertices of the polygon.
+ *   verts  - The polygon vertices, in counter clockwise order.
+ *   out    - Allocated array of the pixels nest index, sorted.  To be
+ *            released by the caller.
+ *
+ * Return:
+ *   The number of pixels.
+ */
+int healpix_query_polygon(int order, int n, const double (*verts)[3],
+                          int **out);
+
 /* Compute moon position.
  *
  * inputs:
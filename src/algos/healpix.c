@@ -9,8 +9,12 @@
 
 #include <assert.h>
 #include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
 #include "utils/vec.h"
 
+#include "tests.h"
+
 // Some of the code comes from the official healpix C implementation.
 
 /*
@@ -332,3 +336,163 @@ void healpix_get_bounding_cap(int nside, int pix, double out[4])
             out[3] = d;
     }
 }
+
+/*
+ * Precomputed geometry of all the pixels of the low orders, since we use
+ * them for clipping tests at every frame.  The tables are allocated the
+ * first time an order is used.  Each pixel takes 16 doubles (the bounding
+ * cap then the four corners), so we limit ourself to order 5 (~1.5MB).
+ */
+#define GEOM_MAX_ORDER 5
+#define GEOM_SIZE 16
+
+static double *g_geoms[GEOM_MAX_ORDER + 1];
+
+static void compute_geometry(int order, int pix, double out[GEOM_SIZE])
+{
+    int nside = 1 << order, ix, iy, face, i;
+    double *cap = out, (*corners)[3] = (void*)(out + 4), d;
+
+    healpix_nest2xyf(nside, pix, &ix, &iy, &face);
+    vec4_set(cap, 0, 0, 0, 1);
+    for (i = 0; i < 4; i++) {
+        healpix_xyf2vec(nside, ix + (i % 2), iy + (i / 2), face, corners[i]);
+        vec3_add(cap, corners[i], cap);
+    }
+    vec3_normalize(cap, cap);
+    for (i = 0; i < 4; i++) {
+        d = vec3_dot(cap, corners[i]);
+        if (d < cap[3])
+            cap[3] = d;
+    }
+}
+
+static const double *get_geometry(int order, int pix, double tmp[GEOM_SIZE])
+{
+    int i, nb;
+    if (order > GEOM_MAX_ORDER) {
+        compute_geometry(order, pix, tmp);
+        return tmp;
+    }
+    if (!g_geoms[order]) {
+        nb = 12 * (1 << (2 * order));
+        g_geoms[order] = malloc(nb * GEOM_SIZE * sizeof(double));
+        for (i = 0; i < nb; i++)
+            compute_geometry(order, i, g_geoms[order] + i * GEOM_SIZE);
+    }
+    return g_geoms[order] + pix * GEOM_SIZE;
+}
+
+void healpix_get_geometry(int order, int pix, double cap[4],
+                          double corners[4][3])
+{
+    double tmp[GEOM_SIZE];
+    const double *geom = get_geometry(order, pix, tmp);
+    int i;
+    if (cap) vec4_copy(geom, cap);
+    if (corners) {
+        for (i = 0; i < 4; i++) vec3_copy(geom + 4 + i * 3, corners[i]);
+    }
+}
+
+/*
+ * Iterate all the pixels of a given order whose bounding caps intersect
+ * all the given caps, starting from order zero and only going down into
+ * the pixels that pass the test.
+ */
+static int query_caps(int order, int nb_caps, const double (*caps)[4],
+                      int **out)
+{
+    int stack[64 * 4], stack_order[64 * 4], nb = 0, size = 0, allocated = 0;
+    int i, o, pix;
+    double tmp[GEOM_SIZE];
+    const double *geom;
+
+    assert(order >= 0 && order < 30);
+    *out = NULL;
+    for (pix = 11; pix >= 0; pix--) {
+        stack[nb] = pix;
+        stack_order[nb++] = 0;
+    }
+    while (nb) {
+        nb--;
+        pix = stack[nb];
+        o = stack_order[nb];
+        geom = get_geometry(o, pix, tmp);
+        for (i = 0; i < nb_caps; i++) {
+            if (!cap_intersects_cap(caps[i], geom)) break;
+        }
+        if (i < nb_caps) continue;
+        if (o == order) {
+            if (size >= allocated) {
+                allocated = allocated ? allocated * 2 : 64;
+                *out = realloc(*out, allocated * sizeof(**out));
+            }
+            (*out)[size++] = pix;
+            continue;
+        }
+        // Push the children in reverse order, so that the results are
+        // sorted.
+        for (i = 3; i >= 0; i--) {
+            stack[nb] = pix * 4 + i;
+            stack_order[nb++] = o + 1;
+        }
+    }
+    return size;
+}
+
+int healpix_query_disc(int order, const double cap[4], int **out)
+{
+    return query_caps(order, 1, (const double (*)[4])cap, out);
+}
+
+int healpix_query_polygon(int order, int n, const double (*verts)[3],
+                          int **out)
+{
+    double (*caps)[4] = malloc(n * sizeof(*caps));
+    int i, ret;
+    // The polygon is the intersection of the half spheres on the left of
+    // each edge.
+    for (i = 0; i < n; i++) {
+        vec3_cross(verts[i], verts[(i + 1) % n], caps[i]);
+        vec3_normalize(caps[i], caps[i]);
+        caps[i][3] = 0.0;
+    }
+    ret = query_caps(order, n, caps, out);
+    free(caps);
+    return ret;
+}
+
+#if COMPILE_TESTS
+
+static void test_healpix_query(void)
+{
+    const double cap[4] = {1, 0, 0, cos(10 * M_PI / 180)};
+    const double poly[4][3] = {
+        {1, -0.1, -0.1}, {1, 0.1, -0.1}, {1, 0.1, 0.1}, {1, -0.1, 0.1}};
+    double pix_cap[4];
+    int *pixs, nb, i, j, order = 6;
+
+    // Compare with a brute force search.
+    nb = healpix_query_disc(order, cap, &pixs);
+    for (i = 0, j = 0; i < 12 * (1 << (2 * order)); i++) {
+        healpix_get_bounding_cap(1 << order, i, pix_cap);
+        if (!cap_intersects_cap(cap, pix_cap)) continue;
+        assert(j < nb && pixs[j] == i);
+        j++;
+    }
+    assert(j == nb && nb > 0);
+    free(pixs);
+
+    nb = healpix_query_polygon(order, 4, poly, &pixs);
+    assert(nb > 0);
+    for (i = 0; i < nb; i++) {
+        healpix_get_bounding_cap(1 << order, pixs[i], pix_cap);
+        assert(cap_intersects_cap(cap, pix_cap));
+    }
+    free(pixs);
+}
+
+TEST_REGISTER(NULL, test_healpix_query, TEST_AUTO);
+
+#endif
@@ -279,6 +279,7 @@ void asset_set_hook(void *user,
 }
 
 
+#include "assets/bench.inl"
 #include "assets/font.inl"
 #include "assets/planets.ini.inl"
 #include "assets/shaders.inl"
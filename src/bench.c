@@ -0,0 +1,314 @@
+/* Stellarium Web Engine - Copyright (c) 2021 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+#include "bench.h"
+#include "swe.h"
+
+#include <time.h>
+
+#define MAX_MODULES 64
+
+// Modules faster than that (ms per frame) are not checked for regressions,
+// since their timings are mostly noise.
+#define MODULE_MIN_MS 0.05
+
+typedef struct {
+    const obj_t *module;
+    double      start;
+    double      total;
+} module_timing_t;
+
+static struct {
+    bool            running;
+    json_value      *script;
+    json_value      *baseline;
+    int             frame;      // Measured frame index, negative on warmup.
+    int             nb_frames;
+    double          dt;
+    double          tolerance;
+    double          time;       // Fixed unix time.
+    double          frame_start;
+    double          *frames_ms;
+    int             nb_modules;
+    module_timing_t modules[MAX_MODULES];
+    cache_stats_t   cache_start;
+    char            *result;
+} g_bench = {};
+
+static double now_ms(void)
+{
+#ifdef __EMSCRIPTEN__
+    return emscripten_get_now();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+#endif
+}
+
+static void apply_step(const json_value *step)
+{
+    const json_value *set;
+    json_value *attrs;
+    double duration, utc, fov, azalt[2], pos[3];
+    char *str;
+
+    duration = json_get_attr_f(step, "duration", 0);
+    utc = json_get_attr_f(step, "utc", NAN);
+    if (!isnan(utc)) core_set_time(utc, duration);
+    if (json_parse_vector(json_get_attr(step, "lookat", 0), 2, azalt) == 0) {
+        eraS2c(azalt[0] * DD2R, azalt[1] * DD2R, pos);
+        core_lookat(pos, duration);
+    }
+    fov = json_get_attr_f(step, "zoom", NAN);
+    if (!isnan(fov)) core_zoomto(fov * DD2R, duration);
+    set = json_get_attr(step, "set", json_object);
+    if (set) {
+        // Serialize a copy, since json-builder would output the whole
+        // document for a non root value.
+        attrs = json_copy(set);
+        str = calloc(1, json_measure(attrs));
+        json_serialize(str, attrs);
+        obj_set_attrs_json(&core->obj, str, NULL);
+        json_builder_free(attrs);
+        free(str);
+    }
+}
+
+static module_timing_t *get_module_timing(const obj_t *module)
+{
+    int i;
+    for (i = 0; i < g_bench.nb_modules; i++) {
+        if (g_bench.modules[i].module == module) return &g_bench.modules[i];
+    }
+    if (g_bench.nb_modules >= MAX_MODULES) return NULL;
+    g_bench.modules[i].module = module;
+    return &g_bench.modules[g_bench.nb_modules++];
+}
+
+static void stop(void)
+{
+    g_bench.running = false;
+    sys_set_fixed_time(0);
+    json_builder_free(g_bench.script);
+    json_builder_free(g_bench.baseline);
+    g_bench.script = NULL;
+    g_bench.baseline = NULL;
+    free(g_bench.frames_ms);
+    g_bench.frames_ms = NULL;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int bench_start(const char *script, const char *baseline)
+{
+    json_settings settings = {.value_extra = json_builder_extra};
+    const json_value *setup;
+    const char *data;
+    char url[256];
+    int code;
+
+    if (g_bench.running) stop();
+    free(g_bench.result);
+    g_bench.result = NULL;
+
+    // Script name: load it from the embedded assets.
+    if (script[0] != '{') {
+        snprintf(url, sizeof(url), "asset://bench/%s.json", script);
+        data = asset_get_data(url, NULL, &code);
+        if (!data) {
+            LOG_E("Cannot find benchmark %s", script);
+            return -1;
+        }
+        script = data;
+    }
+    g_bench.script = json_parse_ex(&settings, script, strlen(script), NULL);
+    if (!g_bench.script || g_bench.script->type != json_object) {
+        LOG_E("Cannot parse benchmark script");
+        json_builder_free(g_bench.script);
+        g_bench.script = NULL;
+        return -1;
+    }
+    if (baseline) {
+        g_bench.baseline = json_parse_ex(&settings, baseline,
+                                         strlen(baseline), NULL);
+        if (!g_bench.baseline) LOG_W("Cannot parse benchmark baseline");
+    }
+
+    g_bench.frame = -json_get_attr_i(g_bench.script, "warmup", 0);
+    g_bench.nb_frames = max(json_get_attr_i(g_bench.script, "frames", 100), 1);
+    g_bench.dt = json_get_attr_f(g_bench.script, "dt", 1.0 / 60);
+    g_bench.tolerance = json_get_attr_f(g_bench.script, "tolerance", 0.1);
+    g_bench.frames_ms = calloc(g_bench.nb_frames, sizeof(*g_bench.frames_ms));
+    g_bench.nb_modules = 0;
+    memset(g_bench.modules, 0, sizeof(g_bench.modules));
+
+    g_bench.time = sys_get_unix_time();
+    sys_set_fixed_time(g_bench.time);
+    setup = json_get_attr(g_bench.script, "setup", json_object);
+    if (setup) apply_step(setup);
+    g_bench.running = true;
+    return 0;
+}
+
+EMSCRIPTEN_KEEPALIVE
+bool bench_is_running(void)
+{
+    return g_bench.running;
+}
+
+EMSCRIPTEN_KEEPALIVE
+const char *bench_get_result(void)
+{
+    return g_bench.result;
+}
+
+void bench_update(void)
+{
+    const json_value *steps, *step;
+    int i;
+
+    if (!g_bench.running) return;
+    g_bench.time += g_bench.dt;
+    sys_set_fixed_time(g_bench.time);
+
+    if (g_bench.frame == 0) cache_get_stats(&g_bench.cache_start);
+    steps = json_get_attr(g_bench.script, "steps", json_array);
+    for (i = 0; steps && i < steps->u.array.length; i++) {
+        step = steps->u.array.values[i];
+        if (json_get_attr_i(step, "frame", -1) == g_bench.frame)
+            apply_step(step);
+    }
+    g_bench.frame_start = now_ms();
+}
+
+void bench_module_start(const obj_t *module)
+{
+    module_timing_t *timing;
+    if (!g_bench.running || g_bench.frame < 0) return;
+    timing = get_module_timing(module);
+    if (timing) timing->start = now_ms();
+}
+
+void bench_module_end(const obj_t *module)
+{
+    module_timing_t *timing;
+    if (!g_bench.running || g_bench.frame < 0) return;
+    timing = get_module_timing(module);
+    if (timing) timing->total += now_ms() - timing->start;
+}
+
+static int double_cmp(const void *a, const void *b)
+{
+    return cmp(*(double*)a, *(double*)b);
+}
+
+// Check a result value against the baseline, and add it to the list of
+// regressions if it is too slow.
+static void check_regression(json_value *regressions, const char *metric,
+                             double value, double min_value)
+{
+    const json_value *v;
+    double base;
+    char group[128];
+    char *name;
+
+    // Metrics are given as 'group.name'.
+    snprintf(group, sizeof(group), "%s", metric);
+    name = strchr(group, '.');
+    *name++ = '\0';
+    v = json_get_attr(g_bench.baseline, group, json_object);
+    base = json_get_attr_f(v, name, NAN);
+    if (isnan(base) || base < min_value) return;
+    if (value <= base * (1.0 + g_bench.tolerance)) return;
+    v = json_array_push(regressions, json_object_new(0));
+    json_object_push((json_value*)v, "metric", json_string_new(metric));
+    json_object_push((json_value*)v, "value", json_double_new(value));
+    json_object_push((json_value*)v, "baseline", json_double_new(base));
+}
+
+static void finish(void)
+{
+    json_value *ret, *jframes, *jmodules, *jcache, *regressions;
+    double *sorted, sum = 0, mean, median, p95, hit_rate;
+    cache_stats_t cache;
+    char metric[128];
+    int i, n = g_bench.nb_frames, hits, misses;
+    const module_timing_t *timing;
+
+    sorted = malloc(n * sizeof(*sorted));
+    memcpy(sorted, g_bench.frames_ms, n * sizeof(*sorted));
+    qsort(sorted, n, sizeof(*sorted), double_cmp);
+    for (i = 0; i < n; i++) sum += sorted[i];
+    mean = sum / n;
+    median = sorted[n / 2];
+    p95 = sorted[min(n - 1, (int)(n * 0.95))];
+
+    ret = json_object_new(0);
+    json_object_push(ret, "name", json_string_new(
+                json_get_attr_s(g_bench.script, "name") ?: ""));
+    json_object_push(ret, "frames", json_integer_new(n));
+
+    jframes = json_object_push(ret, "frame_ms", json_object_new(0));
+    json_object_push(jframes, "mean", json_double_new(mean));
+    json_object_push(jframes, "median", json_double_new(median));
+    json_object_push(jframes, "p95", json_double_new(p95));
+    json_object_push(jframes, "max", json_double_new(sorted[n - 1]));
+
+    jmodules = json_object_push(ret, "modules_ms", json_object_new(0));
+    for (i = 0; i < g_bench.nb_modules; i++) {
+        timing = &g_bench.modules[i];
+        if (!timing->module->id) continue;
+        json_object_push(jmodules, timing->module->id,
+                         json_double_new(timing->total / n));
+    }
+
+    cache_get_stats(&cache);
+    hits = cache.hits - g_bench.cache_start.hits;
+    misses = cache.misses - g_bench.cache_start.misses;
+    jcache = json_object_push(ret, "cache", json_object_new(0));
+    json_object_push(jcache, "hits", json_integer_new(hits));
+    json_object_push(jcache, "misses", json_integer_new(misses));
+    // No hit rate if the run never looked up the cache.
+    if (hits + misses) {
+        hit_rate = (double)hits / (hits + misses);
+        json_object_push(jcache, "hit_rate", json_double_new(hit_rate));
+    }
+    json_object_push(jcache, "size", json_integer_new(cache.size));
+
+    if (g_bench.baseline) {
+        regressions = json_object_push(ret, "regressions", json_array_new(0));
+        check_regression(regressions, "frame_ms.mean", mean, 0);
+        check_regression(regressions, "frame_ms.p95", p95, 0);
+        for (i = 0; i < g_bench.nb_modules; i++) {
+            timing = &g_bench.modules[i];
+            if (!timing->module->id) continue;
+            snprintf(metric, sizeof(metric), "modules_ms.%s",
+                     timing->module->id);
+            check_regression(regressions, metric, timing->total / n,
+                             MODULE_MIN_MS);
+        }
+        json_object_push(ret, "passed",
+                         json_boolean_new(regressions->u.array.length == 0));
+    }
+
+    g_bench.result = calloc(1, json_measure(ret));
+    json_serialize(g_bench.result, ret);
+    json_builder_free(ret);
+    free(sorted);
+    stop();
+}
+
+void bench_frame_end(void)
+{
+    if (!g_bench.running) return;
+    if (g_bench.frame >= 0)
+        g_bench.frames_ms[g_bench.frame] = now_ms() - g_bench.frame_start;
+    g_bench.frame++;
+    if (g_bench.frame >= g_bench.nb_frames) finish();
+}
@@ -0,0 +1,86 @@
+/* Stellarium Web Engine - Copyright (c) 2021 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdbool.h>
+
+typedef struct obj obj_t;
+
+/*
+ * File: bench.h
+ * Reproducible benchmarks driven by json scripts.
+ *
+ * A benchmark script looks like this:
+ *
+ *   {
+ *     "name": "milky-way",
+ *     "warmup": 60,        // Frames rendered before the measure.
+ *     "frames": 300,       // Number of measured frames.
+ *     "dt": 0.0166,        // Time step of each frame in seconds.
+ *     "tolerance": 0.1,    // Allowed slowdown relative to the baseline.
+ *     "setup": STEP,       // Applied before the warmup.
+ *     "steps": [STEP, ...]
+ *   }
+ *
+ * Where each step can have the following attributes:
+ *
+ *   frame    - Measured frame index at which the step is applied.
+ *   utc      - Set the time (MJD).
+ *   lookat   - Set the view direction, as [az, alt] in degrees.
+ *   zoom     - Set the fov in degrees.
+ *   duration - Duration of the utc, lookat and zoom animations in seconds.
+ *   set      - Object of module attributes to set, using the same format
+ *              as <obj_set_attrs_json> on the core object.
+ *
+ * While a benchmark is running, the time returned by <sys_get_unix_time>
+ * advances by a fixed step each frame, so that the animations are the same
+ * on all the runs.  The scripts in data/bench are available as assets.
+ */
+
+/*
+ * Function: bench_start
+ * Start a benchmark.
+ *
+ * The benchmark then runs during the next calls to core_update and
+ * core_render, until <bench_is_running> returns false.
+ *
+ * Parameters:
+ *   script   - A json benchmark script, or the name of one of the
+ *              scripts in data/bench.
+ *   baseline - Optional json result of a previous run to compare to.
+ *
+ * Return:
+ *   0 on success, or -1 if the script could not be parsed.
+ */
+int bench_start(const char *script, const char *baseline);
+
+/*
+ * Function: bench_is_running
+ * Return whether a benchmark is still running.
+ */
+bool bench_is_running(void);
+
+/*
+ * Function: bench_get_result
+ * Return the json result of the last finished benchmark, or NULL.
+ *
+ * The result contains the frames and modules timings in ms, the cache
+ * statistics, and if a baseline was given, the list of the regressions.
+ */
+const char *bench_get_result(void);
+
+// Hooks called by the core.
+void bench_update(void);
+void bench_frame_end(void);
+void bench_module_start(const obj_t *module);
+void bench_module_end(const obj_t *module);
+
+#endif // BENCH_H
@@ -16,6 +16,9 @@ core_t *core;   // The global core object.
 
 #define exp10(x) exp((x) * log(10.f))
 
+// Max amount of texture data uploaded to the GPU per frame.
+#define TEXTURE_UPLOAD_BUDGET (8 * 1024 * 1024)
+
 static void core_on_fov_changed(obj_t *obj, const attribute_t *attr)
 {
     // For the moment there is not point going further than 0.5°.
@@ -50,6 +53,60 @@ static json_value *core_fn_progressbars(obj_t *obj, const attribute_t *attr,
     return ret;
 }
 
+static void core_on_memory_budget_changed(obj_t *obj,
+                                          const attribute_t *attr)
+{
+    core->memory_budget = max(core->memory_budget, 0);
+    cache_set_budget((int64_t)core->memory_budget * (1 << 20));
+}
+
+static void add_cache_usage(void *user, const char *name,
+                            int64_t size, int64_t max_size)
+{
+    json_value *caches = user, *val;
+    val = json_object_push(caches, name, json_object_new(0));
+    json_object_push(val, "size", json_integer_new(size));
+    json_object_push(val, "max_size", json_integer_new(max_size));
+}
+
+static void add_hips_usage(void *user, const char *url, int64_t size)
+{
+    json_object_push(user, url, json_integer_new(size));
+}
+
+static json_value *core_fn_memory(obj_t *obj, const attribute_t *attr,
+                                  const json_value *args)
+{
+    json_value *ret, *frame;
+    cache_stats_t stats;
+    arena_stats_t arena_stats;
+    cache_get_stats(&stats);
+    ret = json_object_new(0);
+    json_object_push(ret, "size", json_integer_new(stats.size));
+    json_object_push(ret, "budget", json_integer_new(cache_get_budget()));
+    cache_get_usage(json_object_push(ret, "caches", json_object_new(0)),
+                    add_cache_usage);
+    // GPU memory used by the surveys textures.
+    hips_get_gpu_usage(json_object_push(ret, "hips", json_object_new(0)),
+                       add_hips_usage);
+
+    // Temporary allocations of the last frame.
+    arena_get_stats(core->frame_arena, &arena_stats);
+    frame = json_object_push(ret, "frame", json_object_new(0));
+    json_object_push(frame, "allocs", json_integer_new(arena_stats.allocs));
+    json_object_push(frame, "mallocs", json_integer_new(arena_stats.mallocs));
+    json_object_push(frame, "size", json_integer_new(arena_stats.size));
+    json_object_push(frame, "capacity",
+                     json_integer_new(arena_stats.capacity));
+    return ret;
+}
+
+EMSCRIPTEN_KEEPALIVE
+void core_on_memory_pressure(void)
+{
+    cache_trim(0);
+}
+
 EMSCRIPTEN_KEEPALIVE
 obj_t *core_get_module(const char *id)
 {
@@ -238,6 +295,7 @@ void core_init(double win_w, double win_h, double pixel_scale)
     DL_SORT(core->obj.children, modules_sort_cmp);
 
     core->areas = areas_create();
+    core->frame_arena = arena_create(1 << 20);
     progressbar_add_listener(on_progressbar);
 
     core_set_default();
@@ -293,6 +351,8 @@ int core_update(void)
     obj_t *atm, *module;
     task_t *task, *task_tmp;
 
+    bench_update();
+    cache_new_frame();
     now = sys_get_unix_time();
     dt = now - core->clock;
     dt = max(dt, 0.001); // Prevent bug in case the clock goes backward.
@@ -551,6 +611,7 @@ int core_render(double win_w, double win_h, double pixel_scale)
     if (!core->rend)
         core->rend = render_create();
     labels_reset();
+    texture_upload_budget_reset(TEXTURE_UPLOAD_BUDGET);
 
     painter_t painter = {
         .rend = core->rend,
@@ -572,7 +633,9 @@ int core_render(double win_w, double win_h, double pixel_scale)
     paint_prepare(&painter, win_w, win_h, pixel_scale);
 
     DL_FOREACH(core->obj.children, module) {
+        bench_module_start(module);
         obj_render(module, &painter);
+        bench_module_end(module);
     }
 
     // Render the viewport cap for debugging.
@@ -587,6 +650,7 @@ int core_render(double win_w, double win_h, double pixel_scale)
 
     // Flush all rendering pipeline
     paint_finish(&painter);
+    arena_reset(core->frame_arena);
 
     assert(bck.obs.tt == core->observer->tt);
     assert(bck.obs.yaw == core->observer->yaw);
@@ -599,6 +663,7 @@ int core_render(double win_w, double win_h, double pixel_scale)
             module->klass->post_render(module, &painter);
     }
 
+    bench_frame_end();
     return 0;
 }
 
@@ -1024,6 +1089,9 @@ static obj_klass_t core_klass = {
         PROPERTY(progressbars, TYPE_JSON, .fn = core_fn_progressbars),
         PROPERTY(fps, TYPE_INT, MEMBER(core_t, fps.avg)),
         PROPERTY(clicks, TYPE_INT, MEMBER(core_t, clicks)),
+        PROPERTY(memory, TYPE_JSON, .fn = core_fn_memory),
+        PROPERTY(memory_budget, TYPE_INT, MEMBER(core_t, memory_budget),
+                 .on_changed = core_on_memory_budget_changed),
         PROPERTY(zoom, TYPE_FLOAT, MEMBER(core_t, zoom)),
         PROPERTY(test, TYPE_BOOL, MEMBER(core_t, test)),
         PROPERTY(exposure_scale, TYPE_FLOAT, MEMBER(core_t, exposure_scale)),
@@ -1100,11 +1168,22 @@ static void test_basic(void)
 
 static void test_info(void)
 {
-    obj_t *obj;
-    double vmag;
+    obj_t *obj, *objs[2];
+    double vmag, radec[4], table[2][5];
+    const int infos[] = {INFO_VMAG, INFO_RADEC};
     obj = core_get_planet(599); // Jupiter.
     assert(obj);
     obj_get_info(obj, core->observer, INFO_VMAG, &vmag);
+
+    // Test bulk infos.
+    obj_get_info(obj, core->observer, INFO_RADEC, radec);
+    objs[0] = obj;
+    objs[1] = core_get_planet(499); // Mars.
+    assert(obj_get_infos(2, objs, core->observer, 2, infos,
+                         (double*)table) == 5);
+    assert(table[0][0] == vmag);
+    assert(vec4_equal(table[0] + 1, radec));
+    assert(table[1][0] != vmag);
 }
 
 TEST_REGISTER(NULL, test_core, TEST_AUTO);
@@ -96,6 +96,12 @@ struct core
     bool            hide_selection_label; // Used by the labels module.
 
     renderer_t      *rend;
+    // Incremented each time a font is added, since it can change the size
+    // of the texts.
+    int             fonts_gen;
+    // Allocator for the temporary data of the current frame.  It is reset
+    // once the frame has been rendered.
+    arena_t         *frame_arena;
     int             proj;
     double          win_size[2];
     double          win_pixels_scale;
@@ -108,6 +114,9 @@ struct core
     // from the ui.
     int clicks;
 
+    // Global budget of all the caches (MB).  Zero for no global budget.
+    int memory_budget;
+
     struct {
         struct {
             int    id; // Backend id (for example used in js).
@@ -224,6 +233,15 @@ void core_on_key(int key, int action);
 void core_on_char(uint32_t c);
 void core_on_zoom(double zoom, double x, double y);
 
+/*
+ * Function: core_on_memory_pressure
+ * Release the cached data not used by the current frame.
+ *
+ * To be called by the host application when the system is running out of
+ * memory.
+ */
+void core_on_memory_pressure(void);
+
 /*
  * Function: core_on_pinch
  * Called from the client to perform a pinch/panning gesture.
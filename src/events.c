@@ -50,28 +50,18 @@ static int sign(double x)
     return x < 0 ? -1 : 1;
 }
 
-static double find_zero(double (*f)(double x, void *user),
-                        double x0, double x1, double step, double precision,
-                        int rising, void *user)
+// Distance of an object above the horizon, assuming the observer is
+// already up to date.
+static double horizon_dist(observer_t *obs, obj_t *obj)
 {
-    int last_sign = 0;
-    double x, fx;
-    bool found = false;
-    // First find an approximate answer simply by stepping.  Not very clever.
-    // Make sure the last iteration is exactly at x1.
-    for (x = x0;; x += step) {
-        if (x > x1) x = x1; // Clamp to x1.
-        fx = f(x, user);
-        if (sign(fx) * last_sign == -1 && sign(fx) == rising) {
-            found = true;
-            break;
-        }
-        last_sign = sign(fx);
-        if (x == x1) break;
-    }
-    if (!found) return NAN;
-    // Once we are near the value, use newton algorithm.
-    return newton(f, x - step, x, precision, user);
+    double radius = 0, pvo[2][4], observed[4], az, alt;
+
+    obj_get_pvo(obj, obs, pvo);
+    convert_framev4(obs, FRAME_ICRF, FRAME_OBSERVED, pvo[0], observed);
+    eraC2s(observed, &az, &alt);
+    az = eraAnp(az);
+    obj_get_info(obj, obs, INFO_RADIUS, &radius);
+    return alt + radius - obs->horizon;
 }
 
 static double rise_dist(double time, void *user)
@@ -80,16 +70,74 @@ static double rise_dist(double time, void *user)
         observer_t *obs;
         obj_t *obj;
     } *data = user;
-    double radius = 0, pvo[2][4], observed[4], az, alt;
 
     data->obs->tt = time;
     observer_update(data->obs, false);
-    obj_get_pvo(data->obj, data->obs, pvo);
-    convert_framev4(data->obs, FRAME_ICRF, FRAME_OBSERVED, pvo[0], observed);
-    eraC2s(observed, &az, &alt);
-    az = eraAnp(az);
-    obj_get_info(data->obj, data->obs, INFO_RADIUS, &radius);
-    return alt + radius - data->obs->horizon;
+    return horizon_dist(data->obs, data->obj);
+}
+
+/*
+ * Function: compute_events
+ * Compute the rise or set time of several objects.
+ *
+ * This does the same as calling compute_event for each object, but the
+ * first approximate search steps are done for all the objects at once, so
+ * that we only update the observer once per step.
+ *
+ * Parameters:
+ *   obs        - The observer.
+ *   nb         - Number of objects.
+ *   objs       - Array of objects.
+ *   event      - EVENT_RISE or EVENT_SET.
+ *   start_time - Start of the search (TT MJD).
+ *   end_time   - End of the search (TT MJD).
+ *   precision  - Precision of the result (days).
+ *   out        - Output time of the event for each object, or NAN if
+ *                not found.
+ */
+EMSCRIPTEN_KEEPALIVE
+void compute_events(observer_t *obs, int nb, obj_t **objs, int event,
+                    double start_time, double end_time, double precision,
+                    double *out)
+{
+    observer_t obs2 = *obs;
+    double x, step = (end_time - start_time) / 24;
+    int i, s, nb_left = nb, rising;
+    int *last_sign;
+    struct {
+        observer_t *obs;
+        obj_t *obj;
+    } data = {&obs2};
+
+    rising = event == EVENT_RISE ? +1 : -1;
+    last_sign = calloc(nb, sizeof(*last_sign));
+    for (i = 0; i < nb; i++) out[i] = NAN;
+
+    // First find an approximate answer simply by stepping.  Make sure the
+    // last iteration is exactly at end_time.
+    for (x = start_time; nb_left; x += step) {
+        if (x > end_time) x = end_time; // Clamp to end_time.
+        obs2.tt = x;
+        observer_update(&obs2, false);
+        for (i = 0; i < nb; i++) {
+            if (!isnan(out[i])) continue;
+            s = sign(horizon_dist(&obs2, objs[i]));
+            if (s * last_sign[i] == -1 && s == rising) {
+                out[i] = x;
+                nb_left--;
+            }
+            last_sign[i] = s;
+        }
+        if (x == end_time) break;
+    }
+
+    // Once we are near the values, use newton algorithm.
+    for (i = 0; i < nb; i++) {
+        if (isnan(out[i])) continue;
+        data.obj = objs[i];
+        out[i] = newton(rise_dist, out[i] - step, out[i], precision, &data);
+    }
+    free(last_sign);
 }
 
 EMSCRIPTEN_KEEPALIVE
@@ -100,16 +148,8 @@ double compute_event(observer_t *obs,
                      double end_time,
                      double precision)
 {
-    observer_t obs2 = *obs;
     double ret;
-    int rising;
-    struct {
-        observer_t *obs;
-        obj_t *obj;
-    } data = {&obs2, obj};
-    rising = event == EVENT_RISE ? +1 : -1;
-    ret = find_zero(rise_dist, start_time, end_time,
-                    (end_time - start_time) / 24, precision,
-                    rising, &data);
+    compute_events(obs, 1, &obj, event, start_time, end_time, precision,
+                   &ret);
     return ret;
 }
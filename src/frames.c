@@ -206,6 +206,135 @@ int convert_frame(const observer_t *obs,
     return 0;
 }
 
+// Multiply a matrix on the left by an other one: m = a * m.
+static void mat_apply(double m[3][3], const double a[3][3])
+{
+    mat3_mul(a, m, m);
+}
+
+/*
+ * Compute the matrices equivalent to the rotations done in convert_frame
+ * for a given conversion.  'pre' is applied before the refraction and
+ * 'post' after.  refract is set to +1 if the refraction needs to be
+ * applied, -1 for the inverse refraction.  normalize is set if the output
+ * vectors need to be normalized.
+ */
+static void get_frame_mats(const observer_t *obs, int origin, int dest,
+                           double pre[3][3], double post[3][3],
+                           int *refract, bool *normalize)
+{
+    double (*m)[3] = pre;
+    double rz[3][3];
+    bool to_ecliptic = dest == FRAME_ECLIPTIC;
+
+    mat3_set_identity(pre);
+    mat3_set_identity(post);
+    *refract = 0;
+    *normalize = false;
+
+    if (origin == FRAME_ECLIPTIC) {
+        mat3_copy(obs->re2i, pre);
+        origin = FRAME_ICRF;
+    }
+    if (to_ecliptic) dest = FRAME_ICRF;
+
+    if (dest > origin) {
+        if (origin < FRAME_CIRS && dest >= FRAME_CIRS) {
+            mat3_transpose(obs->astrom.bpn, rz);
+            mat_apply(m, rz);
+        }
+        if (dest == FRAME_JNOW) {
+            mat3_set_identity(rz);
+            mat3_rz(-obs->eo, rz, rz);
+            mat_apply(m, rz);
+            goto end;
+        }
+        if (origin == FRAME_JNOW) {
+            mat3_set_identity(rz);
+            mat3_rz(obs->eo, rz, rz);
+            mat_apply(m, rz);
+        }
+        if (origin < FRAME_OBSERVED && dest >= FRAME_OBSERVED) {
+            mat_apply(m, obs->ri2h);
+            if (obs->pressure) {
+                *refract = +1;
+                m = post;
+            }
+        }
+        if (origin < FRAME_MOUNT && dest == FRAME_MOUNT) {
+            mat_apply(m, obs->ro2m);
+            goto end;
+        }
+        if (origin < FRAME_VIEW && dest >= FRAME_VIEW)
+            mat_apply(m, obs->ro2v);
+    } else if (dest < origin) {
+        *normalize = true;
+        if (origin >= FRAME_VIEW && dest < FRAME_VIEW)
+            mat_apply(m, obs->rv2o);
+        if (dest == FRAME_MOUNT) {
+            mat_apply(m, obs->ro2m);
+            *normalize = false;
+            goto end;
+        }
+        if (origin >= FRAME_OBSERVED && dest < FRAME_OBSERVED) {
+            if (obs->pressure) {
+                *refract = -1;
+                m = post;
+            }
+            mat_apply(m, obs->rh2i);
+        }
+        if (origin == FRAME_JNOW && dest < FRAME_JNOW) {
+            mat3_set_identity(rz);
+            mat3_rz(obs->eo, rz, rz);
+            mat_apply(m, rz);
+        }
+        if (origin >= FRAME_CIRS && dest < FRAME_CIRS)
+            mat_apply(m, obs->astrom.bpn);
+    }
+
+end:
+    if (to_ecliptic) mat_apply(m, obs->ri2e);
+}
+
+void convert_frame_n(const observer_t *obs, int origin, int dest, bool at_inf,
+                     int n, const double (*in)[3], double (*out)[3])
+{
+    double pre[3][3], post[3][3], dist;
+    int i, refract;
+    bool normalize;
+
+    get_frame_mats(obs, origin, dest, pre, post, &refract, &normalize);
+    for (i = 0; i < n; i++) {
+        if (origin == FRAME_ASTROM && dest > origin)
+            astrometric_to_apparent(obs, in[i], at_inf, out[i]);
+        else
+            vec3_copy(in[i], out[i]);
+        mat3_mul_vec3(pre, out[i], out[i]);
+    }
+
+    if (refract) {
+        for (i = 0; i < n; i++) {
+            dist = at_inf ? 1.0 : vec3_norm(out[i]);
+            // Special case for null's vectors.
+            if (dist == 0.0) continue;
+            if (!at_inf) vec3_mul(1.0 / dist, out[i], out[i]);
+            if (refract > 0)
+                refraction(out[i], obs->refa, obs->refb, out[i]);
+            else
+                refraction_inv(out[i], obs->refa, obs->refb, out[i]);
+            if (!at_inf) vec3_mul(dist, out[i], out[i]);
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        if (refract && vec3_norm2(out[i]) == 0.0) continue;
+        mat3_mul_vec3(post, out[i], out[i]);
+        if (dest == FRAME_ASTROM && origin > dest)
+            apparent_to_astrometric(obs, out[i], at_inf, out[i]);
+        if (normalize) vec3_normalize(out[i], out[i]);
+    }
+}
+
 EMSCRIPTEN_KEEPALIVE
 int convert_framev4(const observer_t *obs,
                         int origin, int dest,
@@ -481,4 +610,30 @@ static void test_convert_origin(void)
 
 TEST_REGISTER(NULL, test_convert_origin, TEST_AUTO)
 
+static void test_convert_frame_n(void)
+{
+    int origin, dest, i;
+    const double in[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+    double out[3][3], ref[3];
+    observer_t *obs;
+
+    core_init(100, 100, 1.0);
+    obs = core->observer;
+    obj_set_attr((obj_t*)obs, "utc", 58450.0);
+    obj_set_attr((obj_t*)obs, "latitude", 33.7490 * DD2R);
+    obs->pressure = 1000;
+    observer_update(obs, false);
+
+    for (origin = 0; origin <= FRAME_ECLIPTIC; origin++)
+    for (dest = 0; dest <= FRAME_ECLIPTIC; dest++) {
+        convert_frame_n(obs, origin, dest, true, 3, in, out);
+        for (i = 0; i < 3; i++) {
+            convert_frame(obs, origin, dest, true, in[i], ref);
+            assert(vec3_dist(out[i], ref) < 1e-12);
+        }
+    }
+}
+
+TEST_REGISTER(NULL, test_convert_frame_n, TEST_AUTO)
+
 #endif
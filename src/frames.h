@@ -147,6 +147,26 @@ int convert_framev4(const observer_t *obs,
                     int origin, int dest,
                     const double in[S 4], double out[S 4]);
 
+/*
+ * Function: convert_frame_n
+ * Same as convert_frame, but for an array of vectors.
+ *
+ * The rotations of the conversion are composed once for the whole array,
+ * so that each vector only goes through at most two matrix products and the
+ * refraction.
+ *
+ * Parameters:
+ *  obs     - The observer.
+ *  origin  - Origin coordinates.  One of the <FRAME> enum values.
+ *  dest    - Destination coordinates.  One of the <FRAME> enum values.
+ *  at_inf  - true for fixed objects (see convert_frame).
+ *  n       - Number of vectors.
+ *  in      - The input coordinates.
+ *  out     - The output coordinates.  Can be the same as in.
+ */
+void convert_frame_n(const observer_t *obs, int origin, int dest, bool at_inf,
+                     int n, const double (*in)[3], double (*out)[3]);
+
 /* Enum: ORIGIN
  * Represent a reference system, i.e. the origin of a reference frame and the
  * associated intertial frame.
@@ -0,0 +1,717 @@
+/* Stellarium Web Engine - Copyright (c) 2021 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+#include "geojson_filter.h"
+
+#include "utils/utils_json.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+    OP_NOT,
+    OP_AND,
+    OP_OR,
+    OP_DEFINED,
+    OP_IN,
+    OP_OVERLAP,
+    OP_COLOR,
+    OP_COLORMAP,
+    OP_COLORMAP_TAGS,
+};
+
+/*
+ * Path to a feature value.
+ *
+ * With columnar data, the path is resolved up to the column array when we
+ * bind the data, so that we only have to look at the remaining keys for
+ * each feature.
+ */
+typedef struct path {
+    int         size;
+    char        **keys;
+    const json_value *column;
+    int         column_depth; // Number of keys used to reach the column.
+} path_t;
+
+typedef struct node node_t;
+struct node {
+    int         op;
+    int         nb_children;
+    node_t      *children;
+    path_t      path;
+    double      range[2];
+    int         nb_numbers;
+    double      *numbers;
+    int         nb_strings;
+    char        **strings;
+    float       color[4];
+    float       default_color[4];
+};
+
+struct geojson_filter {
+    int         ref;
+    node_t      *hidden;
+    node_t      *blink;
+    node_t      *fill;
+    node_t      *stroke;
+    int         colormap_size;
+    float       (*colormap)[3];
+    char        *hash_salt;
+
+    const json_value *data;
+    bool        columnar;
+};
+
+static bool json_is_number(const json_value *v)
+{
+    return v && (v->type == json_integer || v->type == json_double);
+}
+
+static double json_to_double(const json_value *v)
+{
+    return v->type == json_integer ? v->u.integer : v->u.dbl;
+}
+
+static int parse_path(const json_value *v, path_t *path)
+{
+    char *str, *tok, *saveptr;
+    if (!v || v->type != json_string) return -1;
+    str = strdup(v->u.string.ptr);
+    for (tok = strtok_r(str, ".", &saveptr); tok;
+         tok = strtok_r(NULL, ".", &saveptr)) {
+        path->keys = realloc(path->keys, (path->size + 1) *
+                             sizeof(*path->keys));
+        path->keys[path->size++] = strdup(tok);
+    }
+    free(str);
+    return path->size ? 0 : -1;
+}
+
+static int parse_color(const json_value *v, float out[4])
+{
+    int i;
+    if (!v || v->type != json_array || v->u.array.length != 4) return -1;
+    for (i = 0; i < 4; i++) {
+        if (!json_is_number(v->u.array.values[i])) return -1;
+        out[i] = json_to_double(v->u.array.values[i]);
+    }
+    return 0;
+}
+
+static int parse_node(const json_value *v, node_t *node, bool color);
+
+static void node_release(node_t *node)
+{
+    int i;
+    for (i = 0; i < node->nb_children; i++)
+        node_release(&node->children[i]);
+    free(node->children);
+    for (i = 0; i < node->path.size; i++)
+        free(node->path.keys[i]);
+    free(node->path.keys);
+    free(node->numbers);
+    for (i = 0; i < node->nb_strings; i++)
+        free(node->strings[i]);
+    free(node->strings);
+}
+
+static node_t *create_node(const json_value *v, bool color)
+{
+    node_t *node;
+    if (!v) return NULL;
+    node = calloc(1, sizeof(*node));
+    if (parse_node(v, node, color)) {
+        node_release(node);
+        free(node);
+        return NULL;
+    }
+    return node;
+}
+
+static int parse_node(const json_value *v, node_t *node, bool color)
+{
+    const char *op;
+    const json_value *arg;
+    int i, n;
+
+    if (v->type != json_array || v->u.array.length < 1) return -1;
+    n = v->u.array.length;
+    if (color && v->u.array.values[0]->type != json_string) {
+        node->op = OP_COLOR;
+        return parse_color(v, node->color);
+    }
+    if (v->u.array.values[0]->type != json_string) return -1;
+    op = v->u.array.values[0]->u.string.ptr;
+
+    if (!color && strcmp(op, "not") == 0 && n == 2) {
+        node->op = OP_NOT;
+    } else if (!color && strcmp(op, "and") == 0) {
+        node->op = OP_AND;
+    } else if (!color && strcmp(op, "or") == 0) {
+        node->op = OP_OR;
+    } else if (!color && strcmp(op, "defined") == 0 && n == 2) {
+        node->op = OP_DEFINED;
+        return parse_path(v->u.array.values[1], &node->path);
+    } else if (!color && strcmp(op, "in") == 0 && n == 3) {
+        node->op = OP_IN;
+        arg = v->u.array.values[2];
+        if (arg->type != json_array) return -1;
+        for (i = 0; i < arg->u.array.length; i++) {
+            if (json_is_number(arg->u.array.values[i])) {
+                node->numbers = realloc(node->numbers,
+                        (node->nb_numbers + 1) * sizeof(*node->numbers));
+                node->numbers[node->nb_numbers++] =
+                    json_to_double(arg->u.array.values[i]);
+            } else if (arg->u.array.values[i]->type == json_string) {
+                node->strings = realloc(node->strings,
+                        (node->nb_strings + 1) * sizeof(*node->strings));
+                node->strings[node->nb_strings++] =
+                    strdup(arg->u.array.values[i]->u.string.ptr);
+            }
+        }
+        return parse_path(v->u.array.values[1], &node->path);
+    } else if (!color && strcmp(op, "overlap") == 0 && n == 4) {
+        node->op = OP_OVERLAP;
+        if (!json_is_number(v->u.array.values[2]) ||
+            !json_is_number(v->u.array.values[3])) return -1;
+        node->range[0] = json_to_double(v->u.array.values[2]);
+        node->range[1] = json_to_double(v->u.array.values[3]);
+        return parse_path(v->u.array.values[1], &node->path);
+    } else if (color && strcmp(op, "colormap") == 0 && n == 6) {
+        node->op = OP_COLORMAP;
+        if (!json_is_number(v->u.array.values[2]) ||
+            !json_is_number(v->u.array.values[3]) ||
+            !json_is_number(v->u.array.values[4])) return -1;
+        node->range[0] = json_to_double(v->u.array.values[2]);
+        node->range[1] = json_to_double(v->u.array.values[3]);
+        node->color[3] = json_to_double(v->u.array.values[4]);
+        if (parse_color(v->u.array.values[5], node->default_color))
+            return -1;
+        return parse_path(v->u.array.values[1], &node->path);
+    } else if (color && strcmp(op, "colormap_tags") == 0 && n == 4) {
+        node->op = OP_COLORMAP_TAGS;
+        if (!json_is_number(v->u.array.values[2])) return -1;
+        node->color[3] = json_to_double(v->u.array.values[2]);
+        if (parse_color(v->u.array.values[3], node->default_color))
+            return -1;
+        return parse_path(v->u.array.values[1], &node->path);
+    } else {
+        LOG_W("Unknown geojson filter operation: %s", op);
+        return -1;
+    }
+
+    // Logical operators.
+    node->nb_children = n - 1;
+    node->children = calloc(n - 1, sizeof(*node->children));
+    for (i = 0; i < n - 1; i++) {
+        if (parse_node(v->u.array.values[i + 1], &node->children[i], false))
+            return -1;
+    }
+    return 0;
+}
+
+geojson_filter_t *geojson_filter_create(const json_value *program)
+{
+    geojson_filter_t *filter;
+    const json_value *v, *c;
+    int i, j;
+
+    if (!program || program->type != json_object) return NULL;
+    filter = calloc(1, sizeof(*filter));
+    filter->ref = 1;
+
+    v = json_get_attr(program, "colormap", json_array);
+    if (v) {
+        filter->colormap_size = v->u.array.length;
+        filter->colormap = calloc(v->u.array.length,
+                                  sizeof(*filter->colormap));
+        for (i = 0; i < v->u.array.length; i++) {
+            c = v->u.array.values[i];
+            if (c->type != json_array || c->u.array.length < 3) goto error;
+            for (j = 0; j < 3; j++) {
+                if (!json_is_number(c->u.array.values[j])) goto error;
+                filter->colormap[i][j] = json_to_double(c->u.array.values[j]);
+            }
+        }
+    }
+    filter->hash_salt = strdup(json_get_attr_s(program, "hash_salt") ?: "");
+
+#define NODE(name, color) do { \
+        v = json_get_attr(program, #name, 0); \
+        filter->name = create_node(v, color); \
+        if (v && !filter->name) goto error; \
+    } while (0)
+
+    NODE(hidden, false);
+    NODE(blink, false);
+    NODE(fill, true);
+    NODE(stroke, true);
+#undef NODE
+    return filter;
+
+error:
+    LOG_E("Cannot parse geojson filter program");
+    geojson_filter_delete(filter);
+    return NULL;
+}
+
+geojson_filter_t *geojson_filter_retain(geojson_filter_t *filter)
+{
+    filter->ref++;
+    return filter;
+}
+
+void geojson_filter_delete(geojson_filter_t *filter)
+{
+    node_t *nodes[4];
+    int i;
+    if (!filter) return;
+    filter->ref--;
+    assert(filter->ref >= 0);
+    if (filter->ref > 0) return;
+    nodes[0] = filter->hidden;
+    nodes[1] = filter->blink;
+    nodes[2] = filter->fill;
+    nodes[3] = filter->stroke;
+    for (i = 0; i < 4; i++) {
+        if (!nodes[i]) continue;
+        node_release(nodes[i]);
+        free(nodes[i]);
+    }
+    free(filter->colormap);
+    free(filter->hash_salt);
+    free(filter);
+}
+
+static const json_value *json_get_child(const json_value *v, const char *key)
+{
+    char *end;
+    long i;
+    if (!v) return NULL;
+    if (v->type == json_object) return json_get_attr(v, key, 0);
+    if (v->type == json_array) {
+        i = strtol(key, &end, 10);
+        if (*end || i < 0 || i >= v->u.array.length) return NULL;
+        return v->u.array.values[i];
+    }
+    return NULL;
+}
+
+static void bind_node(node_t *node, const json_value *data, bool columnar)
+{
+    int i;
+    const json_value *v = data;
+
+    for (i = 0; i < node->nb_children; i++)
+        bind_node(&node->children[i], data, columnar);
+    if (!columnar) return;
+
+    node->path.column = NULL;
+    for (i = 0; i < node->path.size; i++) {
+        v = json_get_attr(v, node->path.keys[i], 0);
+        if (!v || v->type == json_array) break;
+    }
+    if (v && v->type == json_array) {
+        node->path.column = v;
+        node->path.column_depth = i + 1;
+    }
+}
+
+void geojson_filter_bind(geojson_filter_t *filter, const json_value *data,
+                         bool columnar)
+{
+    filter->data = data;
+    filter->columnar = columnar;
+    if (filter->hidden) bind_node(filter->hidden, data, columnar);
+    if (filter->blink) bind_node(filter->blink, data, columnar);
+    if (filter->fill) bind_node(filter->fill, data, columnar);
+    if (filter->stroke) bind_node(filter->stroke, data, columnar);
+}
+
+// Return the value of a feature, or NULL if not defined.
+static const json_value *get_value(const geojson_filter_t *filter,
+                                   const path_t *path, int idx)
+{
+    const json_value *v;
+    int i = 0;
+
+    if (filter->columnar) {
+        v = path->column;
+        if (!v || idx >= v->u.array.length) return NULL;
+        v = v->u.array.values[idx];
+        i = path->column_depth;
+    } else {
+        v = filter->data;
+        if (!v || v->type != json_array || idx >= v->u.array.length)
+            return NULL;
+        v = v->u.array.values[idx];
+    }
+    for (; v && i < path->size; i++) {
+        v = json_get_child(v, path->keys[i]);
+    }
+    if (v && v->type == json_null) return NULL;
+    return v;
+}
+
+// Get the value of a feature as a [min, max] range.
+static bool get_range(const geojson_filter_t *filter, const path_t *path,
+                      int idx, double range[2])
+{
+    const json_value *v = get_value(filter, path, idx);
+    if (!v) return false;
+    if (json_is_number(v)) {
+        range[0] = range[1] = json_to_double(v);
+        return true;
+    }
+    if (v->type != json_array || v->u.array.length < 2) return false;
+    if (!json_is_number(v->u.array.values[0]) ||
+        !json_is_number(v->u.array.values[1])) return false;
+    range[0] = json_to_double(v->u.array.values[0]);
+    range[1] = json_to_double(v->u.array.values[1]);
+    return true;
+}
+
+static bool eval_predicate(const geojson_filter_t *filter,
+                           const node_t *node, int idx)
+{
+    const json_value *v;
+    double range[2], x;
+    int i;
+
+    switch (node->op) {
+    case OP_NOT:
+        return !eval_predicate(filter, &node->children[0], idx);
+    case OP_AND:
+        for (i = 0; i < node->nb_children; i++) {
+            if (!eval_predicate(filter, &node->children[i], idx))
+                return false;
+        }
+        return true;
+    case OP_OR:
+        for (i = 0; i < node->nb_children; i++) {
+            if (eval_predicate(filter, &node->children[i], idx))
+                return true;
+        }
+        return false;
+    case OP_DEFINED:
+        return get_value(filter, &node->path, idx) != NULL;
+    case OP_IN:
+        v = get_value(filter, &node->path, idx);
+        if (!v) return false;
+        if (json_is_number(v)) {
+            x = json_to_double(v);
+            for (i = 0; i < node->nb_numbers; i++) {
+                if (node->numbers[i] == x) return true;
+            }
+        } else if (v->type == json_string) {
+            for (i = 0; i < node->nb_strings; i++) {
+                if (strcmp(node->strings[i], v->u.string.ptr) == 0)
+                    return true;
+            }
+        }
+        return false;
+    case OP_OVERLAP:
+        if (!get_range(filter, &node->path, idx, range)) return false;
+        return range[1] >= node->range[0] && range[0] <= node->range[1];
+    default:
+        assert(false);
+        return false;
+    }
+}
+
+/*
+ * Write the low bytes of the utf-16 code units of an utf-8 string, that is
+ * the values of 'str.charCodeAt(i) & 0xff' in js, and return their number.
+ * This is what the murmurhash js package hashes, so we need the same bytes
+ * to get the same tags colors as the web frontend.
+ */
+static int utf16_low_bytes(const char *str, uint8_t *out)
+{
+    const uint8_t *s = (const uint8_t*)str;
+    uint32_t c;
+    int i, len, n = 0;
+
+    while (*s) {
+        c = s[0];
+        len = (c < 0xc0) ? 1 : (c < 0xe0) ? 2 : (c < 0xf0) ? 3 : 4;
+        if (len > 1) c &= 0x3f >> (len - 1);
+        for (i = 1; i < len && (s[i] & 0xc0) == 0x80; i++)
+            c = (c << 6) | (s[i] & 0x3f);
+        s += i;
+        if (c >= 0x10000) { // Surrogate pair.
+            c -= 0x10000;
+            out[n++] = (0xd800 | (c >> 10)) & 0xff;
+            out[n++] = (0xdc00 | (c & 0x3ff)) & 0xff;
+        } else {
+            out[n++] = c & 0xff;
+        }
+    }
+    return n;
+}
+
+// MurmurHash2 (32 bits), with the length as seed.
+static uint32_t murmur2(const uint8_t *data, int len)
+{
+    const uint32_t m = 0x5bd1e995;
+    uint32_t h = len, k;
+    int i;
+
+    for (i = 0; i + 4 <= len; i += 4) {
+        k = data[i] | (data[i + 1] << 8) | (data[i + 2] << 16) |
+            ((uint32_t)data[i + 3] << 24);
+        k *= m;
+        k ^= k >> 24;
+        k *= m;
+        h = (h * m) ^ k;
+    }
+    switch (len - i) {
+    case 3: h ^= data[i + 2] << 16; // fall through
+    case 2: h ^= data[i + 1] << 8;  // fall through
+    case 1: h ^= data[i];
+            h *= m;
+    }
+    h ^= h >> 13;
+    h *= m;
+    h ^= h >> 15;
+    return h;
+}
+
+// Hash of a tag with the program salt, same as in the web frontend.
+static uint32_t tag_hash(const char *tag, const char *salt)
+{
+    uint8_t buf[256], *data = buf;
+    size_t size = strlen(tag) + strlen(salt);
+    uint32_t ret;
+    int len;
+
+    if (size > sizeof(buf)) data = malloc(size);
+    len = utf16_low_bytes(tag, data);
+    len += utf16_low_bytes(salt, data + len);
+    ret = murmur2(data, len);
+    if (data != buf) free(data);
+    return ret;
+}
+
+// Map a value in the range [0, 1] to the colormap.
+static const float *colormap_get(const geojson_filter_t *filter, double v)
+{
+    int i;
+    static const float white[3] = {1, 1, 1};
+    if (!filter->colormap_size) return white;
+    i = isnan(v) ? 0 : floor(v * (filter->colormap_size - 1));
+    if (i < 0) i = 0;
+    if (i >= filter->colormap_size) i = filter->colormap_size - 1;
+    return filter->colormap[i];
+}
+
+static void eval_color(const geojson_filter_t *filter, const node_t *node,
+                       int idx, float out[4])
+{
+    const json_value *v, *count;
+    double range[2], x, total = 0, c[3] = {0, 0, 0};
+    const float *cc;
+    int i;
+
+    switch (node->op) {
+    case OP_COLOR:
+        memcpy(out, node->color, sizeof(node->color));
+        return;
+    case OP_COLORMAP:
+        if (!get_range(filter, &node->path, idx, range)) break;
+        x = ((range[0] + range[1]) / 2 - node->range[0]) /
+            (node->range[1] - node->range[0]);
+        cc = colormap_get(filter, x);
+        out[0] = cc[0];
+        out[1] = cc[1];
+        out[2] = cc[2];
+        out[3] = node->color[3];
+        return;
+    case OP_COLORMAP_TAGS:
+        v = get_value(filter, &node->path, idx);
+        if (!v || v->type != json_object) break;
+        for (i = 0; i < v->u.object.length; i++) {
+            count = v->u.object.values[i].value;
+            if (!json_is_number(count)) continue;
+            x = tag_hash(v->u.object.values[i].name, filter->hash_salt) /
+                4294967295.0;
+            cc = colormap_get(filter, x);
+            c[0] += cc[0] * json_to_double(count);
+            c[1] += cc[1] * json_to_double(count);
+            c[2] += cc[2] * json_to_double(count);
+            total += json_to_double(count);
+        }
+        if (total <= 0) break;
+        out[0] = c[0] / total;
+        out[1] = c[1] / total;
+        out[2] = c[2] / total;
+        out[3] = node->color[3];
+        return;
+    default:
+        assert(false);
+        return;
+    }
+    memcpy(out, node->default_color, sizeof(node->default_color));
+}
+
+void geojson_filter_eval(const geojson_filter_t *filter, int idx,
+                         float fill[4], float stroke[4],
+                         bool *blink, bool *hidden)
+{
+    *hidden = false;
+    *blink = false;
+    if (filter->hidden) {
+        *hidden = eval_predicate(filter, filter->hidden, idx);
+        if (*hidden) return;
+    }
+    if (filter->blink) *blink = eval_predicate(filter, filter->blink, idx);
+    if (filter->fill) eval_color(filter, filter->fill, idx, fill);
+    if (filter->stroke) eval_color(filter, filter->stroke, idx, stroke);
+}
+
+/******** TESTS ***********************************************************/
+
+#if COMPILE_TESTS
+
+#include "swe.h"
+
+static const char *TEST_PROGRAM =
+    "{\"hidden\": [\"not\", [\"overlap\", \"properties.date\", 10, 20]],"
+    " \"blink\": [\"in\", \"geogroup_id\", [\"g1\", 3]],"
+    " \"fill\": [\"colormap_tags\", \"properties.tags\", 0.5,"
+    "            [0.5, 0.5, 0.5, 0.5]],"
+    " \"stroke\": [\"colormap\", \"properties.date\", 0, 40, 1,"
+    "              [0, 0, 0, 0]],"
+    " \"colormap\": [[1, 0, 0], [0, 1, 0], [0, 0, 1]],"
+    " \"hash_salt\": \"Stellarium Labs\"}";
+
+static void test_geojson_filter(void)
+{
+    const char *features =
+        "[{\"properties\": {\"date\": [0, 5]}, \"geogroup_id\": \"g1\"},"
+        " {\"properties\": {\"date\": [15, 30], \"tags\": {\"a\": 1}},"
+        "  \"geogroup_id\": \"g1\"},"
+        " {\"properties\": {\"date\": 12}, \"geogroup_id\": 3}]";
+    const char *columns =
+        "{\"properties\": {\"date\": [[0, 5], [15, 30], 12],"
+        "                  \"tags\": [null, {\"a\": 1}, null]},"
+        " \"geogroup_id\": [\"g1\", \"g1\", 3]}";
+    const char *datas[] = {features, columns};
+    json_value *program, *data;
+    geojson_filter_t *filter;
+    float fill[4], stroke[4];
+    bool blink, hidden;
+    int i;
+
+    program = json_parse(TEST_PROGRAM, strlen(TEST_PROGRAM));
+    filter = geojson_filter_create(program);
+    assert(filter);
+    for (i = 0; i < 2; i++) {
+        data = json_parse(datas[i], strlen(datas[i]));
+        geojson_filter_bind(filter, data, i == 1);
+
+        geojson_filter_eval(filter, 0, fill, stroke, &blink, &hidden);
+        assert(hidden);
+
+        blink = hidden = false;
+        geojson_filter_eval(filter, 1, fill, stroke, &blink, &hidden);
+        assert(!hidden && blink);
+        assert(fill[3] == 0.5f && fill[0] + fill[1] + fill[2] == 1);
+        // Center of the range is 22.5 -> second color.
+        assert(stroke[0] == 0 && stroke[1] == 1 && stroke[3] == 1);
+
+        // The hidden and blink values are reset at each evaluation.
+        blink = hidden = true;
+        geojson_filter_eval(filter, 2, fill, stroke, &blink, &hidden);
+        assert(!hidden && blink);
+        assert(fill[0] == 0.5f && fill[3] == 0.5f);
+        assert(stroke[0] == 1 && stroke[1] == 0);
+        json_value_free(data);
+    }
+    geojson_filter_delete(filter);
+    json_value_free(program);
+}
+
+// Check the tags hashes against the values of the js murmurhash.v2
+// function used by the web frontend, including non ascii tags.
+static void test_geojson_filter_tag_hash(void)
+{
+    const struct {
+        const char *tag;
+        uint32_t    hash;
+    } values[] = {
+        {"a", 2889232226u},
+        {"Gaia", 4138002493u},
+        {"T\xc3\xa9lescope", 3394810455u},
+        {"\xe6\x97\xa5\xe6\x9c\xac", 4284478102u},
+        {"clef \xf0\x9d\x84\x9e", 2895222732u},
+    };
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(values); i++)
+        assert(tag_hash(values[i].tag, "Stellarium Labs") == values[i].hash);
+}
+
+/*
+ * Benchmark of a typical SMT program on a 100k features layer.
+ * Not run automatically, use: tests_run("geojson_filter").
+ */
+static void test_geojson_filter_bench(void)
+{
+    const int n = 100000;
+    json_value *program, *data, *props, *dates, *tags, *ids, *v;
+    geojson_filter_t *filter;
+    float fill[4], stroke[4];
+    bool blink, hidden;
+    char buf[32];
+    int i, nb_hidden = 0;
+    double t;
+
+    data = json_object_new(0);
+    props = json_object_push(data, "properties", json_object_new(0));
+    dates = json_object_push(props, "date", json_array_new(n));
+    tags = json_object_push(props, "tags", json_array_new(n));
+    ids = json_object_push(data, "geogroup_id", json_array_new(n));
+    for (i = 0; i < n; i++) {
+        v = json_array_push(dates, json_array_new(2));
+        json_array_push(v, json_integer_new(i % 40));
+        json_array_push(v, json_integer_new(i % 40 + 2));
+        v = json_array_push(tags, json_object_new(0));
+        snprintf(buf, sizeof(buf), "tag%d", i % 17);
+        json_object_push(v, buf, json_integer_new(1 + i % 3));
+        snprintf(buf, sizeof(buf), "g%d", i);
+        json_array_push(ids, json_string_new(buf));
+    }
+
+    program = json_parse(TEST_PROGRAM, strlen(TEST_PROGRAM));
+    filter = geojson_filter_create(program);
+    t = sys_get_unix_time();
+    geojson_filter_bind(filter, data, true);
+    for (i = 0; i < n; i++) {
+        hidden = false;
+        geojson_filter_eval(filter, i, fill, stroke, &blink, &hidden);
+        nb_hidden += hidden;
+    }
+    t = sys_get_unix_time() - t;
+    LOG_I("Geojson filter on %d features: %.1f ms (%d hidden)",
+          n, t * 1000, nb_hidden);
+    geojson_filter_delete(filter);
+    json_value_free(program);
+    json_builder_free(data);
+}
+
+TEST_REGISTER(NULL, test_geojson_filter, TEST_AUTO);
+TEST_REGISTER(NULL, test_geojson_filter_tag_hash, TEST_AUTO);
+TEST_REGISTER(NULL, test_geojson_filter_bench, 0);
+
+#endif
@@ -0,0 +1,117 @@
+/* Stellarium Web Engine - Copyright (c) 2021 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+#ifndef GEOJSON_FILTER_H
+#define GEOJSON_FILTER_H
+
+#include "json.h"
+
+#include <stdbool.h>
+
+/*
+ * Native filter for geojson features.
+ *
+ * Instead of calling a user function for each feature, the style of the
+ * features can be computed from a small declarative program, given as a
+ * json document:
+ *
+ *   {
+ *     "hidden": PREDICATE,
+ *     "blink": PREDICATE,
+ *     "fill": COLOR,
+ *     "stroke": COLOR,
+ *     "colormap": [[r, g, b], ...],
+ *     "hash_salt": "..."
+ *   }
+ *
+ * All the attributes are optional.  The features values are referenced by
+ * dot separated paths, relative to the feature (eg: "properties.date").
+ *
+ * Predicates:
+ *
+ *   ["not", P]
+ *   ["and", P1, P2, ...]
+ *   ["or", P1, P2, ...]
+ *   ["defined", PATH]
+ *   ["in", PATH, [V1, V2, ...]]  - Value equal to one of the numbers or
+ *                                  strings of the list.
+ *   ["overlap", PATH, MIN, MAX]  - Number or [min, max] range value
+ *                                  overlapping [MIN, MAX].
+ *
+ * Colors:
+ *
+ *   [r, g, b, a]                 - A constant color.
+ *   ["colormap", PATH, MIN, MAX, ALPHA, DEFAULT]
+ *        Number or [min, max] range value (we use the center) mapped from
+ *        [MIN, MAX] into the colormap.  DEFAULT is used for undefined
+ *        values.
+ *   ["colormap_tags", PATH, ALPHA, DEFAULT]
+ *        Object of {tag: count} values.  Average of the tags colors weighted
+ *        by their count.  The color of a tag is taken from the colormap using
+ *        the murmur2 hash of the tag followed by the hash_salt string.
+ */
+
+typedef struct geojson_filter geojson_filter_t;
+
+/*
+ * Function: geojson_filter_create
+ * Compile a filter program.
+ *
+ * Return NULL in case of error.
+ */
+geojson_filter_t *geojson_filter_create(const json_value *program);
+
+/*
+ * Function: geojson_filter_retain
+ * Add a reference to a filter.
+ */
+geojson_filter_t *geojson_filter_retain(geojson_filter_t *filter);
+
+/*
+ * Function: geojson_filter_delete
+ * Release a reference to a filter, and delete it if it was the last one.
+ */
+void geojson_filter_delete(geojson_filter_t *filter);
+
+/*
+ * Function: geojson_filter_bind
+ * Set the features data used by <geojson_filter_eval>.
+ *
+ * Parameters:
+ *   filter   - A compiled filter.
+ *   data     - Either a json array of features, or if columnar is set, an
+ *              object with the same structure as a feature but where each
+ *              value is replaced by the array of the values of all the
+ *              features.
+ *   columnar - Set if data is in columnar form.
+ */
+void geojson_filter_bind(geojson_filter_t *filter, const json_value *data,
+                         bool columnar);
+
+/*
+ * Function: geojson_filter_eval
+ * Evaluate the filter program on a feature.
+ *
+ * The hidden and blink values are always set, to false if the program
+ * doesn't define them.  The colors are only changed if the program defines
+ * them, so they should be set to the default colors of the feature first.
+ *
+ * Parameters:
+ *   filter - A compiled filter, bound to some data.
+ *   idx    - Index of the feature in the data.
+ *   fill   - Output fill color.
+ *   stroke - Output stroke color.
+ *   blink  - Output blink state.
+ *   hidden - Output hidden state.
+ */
+void geojson_filter_eval(const geojson_filter_t *filter, int idx,
+                         float fill[4], float stroke[4],
+                         bool *blink, bool *hidden);
+
+#endif // GEOJSON_FILTER_H
@@ -0,0 +1,320 @@
+/* Stellarium Web Engine - Copyright (c) 2021 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+/*
+ * Headless benchmark program.
+ *
+ * Built with 'make headless', using the null renderer, so that we can
+ * measure the CPU cost of the engine on machines without GPU.  The data are
+ * loaded from local directories, and the observer follows a scripted path.
+ * For each frame we output the CPU time, the render calls statistics, and
+ * the number of temporary allocations done in the frame arena.
+ *
+ * With the --bench option we instead run one of the json benchmark scripts
+ * (see bench.h) and output its json result.
+ */
+
+#include "swe.h"
+#include "render.h"
+
+#include <getopt.h>
+#include <time.h>
+
+#define MAX_MOUNTS 16
+#define MAX_KEYS 1024
+
+static const char *USAGE =
+"Usage: swe-headless [OPTION]...\n"
+"Render frames with the null renderer and print their statistics.\n"
+"\n"
+"  -m, --mount=URL=DIR     Serve the urls starting with URL from the local\n"
+"                          directory DIR.\n"
+"  -s, --source=MOD=URL    Add a data source to a module\n"
+"                          (eg: stars=https://data.stellarium.org/stars).\n"
+"  -p, --path=FILE         Observer path file.  Each line is a key frame,\n"
+"                          given as 'yaw pitch fov' in degrees.\n"
+"  -n, --frames=N          Number of measured frames (default 100).\n"
+"  -w, --warmup=N          Number of frames to render before measuring, to\n"
+"                          give time to load the data (default 0).\n"
+"  -t, --utc=MJD           Observation time (default 59215, 2021-01-01).\n"
+"  -g, --size=WxH          Window size (default 1024x768).\n"
+"  -b, --bench=NAME|FILE   Run a benchmark script and print its json result.\n"
+"                          NAME is one of the scripts in data/bench.\n"
+"  -r, --baseline=FILE     Json result of a previous benchmark run.  Exit\n"
+"                          with an error if the benchmark got slower.\n"
+"  -h, --help              Show this help.\n";
+
+static struct {
+    int nb;
+    struct {
+        const char *url;
+        const char *dir;
+    } items[MAX_MOUNTS];
+} g_mounts = {};
+
+// Observer path key frames: yaw, pitch, fov.
+static struct {
+    int nb;
+    double keys[MAX_KEYS][3];
+} g_path = {};
+
+static double get_time(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Asset hook to serve the mounted urls from the local file system.
+static void *mount_hook(void *user, const char *url, int *size, int *code)
+{
+    int i, len = 0;
+    char path[1024];
+    void *data;
+
+    for (i = 0; i < g_mounts.nb; i++) {
+        len = strlen(g_mounts.items[i].url);
+        if (strncmp(url, g_mounts.items[i].url, len) == 0) break;
+    }
+    if (i == g_mounts.nb) {
+        *code = -1; // Not handled.
+        return NULL;
+    }
+    snprintf(path, sizeof(path), "%s/%s", g_mounts.items[i].dir, url + len);
+    // Remove url parameters.
+    if (strchr(path, '?')) *strchr(path, '?') = '\0';
+    data = read_file(path, size);
+    *code = data ? 200 : 404;
+    return data;
+}
+
+static int add_mount(char *arg)
+{
+    char *sep = strchr(arg, '=');
+    if (!sep || g_mounts.nb >= MAX_MOUNTS) return -1;
+    *sep = '\0';
+    g_mounts.items[g_mounts.nb].url = arg;
+    g_mounts.items[g_mounts.nb].dir = sep + 1;
+    g_mounts.nb++;
+    return 0;
+}
+
+static int add_source(char *arg)
+{
+    obj_t *module;
+    char *sep = strchr(arg, '=');
+    if (!sep) return -1;
+    *sep = '\0';
+    module = core_get_module(arg);
+    if (!module) {
+        LOG_E("Unknown module: %s", arg);
+        return -1;
+    }
+    // Errors are logged by the module.
+    module_add_data_source(module, sep + 1, NULL);
+    return 0;
+}
+
+static int load_path(const char *file)
+{
+    char *data, *line, *tmp;
+    double *key;
+
+    data = read_file(file, NULL);
+    if (!data) {
+        LOG_E("Cannot read %s", file);
+        return -1;
+    }
+    for (line = strtok_r(data, "\n", &tmp); line;
+         line = strtok_r(NULL, "\n", &tmp))
+    {
+        if (line[0] == '#' || g_path.nb >= MAX_KEYS) continue;
+        key = g_path.keys[g_path.nb];
+        if (sscanf(line, "%lf %lf %lf", &key[0], &key[1], &key[2]) == 3)
+            g_path.nb++;
+    }
+    free(data);
+    return 0;
+}
+
+// Set the observer view for a given frame, interpolating the path keys.
+static void set_view(int frame, int nb_frames)
+{
+    double k, v[3];
+    int i;
+
+    if (!g_path.nb) return;
+    k = (g_path.nb - 1) * (double)frame / max(nb_frames - 1, 1);
+    i = min((int)k, g_path.nb - 2);
+    if (g_path.nb == 1) {
+        vec3_copy(g_path.keys[0], v);
+    } else {
+        vec3_mix(g_path.keys[i], g_path.keys[i + 1], k - i, v);
+    }
+    core->observer->yaw = v[0] * DD2R;
+    core->observer->pitch = v[1] * DD2R;
+    core->fov = v[2] * DD2R;
+}
+
+// Run a benchmark script until it is done.
+static int run_bench(const char *bench, const char *baseline_file,
+                     int w, int h)
+{
+    char *script = NULL, *baseline = NULL;
+    const char *result;
+    json_value *jresult;
+    int ret = -1;
+
+    // Either a file, or the name of an embedded script.
+    if (strchr(bench, '/') || str_endswith(bench, ".json")) {
+        script = read_file(bench, NULL);
+        if (!script) {
+            LOG_E("Cannot read %s", bench);
+            goto end;
+        }
+    }
+    if (baseline_file) {
+        baseline = read_file(baseline_file, NULL);
+        if (!baseline) {
+            LOG_E("Cannot read %s", baseline_file);
+            goto end;
+        }
+    }
+    if (bench_start(script ?: bench, baseline)) goto end;
+    while (bench_is_running()) {
+        core_update();
+        core_render(w, h, 1.0);
+    }
+    result = bench_get_result();
+    printf("%s\n", result);
+    jresult = json_parse(result, strlen(result));
+    ret = json_get_attr_b(jresult, "passed", true) ? 0 : 1;
+    json_value_free(jresult);
+end:
+    free(script);
+    free(baseline);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    int c, i, nb_frames = 100, warmup = 0, w = 1024, h = 768;
+    double utc = 59215, wall, cpu;
+    double sum[2] = {0}, worst[2] = {0};
+    render_stats_t stats;
+    arena_stats_t arena_stats;
+    const char *path = NULL, *bench = NULL, *baseline = NULL;
+    char *sources[64];
+    int nb_sources = 0;
+
+    const struct option long_options[] = {
+        {"mount",   required_argument, 0, 'm'},
+        {"source",  required_argument, 0, 's'},
+        {"path",    required_argument, 0, 'p'},
+        {"frames",  required_argument, 0, 'n'},
+        {"warmup",  required_argument, 0, 'w'},
+        {"utc",     required_argument, 0, 't'},
+        {"size",    required_argument, 0, 'g'},
+        {"bench",   required_argument, 0, 'b'},
+        {"baseline", required_argument, 0, 'r'},
+        {"help",    no_argument,       0, 'h'},
+        {}
+    };
+
+    while ((c = getopt_long(argc, argv, "m:s:p:n:w:t:g:b:r:h",
+                            long_options, NULL)) != -1) {
+        switch (c) {
+        case 'm':
+            if (add_mount(optarg)) goto error;
+            break;
+        case 's':
+            if (nb_sources >= ARRAY_SIZE(sources)) goto error;
+            sources[nb_sources++] = optarg;
+            break;
+        case 'p':
+            path = optarg;
+            break;
+        case 'n':
+            nb_frames = atoi(optarg);
+            break;
+        case 'w':
+            warmup = atoi(optarg);
+            break;
+        case 't':
+            utc = atof(optarg);
+            break;
+        case 'g':
+            if (sscanf(optarg, "%dx%d", &w, &h) != 2) goto error;
+            break;
+        case 'b':
+            bench = optarg;
+            break;
+        case 'r':
+            baseline = optarg;
+            break;
+        case 'h':
+            printf("%s", USAGE);
+            return 0;
+        default:
+            goto error;
+        }
+    }
+
+    if (g_mounts.nb) asset_set_hook(NULL, mount_hook);
+    core_init(w, h, 1.0);
+    core->time_speed = 0;
+    obj_set_attr(&core->observer->obj, "utc", utc);
+    for (i = 0; i < nb_sources; i++) {
+        if (add_source(sources[i])) goto error;
+    }
+    if (path && load_path(path)) return -1;
+
+    if (bench) {
+        c = run_bench(bench, baseline, w, h);
+        core_release();
+        return c;
+    }
+
+    for (i = 0; i < warmup; i++) {
+        set_view(0, nb_frames);
+        core_update();
+        core_render(w, h, 1.0);
+    }
+
+    printf("frame\twall_ms\tcpu_ms\tcalls\tvertices\tindices\ttexts"
+           "\tallocs\tmallocs\n");
+    for (i = 0; i < nb_frames; i++) {
+        set_view(i, nb_frames);
+        wall = get_time(CLOCK_MONOTONIC);
+        cpu = get_time(CLOCK_THREAD_CPUTIME_ID);
+        core_update();
+        core_render(w, h, 1.0);
+        wall = get_time(CLOCK_MONOTONIC) - wall;
+        cpu = get_time(CLOCK_THREAD_CPUTIME_ID) - cpu;
+        render_get_stats(core->rend, &stats);
+        arena_get_stats(core->frame_arena, &arena_stats);
+        printf("%d\t%.3f\t%.3f\t%d\t%d\t%d\t%d\t%d\t%d\n", i, wall, cpu,
+               stats.calls, stats.vertices, stats.indices, stats.texts,
+               arena_stats.allocs, arena_stats.mallocs);
+        sum[0] += wall;
+        sum[1] += cpu;
+        worst[0] = max(worst[0], wall);
+        worst[1] = max(worst[1], cpu);
+    }
+    if (nb_frames > 0) {
+        printf("# mean\t%.3f\t%.3f\n", sum[0] / nb_frames, sum[1] / nb_frames);
+        printf("# max\t%.3f\t%.3f\n", worst[0], worst[1]);
+    }
+    core_release();
+    return 0;
+
+error:
+    fprintf(stderr, "%s", USAGE);
+    return -1;
+}
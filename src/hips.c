@@ -75,10 +75,15 @@ typedef struct {
     void        *img;
     int         w, h, bpp;
     texture_t   *tex;
+    // Hash of the survey url, set when the texture is created.  We don't
+    // keep a pointer to the survey since the tile can outlive it.
+    uint32_t    hips_hash;
 } img_tile_t;
 
 // Gobal cache for all the tiles.
 static cache_t *g_cache = NULL;
+// List of all the surveys.
+static hips_t *g_hips = NULL;
 
 
 static const void *create_img_tile(
@@ -105,6 +110,7 @@ hips_t *hips_create(const char *url, double release_date,
     hips->release_date = release_date;
     hips->frame = FRAME_ASTROM;
     hips->hash = crc32(0, (void*)url, strlen(url));
+    DL_APPEND(g_hips, hips);
     return hips;
 }
 
@@ -115,14 +121,27 @@ void hips_delete(hips_t *hips)
     hips->ref--;
     assert(hips->ref >= 0);
     if (hips->ref > 0) return;
+    DL_DELETE(g_hips, hips);
     free(hips->url);
     free(hips->service_url);
-    for (i = 0; i < 12; i++)
+    for (i = 0; i < 12; i++) {
+        if (!hips->allsky.textures[i]) continue;
+        hips->gpu_size -= hips->allsky.textures[i]->size;
         texture_release(hips->allsky.textures[i]);
+    }
     json_builder_free(hips->properties);
     free(hips);
 }
 
+void hips_get_gpu_usage(void *user,
+                        void (*f)(void *user, const char *url, int64_t size))
+{
+    hips_t *hips;
+    DL_FOREACH(g_hips, hips) {
+        f(user, hips->url, hips->gpu_size);
+    }
+}
+
 void hips_set_frame(hips_t *hips, int frame)
 {
     hips->frame = frame;
@@ -174,6 +193,7 @@ static int property_handler(void* user, const char* section,
              if (strstr(value, "webp")) hips->ext = "webp";
         else if (strstr(value, "jpeg")) hips->ext = "jpg";
         else if (strstr(value, "png"))  hips->ext = "png";
+        else if (strstr(value, "geobin")) hips->ext = "geobin";
         else if (strstr(value, "eph"))  {
             hips->ext = "eph";
             hips->allsky.not_available = true;
@@ -238,18 +258,44 @@ static int del_tile(void *data)
     return 0;
 }
 
-static bool img_is_transparent(
-        const uint8_t *img, int img_w, int img_h, int bpp,
-        int x, int y, int w, int h)
+// Or together the alpha values of n RGBA pixels.  Contrary to a test on
+// each value, this loop can be vectorized by the compiler.
+static uint8_t or_alpha(const uint8_t *p, int n)
 {
-    int i, j;
-    if (bpp < 4) return false;
+    int i;
+    uint8_t ret = 0;
+    for (i = 0; i < n; i++)
+        ret |= p[i * 4 + 3];
+    return ret;
+}
+
+/*
+ * Compute the transparency mask of the four quadrants of an image in a
+ * single pass.  The bit of a quadrant is set if all its pixels are fully
+ * transparent.
+ */
+static int img_get_transparency(const uint8_t *img, int w, int h, int bpp)
+{
+    int i, q, ret = 0;
+    uint8_t alpha[4] = {};
+
+    if (bpp < 4) return 0;
     assert(bpp == 4);
-    for (i = y; i < y + h; i++)
-        for (j = x; j < x + w; j++)
-            if (img[(i * img_w + j) * 4 + 3])
-                return false;
-    return true;
+    for (i = 0; i < h / 2 * 2; i++) {
+        q = i >= h / 2;
+        alpha[q] |= or_alpha(img + i * w * 4, w / 2);
+        alpha[q + 2] |= or_alpha(img + (i * w + w / 2) * 4, w / 2);
+        // Skip the rest of the half as soon as its two quadrants are
+        // known to be non transparent.
+        if (alpha[q] && alpha[q + 2]) {
+            if (q == 1) break;
+            i = h / 2 - 1;
+        }
+    }
+    for (q = 0; q < 4; q++) {
+        if (!alpha[q]) ret |= 1 << q;
+    }
+    return ret;
 }
 
 int hips_traverse(void *user, int callback(int order, int pix, void *user))
@@ -396,12 +442,19 @@ texture_t *hips_get_tile_texture(
             *loading_complete = true;
     }
 
-    // Create texture if needed.
-    if (tile && tile->img && !tile->tex) {
+    // Create texture if needed.  If we already uploaded too much data this
+    // frame, keep the image for later and use a parent texture meanwhile.
+    if (tile && tile->img && !tile->tex &&
+            texture_upload_budget_take(tile->w * tile->h * tile->bpp)) {
         tile->tex = texture_from_data(tile->img, tile->w, tile->h, tile->bpp,
-                                      0, 0, tile->w, tile->h, 0);
+                                      0, 0, tile->w, tile->h, TF_POOL);
         free(tile->img);
         tile->img = NULL;
+        tile->hips_hash = hips->hash;
+        hips->gpu_size += tile->tex->size;
+        // The tile cost is now the size of the texture on the GPU.
+        cache_set_cost(g_cache, &(tile_key_t){hips->hash, order, pix},
+                       sizeof(tile_key_t), tile->tex->size);
     }
     if (tile && tile->tex) {
         *loading_complete = true;
@@ -420,6 +473,7 @@ texture_t *hips_get_tile_texture(
                     hips->allsky.data, hips->allsky.w, hips->allsky.h,
                     hips->allsky.bpp,
                     x, y, hips->allsky.w / nbw, hips->allsky.w / nbw, 0);
+            hips->gpu_size += hips->allsky.textures[pix]->size;
         }
         if (flags & HIPS_FORCE_USE_ALLSKY) *loading_complete = true;
         return hips->allsky.textures[pix];
@@ -710,7 +764,7 @@ static tile_t *hips_get_tile_(hips_t *hips, int order, int pix, int flags,
     assert(order >= 0);
     *code = 0;
 
-    if (!g_cache) g_cache = cache_create(CACHE_SIZE);
+    if (!g_cache) g_cache = cache_create("hips", CACHE_SIZE);
     tile = cache_get(g_cache, &key, sizeof(key));
 
     // Got a tile but it is still loading.
@@ -820,7 +874,7 @@ static const void *create_img_tile(
         int *cost, int *transparency)
 {
     void *img;
-    int i, w, h, bpp = 0;
+    int w, h, bpp = 0;
     img_tile_t *tile;
 
     // Special case for allsky tiles!  Just return an empty image tile.
@@ -839,13 +893,7 @@ static const void *create_img_tile(
     tile->w = w;
     tile->h = h;
     tile->bpp = bpp;
-    // Compute transparency.
-    for (i = 0; i < 4; i++) {
-        if (img_is_transparent(img, w, h, bpp,
-                    (i / 2) * w / 2, (i % 2) * h / 2, w / 2, h / 2)) {
-                *transparency |= 1 << i;
-        }
-    }
+    *transparency |= img_get_transparency(img, w, h, bpp);
     *cost = w * h * bpp;
     return tile;
 }
@@ -853,6 +901,14 @@ static const void *create_img_tile(
 static int delete_img_tile(void *tile_)
 {
     img_tile_t *tile = tile_;
+    hips_t *hips;
+    if (tile->tex) {
+        DL_FOREACH(g_hips, hips) {
+            if (hips->hash != tile->hips_hash) continue;
+            hips->gpu_size -= tile->tex->size;
+            break;
+        }
+    }
     texture_release(tile->tex);
     free(tile);
     return 0;
@@ -877,3 +933,73 @@ double hips_parse_date(const char *str)
     eraDtf2d("UTC", iy, im, id, ihr, imn, 0, &d1, &d2);
     return d1 - DJM0 + d2;
 }
+
+/******** TESTS ***********************************************************/
+
+#if COMPILE_TESTS
+
+// Reference implementation of img_get_transparency, testing each quadrant
+// separately.
+static int test_img_get_transparency_naive(const uint8_t *img, int w, int h)
+{
+    int q, i, j, x, y, ret = 0;
+    bool transparent;
+
+    for (q = 0; q < 4; q++) {
+        x = (q / 2) * w / 2;
+        y = (q % 2) * h / 2;
+        transparent = true;
+        for (i = y; i < y + h / 2; i++)
+            for (j = x; j < x + w / 2; j++)
+                if (img[(i * w + j) * 4 + 3]) transparent = false;
+        if (transparent) ret |= 1 << q;
+    }
+    return ret;
+}
+
+static void test_img_get_transparency(void)
+{
+    const int sizes[][2] = {{1, 1}, {2, 2}, {3, 3}, {4, 4}, {5, 8}, {8, 5},
+                            {7, 9}, {16, 16}};
+    int s, mask, full, q, w, h, i, j, x, y;
+    uint8_t *img;
+    uint32_t seed = 1;
+
+    for (s = 0; s < ARRAY_SIZE(sizes); s++) {
+        w = sizes[s][0];
+        h = sizes[s][1];
+        img = malloc(w * h * 4);
+        // For each set of non transparent quadrants, either fully opaque,
+        // or with a single opaque pixel.
+        for (mask = 0; mask < 16; mask++)
+        for (full = 0; full < 2; full++) {
+            memset(img, 0, w * h * 4);
+            for (q = 0; q < 4 && w > 1 && h > 1; q++) {
+                if (!(mask & (1 << q))) continue;
+                x = (q / 2) * w / 2;
+                y = (q % 2) * h / 2;
+                if (full) {
+                    for (i = y; i < y + h / 2; i++)
+                        for (j = x; j < x + w / 2; j++)
+                            img[(i * w + j) * 4 + 3] = 255;
+                    continue;
+                }
+                seed = seed * 1103515245 + 12345;
+                i = y + (seed >> 16) % (h / 2);
+                seed = seed * 1103515245 + 12345;
+                j = x + (seed >> 16) % (w / 2);
+                img[(i * w + j) * 4 + 3] = 1;
+            }
+            // The last row and column of odd sizes are not in any quadrant.
+            if (h % 2) img[((h - 1) * w) * 4 + 3] = 255;
+            if (w % 2) img[(w - 1) * 4 + 3] = 255;
+            assert(img_get_transparency(img, w, h, 4) ==
+                   test_img_get_transparency_naive(img, w, h));
+        }
+        free(img);
+    }
+}
+
+TEST_REGISTER(NULL, test_img_get_transparency, TEST_AUTO);
+
+#endif
@@ -89,6 +89,8 @@ struct hips {
     // The settings as passed in the create function.
     hips_settings_t settings;
     int ref; // Ref counting of hips survey.
+    int64_t gpu_size; // Size of the survey textures on the GPU.
+    hips_t *next, *prev; // List of all the surveys.
 };
 
 
@@ -109,6 +111,17 @@ hips_t *hips_create(const char *url, double release_date,
  */
 void hips_delete(hips_t *hips);
 
+/*
+ * Function: hips_get_gpu_usage
+ * Iterate the size of the textures on the GPU of all the surveys.
+ *
+ * Parameters:
+ *   user   - Data passed to the callback.
+ *   f      - Callback called for each survey.
+ */
+void hips_get_gpu_usage(void *user,
+                        void (*f)(void *user, const char *url, int64_t size));
+
 /*
  * Function: hips_get_tile
  * Get a given tile of a hips survey.
@@ -35,6 +35,11 @@ function setData(obj, data) {
   Module._geojson_remove_all_features(obj.v);
 
   obj._features = data.features; // Keep it for the filter function.
+
+  // Pack all the rings into a single buffer, so that we can add all the
+  // features in one call.
+  const sizes = [];
+  let total = 0;
   for (const feature of data.features) {
     const geo = feature.geometry;
     if (geo.type !== 'Polygon') {
@@ -45,16 +50,24 @@ function setData(obj, data) {
       console.error('Only support single ring polygons');
       continue;
     }
-    const coordinates = geo.coordinates[0];
-    const size = coordinates.length;
-    const ptr = Module._malloc(size * 16);
-    for (let i = 0; i < size; i++) {
-      Module._setValue(ptr + i * 16 + 0, coordinates[i][0], 'double');
-      Module._setValue(ptr + i * 16 + 8, coordinates[i][1], 'double');
+    sizes.push(geo.coordinates[0].length);
+    total += geo.coordinates[0].length;
+  }
+  const coordinates = new Float64Array(total * 2);
+  let i = 0;
+  for (const feature of data.features) {
+    const geo = feature.geometry;
+    if (geo.type !== 'Polygon' || geo.coordinates.length != 1) continue;
+    for (const c of geo.coordinates[0]) {
+      coordinates[i++] = c[0];
+      coordinates[i++] = c[1];
     }
-    Module._geojson_add_poly_feature(obj.v, size, ptr);
-    Module._free(ptr);
   }
+  const sizesPtr = Module.heapAlloc('i32', sizes);
+  const dataPtr = Module.heapAlloc('f64', coordinates);
+  Module._geojson_add_poly_features(obj.v, sizes.length, sizesPtr, dataPtr);
+  Module._free(dataPtr);
+  Module._free(sizesPtr);
 }
 
 /*
@@ -94,16 +107,11 @@ function queryRenderedFeatureIds(obj, point) {
   if (typeof(point) === 'object') {
     point = [point.x, point.y];
   }
-  const pointPtr = Module._malloc(16);
-  Module._setValue(pointPtr + 0, point[0], 'double');
-  Module._setValue(pointPtr + 8, point[1], 'double');
+  const pointPtr = Module.heapAlloc('f64', point);
   const size = 128; // Max number of results.
-  const retPtr = Module._malloc(4 * size);
+  const retPtr = Module.heapAlloc('i32', size);
   const nb = Module._geojson_query_rendered_features(obj.v, pointPtr, size, retPtr);
-  let ret = []
-  for (let i = 0; i < nb; i++) {
-    ret.push(Module._getValue(retPtr + i * 4, 'i32'));
-  }
+  const ret = Array.from(Module.heapView('i32', retPtr, nb));
   Module._free(pointPtr);
   Module._free(retPtr);
   return ret;
@@ -166,21 +174,18 @@ function asBox(box) {
 
 function surveyQueryRenderedFeatures(obj, box) {
   box = asBox(box)
-  const boxPtr = Module._malloc(32);
-  Module._setValue(boxPtr +  0, box[0][0], 'double');
-  Module._setValue(boxPtr +  8, box[0][1], 'double');
-  Module._setValue(boxPtr + 16, box[1][0], 'double');
-  Module._setValue(boxPtr + 24, box[1][1], 'double');
+  const boxPtr = Module.heapAlloc('f64', [box[0][0], box[0][1],
+                                          box[1][0], box[1][1]]);
   const size = 1024; // Max number of results.
-  const tilesPtr = Module._malloc(4 * size);
-  const indexPtr = Module._malloc(4 * size);
+  const tilesPtr = Module.heapAlloc('i32', size);
+  const indexPtr = Module.heapAlloc('i32', size);
   const nb = Module._geojson_survey_query_rendered_features(
     obj.v, boxPtr, size, tilesPtr, indexPtr);
+  const tiles = Module.heapView('i32', tilesPtr, nb);
+  const index = Module.heapView('i32', indexPtr, nb);
   let ret = []
   for (let i = 0; i < nb; i++) {
-    const tile = Module._getValue(tilesPtr + i * 4, 'i32*');
-    const idx = Module._getValue(indexPtr + i * 4, 'i32');
-    ret.push(g_tiles[tile][idx]);
+    ret.push(g_tiles[tiles[i]][index[i]]);
   }
   Module._free(boxPtr);
   Module._free(indexPtr);
@@ -188,11 +193,29 @@ function surveyQueryRenderedFeatures(obj, box) {
   return ret;
 }
 
+// Rebuild the features list from the columnar properties of a binary
+// ('geobin') tile.
+function featuresFromColumns(cols) {
+  const ret = [];
+  for (let i = 0; i < cols.healpix_index.length; i++) {
+    const properties = {};
+    for (const k in cols.properties) properties[k] = cols.properties[k][i];
+    ret.push({
+      type: 'Feature',
+      properties: properties,
+      geogroup_id: cols.geogroup_id[i],
+      healpix_index: cols.healpix_index[i],
+      geogroup_size: cols.geogroup_size[i]
+    });
+  }
+  return ret;
+}
+
 // Called each time a new geojson tile of a survey is loaded.
 let onNewTile = function(img, json) {
   json = Module.UTF8ToString(json);
   json = JSON.parse(json);
-  g_tiles[img] = json.features;
+  g_tiles[img] = json.features || featuresFromColumns(json);
 }
 let onNewTileSet = false;
 
@@ -0,0 +1,58 @@
+/* Stellarium Web Engine - Copyright (c) 2021 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+// Helpers to exchange bulk numeric data with the wasm heap using typed
+// arrays, instead of JSON strings or getValue/setValue loops.
+
+const HEAP_TYPES = {
+  'f64': {heap: 'HEAPF64', shift: 3},
+  'i32': {heap: 'HEAP32',  shift: 2},
+};
+
+/*
+ * Function: heapView
+ * Return a typed array view on a region of the wasm heap.
+ *
+ * No data is copied.  The view becomes invalid as soon as the heap grows,
+ * so it should be used right away, or copied with slice().
+ *
+ * Parameters:
+ *   type - 'f64' or 'i32'.
+ *   ptr  - Pointer to the data.
+ *   size - Number of values.
+ *
+ * Return:
+ *   A Float64Array or Int32Array.
+ */
+Module['heapView'] = function(type, ptr, size) {
+  const t = HEAP_TYPES[type];
+  const start = ptr >> t.shift;
+  return Module[t.heap].subarray(start, start + size);
+}
+
+/*
+ * Function: heapAlloc
+ * Allocate an array in the wasm heap.
+ *
+ * Parameters:
+ *   type   - 'f64' or 'i32'.
+ *   values - Either the number of values to allocate, or an array (or
+ *            typed array) of values to copy into the buffer.
+ *
+ * Return:
+ *   A pointer to the data, to be released with Module._free.
+ */
+Module['heapAlloc'] = function(type, values) {
+  const t = HEAP_TYPES[type];
+  const size = (typeof values === 'number') ? values : values.length;
+  const ptr = Module._malloc(Math.max(size, 1) << t.shift);
+  if (typeof values !== 'number')
+    Module[t.heap].set(values, ptr >> t.shift);
+  return ptr;
+}
@@ -26,6 +26,8 @@ Module.afterInit(function() {
   var core_get_module = Module.cwrap('core_get_module', 'number', ['string']);
   var obj_get_info_json = Module.cwrap('obj_get_info_json', 'number',
     ['number', 'number', 'string']);
+  var obj_info_from_str = Module.cwrap('obj_info_from_str', 'number',
+    ['string']);
   var obj_get_json_data_str = Module.cwrap('obj_get_json_data_str', 'number',
     ['number']);
 
@@ -386,6 +388,86 @@ Module.afterInit(function() {
     return ret;
   }
 
+  /*
+   * Function: getObjsInfo
+   * Compute numeric infos for many objects in a single call.
+   *
+   * Parameters:
+   *   objs  - Array of SweObj.
+   *   infos - Array of numeric info names ('vmag', 'radec', 'distance'...).
+   *   obs   - An observer.  If not set use current core observer.
+   *
+   * Return:
+   *   An object with the attributes:
+   *     data    - Float64Array with the values of all the objects one after
+   *               the other.  Unavailable values are set to NaN.
+   *     stride  - Number of values per object.
+   *     offsets - Dict of info name to the offset of the info in each
+   *               object values.
+   */
+  Module['getObjsInfo'] = function(objs, infos, obs) {
+    obs = obs || Module.core.observer;
+    const ids = infos.map(x => obj_info_from_str(x));
+    const offsets = {};
+    let stride = 0;
+    for (let i = 0; i < infos.length; i++) {
+      offsets[infos[i]] = stride;
+      stride += Module._obj_info_size(ids[i]);
+    }
+    const objsPtr = Module.heapAlloc('i32', objs.map(x => x.v));
+    const infosPtr = Module.heapAlloc('i32', ids);
+    const dataPtr = Module.heapAlloc('f64', objs.length * stride);
+    Module._observer_update(obs.v, true);
+    Module._obj_get_infos(objs.length, objsPtr, obs.v, ids.length, infosPtr,
+                          dataPtr);
+    const data = Module.heapView('f64', dataPtr, objs.length * stride).slice();
+    Module._free(dataPtr);
+    Module._free(infosPtr);
+    Module._free(objsPtr);
+    return {data: data, stride: stride, offsets: offsets};
+  }
+
+  /*
+   * Function: computeVisibilities
+   * Same as SweObj.computeVisibility, but for many objects at once.
+   *
+   * Parameters:
+   *   objs - Array of SweObj.
+   *   args - Same as SweObj.computeVisibility.
+   *
+   * Return:
+   *   An array with the result of SweObj.computeVisibility for each object.
+   */
+  Module['computeVisibilities'] = function(objs, args) {
+    args = args || {};
+    const obs = args.obs || Module.core.observer;
+    const startTime = args.startTime || obs.tt - 1 / 2;
+    const endTime = args.endTime || obs.tt + 1 / 2;
+    const precision = 1 / 24 / 60 / 2;
+    const nb = objs.length;
+    const objsPtr = Module.heapAlloc('i32', objs.map(x => x.v));
+    const outPtr = Module.heapAlloc('f64', nb);
+    Module._compute_events(obs.v, nb, objsPtr, 1, startTime, endTime,
+                           precision, outPtr);
+    const rises = Module.heapView('f64', outPtr, nb).slice();
+    Module._compute_events(obs.v, nb, objsPtr, 2, startTime, endTime,
+                           precision, outPtr);
+    const sets = Module.heapView('f64', outPtr, nb).slice();
+    Module._free(outPtr);
+    Module._free(objsPtr);
+    return objs.map(function(obj, i) {
+      const rise = rises[i] || null;
+      const set = sets[i] || null;
+      // Check if the object is never visible:
+      if (rise === null && set === null) {
+        let p = obj.getInfo('radec', obs);
+        p = Module.convertFrame(obs, 'ICRF', 'OBSERVED', p);
+        if (p[2] < 0) return [];
+      }
+      return [{'rise': rise, 'set': set}];
+    });
+  }
+
   var onObjChanged = Module.addFunction(function(objPtr, attr) {
     attr = Module.UTF8ToString(attr);
     for (var i = 0; i < g_listeners.length; i++) {
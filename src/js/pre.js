@@ -330,14 +330,10 @@ Module['convertFrame'] = function(obs, origin, dest, v) {
   origin = asFrame(origin);
   dest = asFrame(dest);
   var v4 = [v[0], v[1], v[2], v[3] || 0.0];
-  var ptr = Module._malloc(8 * 8);
-  var i;
-  for (i = 0; i < 4; i++)
-    Module._setValue(ptr + i * 8, v4[i], 'double');
+  var ptr = Module.heapAlloc('f64', 8);
+  Module.heapView('f64', ptr, 4).set(v4);
   Module._convert_framev4(obs.v, origin, dest, ptr, ptr + 4 * 8);
-  var ret = new Array(4);
-  for (i = 0; i < 4; i++)
-    ret[i] = Module._getValue(ptr + (4 + i) * 8, 'double')
+  var ret = Array.from(Module.heapView('f64', ptr + 4 * 8, 4));
   Module._free(ptr);
   return ret;
 }
@@ -356,10 +352,7 @@ Module['convertFrame'] = function(obs, origin, dest, v) {
 Module['lookAt'] = function(pos, duration) {
   if (duration === undefined)
     duration = 1.0;
-  var v = Module._malloc(3 * 8);
-  var i;
-  for (i = 0; i < 3; i++)
-    Module._setValue(v + i * 8, pos[i], 'double');
+  var v = Module.heapAlloc('f64', [pos[0], pos[1], pos[2]]);
   Module._core_lookat(v, duration);
   Module._free(v);
 }
@@ -392,6 +385,41 @@ Module['zoomTo'] = function(fov, duration) {
   Module._core_zoomto(fov, duration);
 }
 
+/*
+ * Function: runBenchmark
+ * Run one of the benchmark scripts of data/bench.
+ *
+ * The benchmark runs as part of the normal rendering loop, and the engine
+ * time is fixed to advance by a constant step each frame until it is done.
+ *
+ * Parameters:
+ *   script   - Name of a bundled benchmark (eg: 'milky-way'), or a
+ *              benchmark script object.
+ *   baseline - Optional result object of a previous run.  If set the
+ *              result contains the list of the regressions.
+ *
+ * Return:
+ *   A promise that resolves to the result object of the benchmark.
+ */
+Module['runBenchmark'] = function(script, baseline) {
+  if (typeof script !== 'string') script = JSON.stringify(script);
+  if (baseline) baseline = JSON.stringify(baseline);
+  const bench_start = Module.cwrap('bench_start', 'number',
+                                   ['string', 'string']);
+  if (bench_start(script, baseline || null) !== 0)
+    return Promise.reject(new Error('Cannot start benchmark'));
+  return new Promise(function(resolve) {
+    const check = function() {
+      if (Module._bench_is_running()) {
+        requestAnimationFrame(check);
+        return;
+      }
+      resolve(JSON.parse(Module.UTF8ToString(Module._bench_get_result())));
+    };
+    requestAnimationFrame(check);
+  });
+}
+
 /*
  * Function: otypeToStr
  * Get the name for an object's otype.
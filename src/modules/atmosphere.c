@@ -16,21 +16,14 @@
  *
  */
 
-/*
- * Type: atmosphere_t
- * Atmosphere module struct.
- */
-typedef struct atmosphere {
-    obj_t           obj;
-    // The twelves tile textures of healpix at order 0 and construction bufs.
-    struct {
-        texture_t       *tex;
-        float           (*buf)[3];  // color buffer (in xyY).
-        bool            visible;
-    } tiles[12];
-    fader_t         visible;
-    double          turbidity;
-} atmosphere_t;
+// Split of the order 1 healpix tiles the atmosphere is rendered on.
+#define GRID_SPLIT 4
+#define GRID_SIZE ((GRID_SPLIT + 1) * (GRID_SPLIT + 1))
+
+// Sun or moon move (rad) and magnitude change after which we recompute the
+// luminance of the grid.
+#define CACHE_MAX_MOVE (0.05 * DD2R)
+#define CACHE_MAX_VMAG_CHANGE 0.01
 
 // All the precomputed data
 typedef struct {
@@ -60,6 +53,46 @@ typedef struct {
     float cos_grid_angular_step;
 } render_data_t;
 
+/*
+ * Type: atmosphere_t
+ * Atmosphere module struct.
+ */
+typedef struct atmosphere {
+    obj_t           obj;
+    // The twelves tile textures of healpix at order 0 and construction bufs.
+    struct {
+        texture_t       *tex;
+        float           (*buf)[3];  // color buffer (in xyY).
+        bool            visible;
+    } tiles[12];
+    fader_t         visible;
+    double          turbidity;
+
+    // Positions of the grid vertices of the 48 order 1 tiles.
+    float           (*grids)[GRID_SIZE][3];
+
+    // Luminance of the grids, and eye adaptation values of each tile.  This
+    // is only recomputed when the sun or moon moved enough.
+    struct {
+        bool            valid;
+        render_data_t   data;
+        double          sun_vmag;
+        double          moon_vmag;
+        double          turbidity;
+        double          bortle_index;
+        double          phi;
+        double          hm;
+        int             year;
+        int             month;
+        float           lum[48][GRID_SIZE];
+        struct {
+            double  sum;
+            double  max;
+            int     nb;
+        } stats[48];
+    } cache;
+} atmosphere_t;
+
 static double F2(const double *lam, double cos_theta,
                  double gamma, double cos_gamma)
 {
@@ -170,33 +203,113 @@ static void prepare_skybrightness(
                           eraSepp(sun_pos, zenith));
 }
 
-static float compute_lum(void *user, const float pos[3])
+/*
+ * Compute the luminance of all the vertices of the tiles grids in a single
+ * pass, and reduce the eye adaptation values of each tile at the same time.
+ */
+static void compute_lum_grids(atmosphere_t *atm)
 {
-    render_data_t *d = user;
-    double p[3] = {pos[0], pos[1], pos[2]};
-    const double zenith[3] = {0, 0, 1};
-    float lum;
-    // Our formula does not work below the horizon.
-    p[2] = fabs(p[2]);
-    lum = skybrightness_get_luminance(&d->skybrightness,
-                min(vec3_dot(p, d->moon_pos), d->cos_grid_angular_step),
-                min(vec3_dot(p, d->sun_pos), d->cos_grid_angular_step),
-                vec3_dot(p, zenith));
-    lum *= d->eclipse_factor;
-
-    lum += d->light_pollution_lum;
-
-    // Update luminance sum for eye adaptation.
-    // If we are below horizon use the precomputed landscape luminance.
-    if (pos[2] > 0) {
-        d->sum_lum += lum;
-        d->nb_lum++;
-        d->max_lum = max(d->max_lum, lum);
+    const render_data_t *d = &atm->cache.data;
+    const skybrightness_t *sb = &d->skybrightness;
+    const float cos_step = d->cos_grid_angular_step;
+    const float eclipse_factor = d->eclipse_factor;
+    const float light_pollution_lum = d->light_pollution_lum;
+    float sun[3], moon[3], cos_sun, cos_moon, z, lum;
+    const float *pos;
+    int t, i;
+
+    vec3_to_float(d->sun_pos, sun);
+    vec3_to_float(d->moon_pos, moon);
+
+    for (t = 0; t < 48; t++) {
+        atm->cache.stats[t].sum = 0;
+        atm->cache.stats[t].max = 0;
+        atm->cache.stats[t].nb = 0;
+        for (i = 0; i < GRID_SIZE; i++) {
+            pos = atm->grids[t][i];
+            // Our formula does not work below the horizon.
+            z = fabsf(pos[2]);
+            cos_moon = pos[0] * moon[0] + pos[1] * moon[1] + z * moon[2];
+            cos_sun = pos[0] * sun[0] + pos[1] * sun[1] + z * sun[2];
+            lum = skybrightness_get_luminance(sb, min(cos_moon, cos_step),
+                                              min(cos_sun, cos_step), z);
+            lum = lum * eclipse_factor + light_pollution_lum;
+            atm->cache.lum[t][i] = lum;
+
+            // If we are below horizon use the precomputed landscape
+            // luminance for eye adaptation.
+            if (pos[2] > 0) {
+                atm->cache.stats[t].sum += lum;
+                atm->cache.stats[t].nb++;
+                atm->cache.stats[t].max = max(atm->cache.stats[t].max, lum);
+            } else {
+                atm->cache.stats[t].max = max(atm->cache.stats[t].max,
+                                              d->landscape_lum);
+            }
+        }
     }
-    else {
-        d->max_lum = max(d->max_lum, d->landscape_lum);
+}
+
+static void init_grids(atmosphere_t *atm)
+{
+    int t, i;
+    uv_map_t map;
+    double grid[GRID_SIZE][4];
+
+    atm->grids = calloc(48, sizeof(*atm->grids));
+    for (t = 0; t < 48; t++) {
+        uv_map_init_healpix(&map, 1, t, true, true);
+        uv_map_grid(&map, GRID_SPLIT, grid, NULL);
+        for (i = 0; i < GRID_SIZE; i++)
+            vec3_to_float(grid[i], atm->grids[t][i]);
     }
-    return lum;
+}
+
+/*
+ * Update the cached luminance grid if the sun or the moon moved too much,
+ * or if any other parameter of the model changed since the last frame.
+ */
+static void update_cache(atmosphere_t *atm, const painter_t *painter,
+                         const double sun_pos[3], double sun_vmag,
+                         const double moon_pos[3], double moon_vmag)
+{
+    const observer_t *obs = painter->obs;
+    const double cos_max_move = cos(CACHE_MAX_MOVE);
+    int year, month;
+
+    mjd2gcal(obs->utc, &year, &month);
+    if (    atm->cache.valid &&
+            vec3_dot(sun_pos, atm->cache.data.sun_pos) > cos_max_move &&
+            vec3_dot(moon_pos, atm->cache.data.moon_pos) > cos_max_move &&
+            fabs(sun_vmag - atm->cache.sun_vmag) < CACHE_MAX_VMAG_CHANGE &&
+            fabs(moon_vmag - atm->cache.moon_vmag) < CACHE_MAX_VMAG_CHANGE &&
+            atm->cache.turbidity == atm->turbidity &&
+            atm->cache.bortle_index == core->bortle_index &&
+            atm->cache.phi == obs->phi &&
+            atm->cache.hm == obs->hm &&
+            atm->cache.year == year &&
+            atm->cache.month == month)
+        return;
+
+    if (!atm->grids) init_grids(atm);
+    atm->cache.valid = true;
+    atm->cache.sun_vmag = sun_vmag;
+    atm->cache.moon_vmag = moon_vmag;
+    atm->cache.turbidity = atm->turbidity;
+    atm->cache.bortle_index = core->bortle_index;
+    atm->cache.phi = obs->phi;
+    atm->cache.hm = obs->hm;
+    atm->cache.year = year;
+    atm->cache.month = month;
+
+    atm->cache.data = prepare_render_data(sun_pos, sun_vmag,
+                                          moon_pos, moon_vmag,
+                                          atm->turbidity, core->bortle_index);
+    // This is quite ad-hoc as in reality we are using a HIPS grid
+    atm->cache.data.cos_grid_angular_step = cos(15. * DD2R);
+    prepare_skybrightness(&atm->cache.data.skybrightness,
+                          painter, sun_pos, moon_pos, moon_vmag);
+    compute_lum_grids(atm);
 }
 
 static int atmosphere_update(obj_t *obj, double dt)
@@ -205,11 +318,12 @@ static int atmosphere_update(obj_t *obj, double dt)
     return fader_update(&atm->visible, dt);
 }
 
-static void render_tile(atmosphere_t *atm, const painter_t *painter,
+static void render_tile(atmosphere_t *atm, painter_t *painter,
                         int order, int pix)
 {
-    int split, i;
+    int i;
     uv_map_t map;
+    render_data_t *data = &atm->cache.data;
 
     if (painter_is_healpix_clipped(painter, FRAME_OBSERVED, order, pix))
         return;
@@ -218,9 +332,15 @@ static void render_tile(atmosphere_t *atm, const painter_t *painter,
             render_tile(atm, painter, order + 1, pix * 4 + i);
         return;
     }
-    split = 4; // Adhoc split value to look good while not being too slow.
+
+    // Update luminance sum for eye adaptation.
+    data->sum_lum += atm->cache.stats[pix].sum;
+    data->nb_lum += atm->cache.stats[pix].nb;
+    data->max_lum = max(data->max_lum, atm->cache.stats[pix].max);
+
     uv_map_init_healpix(&map, order, pix, true, true);
-    paint_quad(painter, FRAME_OBSERVED, &map, split);
+    painter->atm.lum = atm->cache.lum[pix];
+    paint_quad(painter, FRAME_OBSERVED, &map, GRID_SPLIT);
 }
 
 static int atmosphere_render(const obj_t *obj, const painter_t *painter_)
@@ -228,7 +348,7 @@ static int atmosphere_render(const obj_t *obj, const painter_t *painter_)
     atmosphere_t *atm = (atmosphere_t*)obj;
     obj_t *sun, *moon;
     double sun_pos[4], moon_pos[4], sun_vmag, moon_vmag;
-    render_data_t data;
+    render_data_t *data;
     int i;
     painter_t painter = *painter_;
     core->lwsky_average = 0.0001;
@@ -246,43 +366,38 @@ static int atmosphere_render(const obj_t *obj, const painter_t *painter_)
     obj_get_info(sun, obs, INFO_VMAG, &sun_vmag);
     obj_get_info(moon, obs, INFO_VMAG, &moon_vmag);
 
-    // XXX: this could be cached!
-    data = prepare_render_data(sun_pos, sun_vmag, moon_pos, moon_vmag,
-                               atm->turbidity, core->bortle_index);
-    // This is quite ad-hoc as in reality we are using a HIPS grid
-    data.cos_grid_angular_step = cos(15. * DD2R);
-    prepare_skybrightness(&data.skybrightness,
-            &painter, sun_pos, moon_pos, moon_vmag);
+    update_cache(atm, &painter, sun_pos, sun_vmag, moon_pos, moon_vmag);
+    data = &atm->cache.data;
 
     // Set the shader attributes.
-    painter.atm.p[0]  = data.Px[0];
-    painter.atm.p[1]  = data.Px[1];
-    painter.atm.p[2]  = data.Px[2];
-    painter.atm.p[3]  = data.Px[3];
-    painter.atm.p[4]  = data.Px[4];
-    painter.atm.p[5]  = data.kx;
-
-    painter.atm.p[6]  = data.Py[0];
-    painter.atm.p[7]  = data.Py[1];
-    painter.atm.p[8]  = data.Py[2];
-    painter.atm.p[9]  = data.Py[3];
-    painter.atm.p[10] = data.Py[4];
-    painter.atm.p[11] = data.ky;
-
-    vec3_to_float(sun_pos, painter.atm.sun);
-    painter.atm.compute_lum = compute_lum;
-    painter.atm.user = &data;
+    painter.atm.p[0]  = data->Px[0];
+    painter.atm.p[1]  = data->Px[1];
+    painter.atm.p[2]  = data->Px[2];
+    painter.atm.p[3]  = data->Px[3];
+    painter.atm.p[4]  = data->Px[4];
+    painter.atm.p[5]  = data->kx;
+
+    painter.atm.p[6]  = data->Py[0];
+    painter.atm.p[7]  = data->Py[1];
+    painter.atm.p[8]  = data->Py[2];
+    painter.atm.p[9]  = data->Py[3];
+    painter.atm.p[10] = data->Py[4];
+    painter.atm.p[11] = data->ky;
+
+    vec3_to_float(data->sun_pos, painter.atm.sun);
     painter.flags |= PAINTER_ADD | PAINTER_ATMOSPHERE_SHADER;
     painter.color[3] = atm->visible.value;
 
-    data.max_lum = 0;
+    data->sum_lum = 0;
+    data->max_lum = 0;
+    data->nb_lum = 0;
     for (i = 0; i < 12; i++) {
         render_tile(atm, &painter, 0, i);
     }
 
-    core_report_luminance_in_fov(data.max_lum, true);
-    if (data.nb_lum)
-        core->lwsky_average = data.sum_lum / data.nb_lum;
+    core_report_luminance_in_fov(data->max_lum, true);
+    if (data->nb_lum)
+        core->lwsky_average = data->sum_lum / data->nb_lum;
     return 0;
 }
 
@@ -18,6 +18,14 @@ enum {
     LABEL_DISPLAY_NATIVE        = 1,
 };
 
+// Max angle between two points of the tessellated boundaries.  At this
+// step the chord error is below a pixel down to a fov of about 0.5°.
+#define BOUNDS_STEP (0.25 * DD2R)
+// Max chord error (px) allowed when rendering the cached boundaries.
+#define BOUNDS_MAX_ERROR 0.5
+// Max number of cached points we skip when zoomed out.
+#define BOUNDS_MAX_STRIDE 16
+
 /*
  * Type: anchor_t
  * An anchor point of a constellation texture.
@@ -27,6 +35,16 @@ typedef struct {
     int     hip;
 } anchor_t;
 
+/*
+ * Type: bound_edge_t
+ * A tessellated edge of a constellation boundaries.
+ */
+typedef struct {
+    int     start;  // Index of the first point.
+    int     size;   // Number of points.
+    double  cap[4]; // Bounding cap (ICRF).
+} bound_edge_t;
+
 /*
  * Type: constellation_t
  * Object representing a single constellation.
@@ -51,8 +69,16 @@ typedef struct constellation {
 
     double last_update; // Last update time in TT
     double (*stars_pos)[3]; // ICRF/observer pos for all stars.
+    double *stars_vmag; // Magnitude of all stars.
     double lines_cap[4]; // Bounding cap of the lines (ICRF). zero if no stars.
     double pvo[2][4];
+
+    // Boundaries, tessellated once when the constellation is created.
+    struct {
+        double      (*points)[3]; // Points of all the edges (ICRF).
+        bound_edge_t *edges;
+        double      cap[4]; // Bounding cap (ICRF).  Zero if no edges.
+    } bounds;
 } constellation_t;
 
 /*
@@ -70,6 +96,7 @@ typedef struct constellations {
 } constellations_t;
 
 static int constellation_update(constellation_t *con, const observer_t *obs);
+static void constellation_create_bounds(constellation_t *con);
 
 
 // Test if a shape in clipping coordinates is clipped or not.
@@ -151,6 +178,7 @@ static int constellation_init(obj_t *obj, json_value *args)
     cons->info = *info;
     strcpy(cons->obj.type, "Con");
     constellation_set_image(obj);
+    constellation_create_bounds(cons);
 
     return 0;
 }
@@ -185,6 +213,7 @@ static int constellation_create_stars(constellation_t *cons)
         if (!cons->stars[i]) nb_err++;
     }
     cons->stars_pos = calloc(cons->count, sizeof(*cons->stars_pos));
+    cons->stars_vmag = calloc(cons->count, sizeof(*cons->stars_vmag));
     if (nb_err) {
         LOG_W("%d stars not found in constellation %s",
               nb_err, cons->info.id);
@@ -308,7 +337,9 @@ static void line_animation_effect(double pos[2][4], double k)
 static int constellation_update(constellation_t *con, const observer_t *obs)
 {
     // The position of a constellation is its middle point.
-    double pvo[2][4], pos[4] = {0, 0, 0, 0};
+    double pos[4] = {0, 0, 0, 0};
+    double (*table)[9]; // pvo + vmag of each star.
+    const int infos[] = {INFO_PVO, INFO_VMAG};
     int i;
     if (con->error) return -1;
 
@@ -322,12 +353,17 @@ static int constellation_update(constellation_t *con, const observer_t *obs)
     }
     con->last_update = obs->tt;
 
+    // Get all the stars positions and magnitudes in a single call.
+    table = malloc(con->count * sizeof(*table));
+    obj_get_infos(con->count, con->stars, obs,
+                  ARRAY_SIZE(infos), infos, (double*)table);
     for (i = 0; i < con->count; i++) {
         if (!con->stars[i]) continue;
-        obj_get_pvo(con->stars[i], obs, pvo);
-        vec3_normalize(pvo[0], con->stars_pos[i]);
+        vec3_normalize(table[i], con->stars_pos[i]);
+        con->stars_vmag[i] = table[i][8];
         vec3_add(pos, con->stars_pos[i], pos);
     }
+    free(table);
     if (vec3_norm2(pos) == 0) return 1; // No stars loaded yet.
 
     vec3_normalize(pos, pos);
@@ -370,13 +406,97 @@ static void spherical_project(
     mat3_mul_vec3(rnpb, out, out);
 }
 
+// Get an edge of the boundaries as a line in the spherical_project uv space.
+static void get_edge(const constellation_infos_t *info, int i,
+                     double line[2][4])
+{
+    memset(line, 0, 2 * sizeof(line[0]));
+    memcpy(line[0], info->edges[i][0], 2 * sizeof(double));
+    memcpy(line[1], info->edges[i][1], 2 * sizeof(double));
+    if (line[1][0] < line[0][0]) line[1][0] += 2 * M_PI;
+}
+
+static int get_edge_split(const double line[2][4])
+{
+    return max(1, ceil(max(fabs(line[1][0] - line[0][0]),
+                           fabs(line[1][1] - line[0][1])) / BOUNDS_STEP));
+}
+
+/*
+ * Tessellate all the boundaries edges into a single array of points, and
+ * compute their bounding cap, so that we only have to project the points
+ * when we render them.
+ */
+static void constellation_create_bounds(constellation_t *con)
+{
+    const constellation_infos_t *info = &con->info;
+    const uv_map_t map = {.map = spherical_project};
+    double line[2][4], uv[4], p[4], center[3] = {0};
+    double (*points)[3], *cap;
+    int i, j, split, nb = 0;
+
+    if (!info->nb_edges) return;
+    con->bounds.edges = calloc(info->nb_edges, sizeof(*con->bounds.edges));
+    for (i = 0; i < info->nb_edges; i++) {
+        get_edge(info, i, line);
+        con->bounds.edges[i].start = nb;
+        con->bounds.edges[i].size = get_edge_split(line) + 1;
+        nb += con->bounds.edges[i].size;
+    }
+    con->bounds.points = calloc(nb, sizeof(*con->bounds.points));
+    for (i = 0; i < info->nb_edges; i++) {
+        get_edge(info, i, line);
+        points = con->bounds.points + con->bounds.edges[i].start;
+        split = con->bounds.edges[i].size - 1;
+        for (j = 0; j <= split; j++) {
+            vec4_mix(line[0], line[1], (double)j / split, uv);
+            uv_map(&map, uv, p, NULL);
+            vec3_normalize(p, points[j]);
+            vec3_add(center, points[j], center);
+        }
+        // Edge cap, centered on the middle point.
+        cap = con->bounds.edges[i].cap;
+        vec3_mix(points[0], points[split], 0.5, cap);
+        vec3_normalize(cap, cap);
+        cap[3] = 1.0;
+        for (j = 0; j <= split; j++) cap_extends(cap, points[j]);
+    }
+    vec3_normalize(center, con->bounds.cap);
+    con->bounds.cap[3] = 1.0;
+    for (i = 0; i < nb; i++)
+        cap_extends(con->bounds.cap, con->bounds.points[i]);
+}
+
+/*
+ * Compute the stride to use to render the cached boundary points, so that
+ * the chord error stays below BOUNDS_MAX_ERROR pixel.  The chord error of
+ * an arc of angle a is about a² / 8.
+ *
+ * Return 0 if even the full resolution points are not precise enough, in
+ * which case we have to use an adaptive split.
+ */
+static int get_bounds_stride(const projection_t *proj)
+{
+    int stride;
+    double a, px_per_rad = proj->window_size[1] / proj->fovy;
+
+    for (stride = BOUNDS_MAX_STRIDE; stride >= 1; stride /= 2) {
+        a = stride * BOUNDS_STEP;
+        if (a * a / 8 * px_per_rad <= BOUNDS_MAX_ERROR) return stride;
+    }
+    return 0;
+}
+
 static int render_bounds(const constellation_t *con,
                          const painter_t *painter_,
                          bool selected)
 {
-    int i;
-    const constellation_infos_t *info;
-    double line[2][4] = {};
+    int i, j, n, stride;
+    const constellation_infos_t *info = &con->info;
+    double line[2][4];
+    const double (*points)[3];
+    double (*tmp)[3];
+    const bound_edge_t *edge;
     painter_t painter = *painter_;
     const constellations_t *cons = (const constellations_t*)con->obj.parent;
     uv_map_t map = {
@@ -387,8 +507,8 @@ static int render_bounds(const constellation_t *con,
         painter.color[3] *= cons->bounds_visible.value * con->visible.value;
     }
     if (!painter.color[3]) return 0;
-    if (vec3_norm2(con->lines_cap) == 0) return 0;
-    if (painter_is_cap_clipped(&painter, FRAME_ICRF, con->lines_cap))
+    if (vec3_norm2(con->bounds.cap) == 0) return 0;
+    if (painter_is_cap_clipped(&painter, FRAME_ICRF, con->bounds.cap))
         return 0;
 
     if (selected)
@@ -397,14 +517,30 @@ static int render_bounds(const constellation_t *con,
         vec4_set(painter.color, 0.8, 0.34, 0.34, 0.2 * painter.color[3]);
     painter.lines.dash_ratio = 0.85;
     painter.lines.dash_length = 8;
-    info = &con->info;
-    if (!info) return 0;
+    stride = get_bounds_stride(painter.proj);
     for (i = 0; i < info->nb_edges; i++) {
-        memcpy(line[0], info->edges[i][0], 2 * sizeof(double));
-        memcpy(line[1], info->edges[i][1], 2 * sizeof(double));
-        if (line[1][0] < line[0][0]) line[1][0] += 2 * M_PI;
-        paint_line(&painter, FRAME_ICRF, line, &map, 0,
-                   PAINTER_SKIP_DISCONTINUOUS);
+        edge = &con->bounds.edges[i];
+        if (painter_is_cap_clipped(&painter, FRAME_ICRF, edge->cap))
+            continue;
+        get_edge(info, i, line);
+        if (!stride) {
+            paint_line(&painter, FRAME_ICRF, line, &map, 0,
+                       PAINTER_SKIP_DISCONTINUOUS);
+            continue;
+        }
+        points = (const double (*)[3])(con->bounds.points + edge->start);
+        n = edge->size;
+        if (stride > 1) {
+            // Keep one point every stride, plus the last one.
+            n = (edge->size - 2) / stride + 2;
+            tmp = arena_alloc(core->frame_arena, n * sizeof(*tmp));
+            for (j = 0; j < n - 1; j++)
+                vec3_copy(points[j * stride], tmp[j]);
+            vec3_copy(points[edge->size - 1], tmp[n - 1]);
+            points = (const double (*)[3])tmp;
+        }
+        paint_line_points(&painter, FRAME_ICRF, n, points, line, &map,
+                          PAINTER_SKIP_DISCONTINUOUS);
     }
     return 0;
 }
@@ -508,8 +644,7 @@ static int render_lines(constellation_t *con, const painter_t *_painter,
     int i;
     double (*lines)[4];
     double lines_color[4];
-    double mag[2], radius[2], visible, opacity;
-    observer_t *obs = painter.obs;
+    double radius[2], visible, opacity;
     const constellations_t *cons = (const constellations_t*)con->obj.parent;
 
     visible = cons->lines_visible.value * con->visible.value;
@@ -534,10 +669,8 @@ static int render_lines(constellation_t *con, const painter_t *_painter,
 
     for (i = 0; i < con->count; i += 2) {
         if (!con->stars[i + 0] || !con->stars[i + 1]) continue;
-        obj_get_info(con->stars[i + 0], obs, INFO_VMAG, &mag[0]);
-        obj_get_info(con->stars[i + 1], obs, INFO_VMAG, &mag[1]);
-        core_get_point_for_mag(mag[0], &radius[0], NULL);
-        core_get_point_for_mag(mag[1], &radius[1], NULL);
+        core_get_point_for_mag(con->stars_vmag[i + 0], &radius[0], NULL);
+        core_get_point_for_mag(con->stars_vmag[i + 1], &radius[1], NULL);
         radius[0] = core_get_apparent_angle_for_point(painter.proj, radius[0]);
         radius[1] = core_get_apparent_angle_for_point(painter.proj, radius[1]);
         // Add some space, using ad-hoc formula.
@@ -794,6 +927,9 @@ static void constellation_del(obj_t *obj)
     }
     free(con->stars);
     free(con->stars_pos);
+    free(con->stars_vmag);
+    free(con->bounds.points);
+    free(con->bounds.edges);
 }
 
 static void constellation_get_2d_ellipse(const obj_t *obj,
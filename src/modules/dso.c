@@ -18,6 +18,9 @@
 
 #define DSO_DEFAULT_VMAG 16.0
 
+// Number of DSOs of a tile we select and project together when rendering.
+#define RENDER_BATCH_SIZE 64
+
 static obj_klass_t dso_klass;
 
 /*
@@ -68,6 +71,9 @@ typedef struct tile {
     int         nb;
     dso_t       *sources;
     dso_clip_data_t *sources_quick;
+    // Ellipse points of each source, as returned by
+    // painter_get_ellipse_points, so that we only have to project them.
+    double      (*ellipses)[3][3];
 } tile_t;
 
 typedef struct survey survey_t;
@@ -95,11 +101,6 @@ typedef struct {
 // Static instance.
 static dsos_t *g_dsos = NULL;
 
-static uint64_t pix_to_nuniq(int order, int pix)
-{
-    return pix + 4 * (1L << (2 * order));
-}
-
 static void nuniq_to_pix(uint64_t nuniq, int *order, int *pix)
 {
     *order = log2(nuniq / 4) / 2;
@@ -218,6 +219,7 @@ static int del_tile(void *data)
     }
     free(tile->sources);
     free(tile->sources_quick);
+    free(tile->ellipses);
     free(tile);
     return 0;
 }
@@ -348,10 +350,15 @@ static int on_file_tile_loaded(const char type[4],
 
     // Sort DSO in tile by display magnitude
     qsort(tile->sources, tile->nb, sizeof(dso_t), dso_cmp);
-    // Create a small table with all data used for fast tile iteration
+    // Create small tables with all data used for fast tile iteration
     tile->sources_quick = calloc(tile->nb, sizeof(dso_clip_data_t));
-    for (i = 0; i < tile->nb; ++i)
-        tile->sources_quick[i] = tile->sources[i].clip_data;
+    tile->ellipses = calloc(tile->nb, sizeof(*tile->ellipses));
+    for (i = 0; i < tile->nb; ++i) {
+        s = &tile->sources[i];
+        tile->sources_quick[i] = s->clip_data;
+        painter_get_ellipse_points(s->ra, s->de, s->angle, s->smax, s->smin,
+                                   tile->ellipses[i]);
+    }
 
     // If we have a json header, check for a children mask value.
     if (json) {
@@ -372,7 +379,9 @@ static const void *dsos_create_tile(void *user, int order, int pix, void *data,
     survey_t *survey = user;
     eph_load(data, size, USER_PASS(survey, &tile, transparency),
              on_file_tile_loaded);
-    if (tile) *cost = tile->nb * sizeof(*tile->sources);
+    if (tile) *cost = tile->nb * (sizeof(*tile->sources) +
+                                  sizeof(*tile->sources_quick) +
+                                  sizeof(*tile->ellipses));
     return tile;
 }
 
@@ -405,13 +414,13 @@ static tile_t *get_tile(dsos_t *dsos, survey_t *survey, int order, int pix,
 }
 
 static void compute_hint_transformation(
-        const painter_t *painter,
-        float ra, float de, float angle,
-        float size_x, float size_y, int symbol,
+        const painter_t *painter, const dso_t *s, const double points[3][3],
         double win_pos[2], double win_size[2], double *win_angle)
 {
-    painter_project_ellipse(painter, FRAME_ASTROM, ra, de, angle,
-                            size_x, size_y, win_pos, win_size, win_angle);
+    const int symbol = s->symbol;
+    painter_project_ellipse_points(painter, FRAME_ASTROM, points,
+                                   !isnan(s->angle) || !isnan(s->smin),
+                                   win_pos, win_size, win_angle);
 
     win_size[0] = max(win_size[0], symbol == SYMBOL_GALAXY ? 6 : 12);
     win_size[1] = max(win_size[1], 12);
@@ -425,10 +434,13 @@ static void dso_get_2d_ellipse(const obj_t *obj, const observer_t *obs,
 {
     const dso_t *dso = (dso_t*)obj;
     painter_t tmp_painter;
+    double points[3][3];
     tmp_painter.obs = obs;
     tmp_painter.proj = proj;
-    compute_hint_transformation(&tmp_painter, dso->ra, dso->de, dso->angle,
-            dso->smax, dso->smin, dso->symbol, win_pos, win_size, win_angle);
+    painter_get_ellipse_points(dso->ra, dso->de, dso->angle,
+                               dso->smax, dso->smin, points);
+    compute_hint_transformation(&tmp_painter, dso, points,
+                                win_pos, win_size, win_angle);
     win_size[0] /= 2.0;
     win_size[1] /= 2.0;
 }
@@ -504,27 +516,31 @@ static void dso_render_label(const dso_t *s,
 }
 
 
-// Render a DSO from its data.
-static int dso_render_from_data(const dso_t *s,
-                                const painter_t *painter, uint64_t hint)
+/*
+ * Check if a DSO needs to be rendered, using only its clip data.
+ *
+ * Return:
+ *   -1 if the DSO and all the fainter ones are too faint.
+ *    0 if the DSO is not visible.
+ *    1 if the DSO should be rendered.  In that case we also return the
+ *      hints limit magnitude to use.
+ */
+static int dso_select(const dso_t *s, const dso_clip_data_t *clip,
+                      const painter_t *painter, double *hints_limit_mag)
 {
-    double color[4];
-    double win_pos[2], win_size[2], win_angle, hints_limit_mag;
     const bool selected = (&s->obj == core->selection);
-    double opacity;
-    painter_t tmp_painter;
-    const float vmag = s->display_vmag;
+    const float vmag = clip->display_vmag;
     const double hints_mag_offset = g_dsos->hints_mag_offset - 0.8;
 
-    hints_limit_mag = painter->hints_limit_mag - 0.5 + hints_mag_offset;
+    *hints_limit_mag = painter->hints_limit_mag - 0.5 + hints_mag_offset;
 
     // Allow to select DSO a bit fainter than the faintest star
     // as they tend to be more visible as they are extended objects.
     if (vmag > painter->stars_limit_mag + 1.5 || vmag > painter->hard_limit_mag)
-        return 1;
+        return -1;
 
     // Check that it's intersecting with current viewport
-    if (painter_is_cap_clipped(painter, FRAME_ASTROM, s->bounding_cap))
+    if (painter_is_cap_clipped(painter, FRAME_ASTROM, clip->bounding_cap))
         return 0;
 
     // Special case for Open Clusters, for which the limiting magnitude
@@ -532,29 +548,39 @@ static int dso_render_from_data(const dso_t *s,
     if (s->symbol == SYMBOL_OPEN_GALACTIC_CLUSTER ||
         s->symbol == SYMBOL_CLUSTER_OF_STARS ||
         s->symbol == SYMBOL_MULTIPLE_DEFAULT) {
-        hints_limit_mag = painter->hints_limit_mag - 2. + hints_mag_offset;
+        *hints_limit_mag = painter->hints_limit_mag - 2. + hints_mag_offset;
     }
 
     if (s->smax == 0) {
         // DSO without shape don't need to have labels displayed unless they are
         // much zoomed or selected
-        hints_limit_mag = painter->stars_limit_mag - 10 + hints_mag_offset;
+        *hints_limit_mag = painter->stars_limit_mag - 10 + hints_mag_offset;
     }
 
     if (selected)
-        hints_limit_mag = 99;
+        *hints_limit_mag = 99;
 
-    if (vmag > hints_limit_mag + 2)
+    if (vmag > *hints_limit_mag + 2)
         return 0;
+    return 1;
+}
 
-    compute_hint_transformation(painter, s->ra, s->de, s->angle,
-            s->smax, s->smin, s->symbol, win_pos, win_size,
-            &win_angle);
+// Render a DSO once its ellipse has been projected.
+static void dso_render_projected(const dso_t *s, const painter_t *painter,
+                                 double hints_limit_mag,
+                                 const double win_pos[2],
+                                 const double win_size[2], double win_angle)
+{
+    double color[4];
+    const bool selected = (&s->obj == core->selection);
+    double opacity;
+    painter_t tmp_painter;
+    const float vmag = s->display_vmag;
 
     // Skip if 2D circle is outside screen (TODO intersect 2D ellipse instead)
     if (painter_is_2d_circle_clipped(painter, win_pos,
                                      max(win_size[0], win_size[1]) / 2))
-        return 0;
+        return;
 
     areas_add_ellipse(core->areas, win_pos, win_angle,
                       win_size[0] / 2, win_size[1] / 2, &s->obj);
@@ -563,10 +589,10 @@ static int dso_render_from_data(const dso_t *s,
     // But the previous steps are still necessary as we want to be able to
     // select them even without hints/names
     if (painter->color[3] < 0.01 && !selected)
-        return 0;
+        return;
 
     if (!g_dsos->hints_visible)
-        return 0;
+        return;
 
     if (vmag <= hints_limit_mag + 0.5) {
         tmp_painter = *painter;
@@ -595,13 +621,29 @@ static int dso_render_from_data(const dso_t *s,
     if (vmag <= hints_limit_mag - 1.) {
         dso_render_label(s, painter, win_size, win_angle);
     }
+}
+
+// Render a DSO from its data.
+static int dso_render_from_data(const dso_t *s, const painter_t *painter)
+{
+    double points[3][3], win_pos[2], win_size[2], win_angle, hints_limit_mag;
+    int r;
+
+    r = dso_select(s, &s->clip_data, painter, &hints_limit_mag);
+    if (r <= 0) return r < 0 ? 1 : 0;
+    painter_get_ellipse_points(s->ra, s->de, s->angle, s->smax, s->smin,
+                               points);
+    compute_hint_transformation(painter, s, points,
+                                win_pos, win_size, &win_angle);
+    dso_render_projected(s, painter, hints_limit_mag,
+                         win_pos, win_size, win_angle);
     return 0;
 }
 
 static int dso_render(const obj_t *obj, const painter_t *painter)
 {
     const dso_t *dso = (const dso_t*)obj;
-    return dso_render_from_data(dso, painter, 0);
+    return dso_render_from_data(dso, painter);
 }
 
 void dso_get_designations(
@@ -616,6 +658,50 @@ void dso_get_designations(
     }
 }
 
+/*
+ * Render all the visible DSOs of a tile.
+ *
+ * The sources are processed by batches: first we select the visible ones
+ * using the compact clip data table, then we project all their ellipses
+ * from the precomputed points, and finally we render them, so that each
+ * pass only touches the data it needs.
+ */
+static int render_tile(const tile_t *tile, const painter_t *painter)
+{
+    int i, j, n, r;
+    struct {
+        int     idx;
+        double  hints_limit_mag;
+        double  win_pos[2];
+        double  win_size[2];
+        double  win_angle;
+    } batch[RENDER_BATCH_SIZE], *item;
+
+    for (i = 0; i < tile->nb; i += RENDER_BATCH_SIZE) {
+        n = 0;
+        for (j = i; j < min(tile->nb, i + RENDER_BATCH_SIZE); j++) {
+            r = dso_select(&tile->sources[j], &tile->sources_quick[j],
+                           painter, &batch[n].hints_limit_mag);
+            if (r < 0) break;
+            if (r == 0) continue;
+            batch[n++].idx = j;
+        }
+        for (item = batch; item < batch + n; item++) {
+            compute_hint_transformation(
+                    painter, &tile->sources[item->idx],
+                    tile->ellipses[item->idx],
+                    item->win_pos, item->win_size, &item->win_angle);
+        }
+        for (item = batch; item < batch + n; item++) {
+            dso_render_projected(&tile->sources[item->idx], painter,
+                                 item->hints_limit_mag, item->win_pos,
+                                 item->win_size, item->win_angle);
+        }
+        if (j < min(tile->nb, i + RENDER_BATCH_SIZE)) break;
+    }
+    return 0;
+}
+
 static int render_visitor(int order, int pix, void *user)
 {
     dsos_t *dsos = USER_GET(user, 0);
@@ -624,8 +710,7 @@ static int render_visitor(int order, int pix, void *user)
     int *nb_loaded = USER_GET(user, 3);
     survey_t *survey = USER_GET(user, 4);
     tile_t *tile;
-    int i, ret, code;
-    uint64_t hint;
+    int code;
 
     // Early exit if the tile is clipped.
     if (painter_is_healpix_clipped(&painter, FRAME_ICRF, order, pix))
@@ -638,12 +723,7 @@ static int render_visitor(int order, int pix, void *user)
     if (!tile) return 0;
     if (tile->mag_min > painter.stars_limit_mag + 1.5) return 0;
 
-    hint = pix_to_nuniq(order, pix);
-    for (i = 0; i < tile->nb; i++) {
-        ret = dso_render_from_data(&tile->sources[i], &painter, hint);
-        if (ret)
-            break;
-    }
+    render_tile(tile, &painter);
     if (tile->mag_max > painter.stars_limit_mag + 1.5) return 0;
     return 1;
 }
@@ -9,6 +9,7 @@
 
 #include "swe.h"
 
+#include "geojson_filter.h"
 #include "geojson_parser.h"
 
 #include "utils/mesh.h"
@@ -23,6 +24,9 @@ struct feature {
     int         frame;
     float       fill_color[4];
     float       stroke_color[4];
+    // Colors of the feature itself, before any filter program.
+    float       default_fill_color[4];
+    float       default_stroke_color[4];
     float       stroke_width;
     char        *title;
     int         text_anchor;
@@ -41,16 +45,24 @@ typedef void (*filter_fn_t)(const image_t *img, int idx,
  * Represents a geojson document
  *
  * Attributes:
- *   filter - Function called for each feature.  Can set the fill and stroke
- *            color.  If it returns zero, then the feature is hidden.
+ *   filter     - Function called for each feature.  Can set the fill and
+ *                stroke color.  If it returns zero, then the feature is
+ *                hidden.
+ *   program    - Native filter program, used instead of the filter function
+ *                if set.
+ *   attrs_json - Json source of the features attributes used by the filter
+ *                program.  Only parsed the first time we need it.
  */
 struct image {
     obj_t       obj;
     feature_t   *features;
     int         frame;
     filter_fn_t filter;
+    geojson_filter_t *program;
     int         filter_idx;
     double      z;      // For sorting inside a layer.
+    char        *attrs_json;
+    json_value  *attrs;
 };
 
 
@@ -66,6 +78,7 @@ typedef struct survey {
     void        (*filter)(const image_t *img, int idx,
                           float fill_color[4], float stroke_color[4],
                           bool *blink, bool *hidden);
+    geojson_filter_t *program;
     int         filter_idx;
     double      z;      // For sorting inside a layer.
 } survey_t;
@@ -145,6 +158,8 @@ static void add_geojson_feature(image_t *image,
     vec3_copy(geo_feature->properties.stroke, feature->stroke_color);
     feature->fill_color[3] = geo_feature->properties.fill_opacity;
     feature->stroke_color[3] = geo_feature->properties.stroke_opacity;
+    vec4_copy(feature->fill_color, feature->default_fill_color);
+    vec4_copy(feature->stroke_color, feature->default_stroke_color);
     feature->stroke_width = geo_feature->properties.stroke_width;
     if (geo_feature->properties.title)
         feature->title = strdup(geo_feature->properties.title);
@@ -214,10 +229,46 @@ void geojson_remove_all_features(image_t *image)
     }
 }
 
+static void apply_program(image_t *image)
+{
+    json_settings settings = {.value_extra = json_builder_extra};
+    const json_value *data;
+    feature_t *feature;
+    int i = 0;
+
+    if (!image->attrs) {
+        if (!image->attrs_json) return;
+        image->attrs = json_parse_ex(&settings, image->attrs_json,
+                                     strlen(image->attrs_json), NULL);
+        free(image->attrs_json);
+        image->attrs_json = NULL;
+        if (!image->attrs) {
+            LOG_E("Cannot parse geojson features attributes");
+            return;
+        }
+    }
+    // Either a geojson document, or columnar attributes.
+    data = json_get_attr(image->attrs, "features", json_array);
+    geojson_filter_bind(image->program, data ?: image->attrs, !data);
+    for (feature = image->features; feature; feature = feature->next, i++) {
+        // Start from the feature colors, so that the result doesn't depend
+        // on the previous programs.
+        vec4_copy(feature->default_fill_color, feature->fill_color);
+        vec4_copy(feature->default_stroke_color, feature->stroke_color);
+        geojson_filter_eval(image->program, i, feature->fill_color,
+                            feature->stroke_color, &feature->blink,
+                            &feature->hidden);
+    }
+}
+
 static void apply_filter(image_t *image)
 {
     feature_t *feature;
     int i = 0;
+    if (image->program) {
+        apply_program(image);
+        return;
+    }
     if (!image->filter) return;
     for (feature = image->features; feature; feature = feature->next, i++) {
         image->filter(image, i, feature->fill_color, feature->stroke_color,
@@ -342,6 +393,9 @@ static void image_del(obj_t *obj)
 {
     image_t *image = (void*)obj;
     geojson_remove_all_features(image);
+    geojson_filter_delete(image->program);
+    free(image->attrs_json);
+    if (image->attrs) json_builder_free(image->attrs);
 }
 
 // Special function for fast geojson parsing directly from js!
@@ -371,6 +425,20 @@ void geojson_add_poly_feature(image_t *image, int size, const double *data)
     add_geojson_feature(image, &feature);
 }
 
+// Same as geojson_add_poly_feature, but add several features in a single
+// call.  sizes contains the number of points of each feature, and data all
+// the features coordinates one after the other.
+EMSCRIPTEN_KEEPALIVE
+void geojson_add_poly_features(image_t *image, int nb, const int *sizes,
+                               const double *data)
+{
+    int i;
+    for (i = 0; i < nb; i++) {
+        geojson_add_poly_feature(image, sizes[i], data);
+        data += sizes[i] * 2;
+    }
+}
+
 static int query_rendered_features_(
         const image_t *image, const double pos[3], int max_ret,
         void **tiles, int *index)
@@ -397,21 +465,24 @@ static int query_rendered_features_(
 static bool mesh_intersects_box(const mesh_t *mesh_, const painter_t *painter,
                                 const double box[2][2])
 {
-    mesh_t *mesh;
+    mesh_t mesh = *mesh_;
     int i;
-    double p[4];
     bool ret;
+    double p[4];
 
-    // Project the mesh vertices into screen coordinates.
-    mesh = mesh_copy(mesh_);
-    for (i = 0; i < mesh->vertices_count; i++) {
-        vec3_normalize(mesh->vertices[i], p);
+    // Project the mesh vertices into screen coordinates.  Only the vertices
+    // are modified, so we don't need to copy the whole mesh.
+    // Note: we can't use the frame arena here since this is also called
+    // outside of the rendering.
+    mesh.vertices = malloc(mesh.vertices_count * sizeof(*mesh.vertices));
+    for (i = 0; i < mesh.vertices_count; i++) {
+        vec3_normalize(mesh_->vertices[i], p);
         convert_frame(painter->obs, FRAME_ICRF, FRAME_VIEW, true, p, p);
         project_to_win(painter->proj, p, p);
-        vec2_copy(p, mesh->vertices[i]);
+        vec2_copy(p, mesh.vertices[i]);
     }
-    ret = mesh_intersects_2d_box(mesh, box);
-    mesh_delete(mesh);
+    ret = mesh_intersects_2d_box(&mesh, box);
+    free(mesh.vertices);
     return ret;
 }
 
@@ -475,11 +546,15 @@ void geojson_set_on_new_tile_callback(
     g_survey_on_new_tile = fn;
 }
 
-static void image_update_filter(image_t *image,
-                                filter_fn_t filter, int filter_idx)
+static void image_update_filter(image_t *image, filter_fn_t filter,
+                                geojson_filter_t *program, int filter_idx)
 {
     if (image->filter_idx == filter_idx) return;
     image->filter = filter;
+    // The tiles keep a reference to the program, since the survey might
+    // change it before all the tiles get updated.
+    geojson_filter_delete(image->program);
+    image->program = program ? geojson_filter_retain(program) : NULL;
     image->filter_idx = filter_idx;
     apply_filter(image);
 }
@@ -510,7 +585,8 @@ static bool survey_iter_visible_tiles(
         }
         *tile = hips_get_tile(hips, *order, *pix, HIPS_NO_DELAY, code);
         if (*tile)
-            image_update_filter(*tile, survey->filter, survey->filter_idx);
+            image_update_filter(*tile, survey->filter, survey->program,
+                                survey->filter_idx);
         return true;
     }
 }
@@ -588,6 +664,198 @@ int geojson_survey_query_rendered_features(
     return nb;
 }
 
+/*
+ * Binary tiles ('geobin' hips format).
+ *
+ * Same content as the geojson tiles, but with the geometries already
+ * triangulated by the server, so that we can fill the meshes directly
+ * without parsing json or running the tesselator.
+ *
+ * All values are little endian:
+ *
+ *   header     - magic ('GEOB'), version, children_mask, nb_features,
+ *                nb_vertices, nb_indices, properties_size, reserved
+ *                (uint32 each).
+ *   features   - for each feature, the number of vertices, triangles
+ *                indices, lines indices and points indices (uint32 each).
+ *   vertices   - nb_vertices ICRF unit vectors (3 float32 each).
+ *   indices    - for each feature its triangles, lines and points indices
+ *                (uint16, relative to the feature first vertex), padded to
+ *                a multiple of 4 bytes.
+ *   properties - json document with the features properties stored per
+ *                column, nul terminated.  Passed as is to the new tile
+ *                callback.
+ */
+
+#define GEOBIN_MAGIC "GEOB"
+#define GEOBIN_VERSION 1
+
+static bool is_geobin(const void *data, int size)
+{
+    return size >= 32 && memcmp(data, GEOBIN_MAGIC, 4) == 0;
+}
+
+/*
+ * Check that a geobin tile is well formed before we read it.  The features
+ * counts have to match the header and the size of the data, and all the
+ * indices have to reference one of their feature vertices.
+ */
+static bool geobin_check(const void *data, int size)
+{
+    uint32_t header[8], counts[4];
+    uint64_t ofs, nb_vertices = 0, nb_indices = 0;
+    const uint8_t *table;
+    const uint16_t *indices;
+    const char *props;
+    int i, j, k, nb_features;
+
+    memcpy(header, data, sizeof(header));
+    if (header[1] != GEOBIN_VERSION) {
+        LOG_E("Unsupported geobin tile version: %d", (int)header[1]);
+        return false;
+    }
+    nb_features = header[3];
+    table = (const uint8_t*)data + sizeof(header);
+    // 64 bits offsets, so that big values in the header can't overflow.
+    ofs = sizeof(header) + (uint64_t)nb_features * sizeof(counts);
+    if (ofs > size) goto error_size;
+    for (i = 0; i < nb_features; i++) {
+        memcpy(counts, table + i * sizeof(counts), sizeof(counts));
+        if (counts[0] > 65536 || counts[1] % 3 || counts[2] % 2)
+            goto error_size;
+        nb_vertices += counts[0];
+        nb_indices += counts[1] + counts[2] + counts[3];
+    }
+    if (nb_vertices != header[4] || nb_indices != header[5])
+        goto error_size;
+    ofs += nb_vertices * 3 * sizeof(float);
+    indices = (const void*)((const uint8_t*)data + ofs);
+    ofs += (nb_indices * 2 + 3) & ~3;
+    if (header[6] < 1 || ofs + header[6] != size) goto error_size;
+    props = (const char*)data + ofs;
+    if (props[header[6] - 1] != '\0') goto error_size;
+
+    for (i = 0; i < nb_features; i++) {
+        memcpy(counts, table + i * sizeof(counts), sizeof(counts));
+        for (k = 1; k < 4; k++) {
+            for (j = 0; j < counts[k]; j++, indices++) {
+                if (*indices >= counts[0]) {
+                    LOG_E("Wrong geobin tile indices");
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+
+error_size:
+    LOG_E("Wrong geobin tile size");
+    return false;
+}
+
+static uint16_t *read_indices(const uint16_t **src, int count)
+{
+    uint16_t *ret;
+    if (!count) return NULL;
+    ret = malloc(count * sizeof(*ret));
+    memcpy(ret, *src, count * sizeof(*ret));
+    *src += count;
+    return ret;
+}
+
+static image_t *image_create_from_geobin(const void *data, int size,
+                                         int *children_mask)
+{
+    uint32_t header[8], counts[4];
+    int i, j, nb_features, nb_vertices, nb_indices;
+    const uint8_t *table;
+    const float *verts;
+    const uint16_t *indices;
+    const char *props;
+    image_t *image;
+    feature_t *feature;
+    mesh_t *mesh;
+
+    if (!geobin_check(data, size)) return NULL;
+    memcpy(header, data, sizeof(header));
+    nb_features = header[3];
+    nb_vertices = header[4];
+    nb_indices = header[5];
+    table = (const uint8_t*)data + sizeof(header);
+    verts = (const void*)(table + nb_features * sizeof(counts));
+    indices = (const void*)(verts + nb_vertices * 3);
+    props = (const char*)indices + ((nb_indices * 2 + 3) & ~3);
+    if (children_mask) *children_mask = header[2];
+
+    image = (void*)obj_create("geojson", NULL);
+    for (i = 0; i < nb_features; i++) {
+        memcpy(counts, table + i * sizeof(counts), sizeof(counts));
+        feature = (void*)obj_create("geojson-feature", NULL);
+        feature->frame = image->frame;
+        // Same default style as in the geojson parser.
+        vec3_set(feature->fill_color, 1, 1, 1);
+        vec3_set(feature->stroke_color, 1, 1, 1);
+        feature->fill_color[3] = 0.5;
+        feature->stroke_color[3] = 1;
+        vec4_copy(feature->fill_color, feature->default_fill_color);
+        vec4_copy(feature->stroke_color, feature->default_stroke_color);
+        feature->stroke_width = 1;
+        DL_APPEND(image->features, feature);
+        if (!counts[0]) continue;
+
+        mesh = calloc(1, sizeof(*mesh));
+        mesh->vertices_count = counts[0];
+        mesh->vertices = malloc(counts[0] * sizeof(*mesh->vertices));
+        for (j = 0; j < counts[0]; j++, verts += 3) {
+            vec3_set(mesh->vertices[j], verts[0], verts[1], verts[2]);
+        }
+        mesh->triangles_count = counts[1];
+        mesh->triangles = read_indices(&indices, counts[1]);
+        mesh->lines_count = counts[2];
+        mesh->lines = read_indices(&indices, counts[2]);
+        mesh->points_count = counts[3];
+        mesh->points = read_indices(&indices, counts[3]);
+        // Same as in mesh_add_poly_lonlat.
+        if (mesh_subdivide(mesh, M_PI / 8)) mesh->subdivided = true;
+        mesh_update_bounding_cap(mesh);
+        DL_APPEND(feature->meshes, mesh);
+    }
+    image->attrs_json = strdup(props);
+    if (g_survey_on_new_tile)
+        g_survey_on_new_tile(image, props);
+    return image;
+}
+
+/*
+ * Return the serialized attributes of a geojson document for the filter
+ * programs, that is the document without the features geometries, so
+ * that we don't keep them in memory.  The geometries of the document are
+ * released.
+ */
+static char *geojson_attrs_json(json_value *jdata)
+{
+    json_value *features, *feature, *geo;
+    int i, j;
+    char *ret;
+
+    features = json_get_attr(jdata, "features", json_array);
+    for (i = 0; features && i < features->u.array.length; i++) {
+        feature = features->u.array.values[i];
+        if (feature->type != json_object) continue;
+        for (j = 0; j < feature->u.object.length; j++) {
+            if (strcmp(feature->u.object.values[j].name, "geometry") != 0)
+                continue;
+            json_builder_free(feature->u.object.values[j].value);
+            geo = json_null_new();
+            geo->parent = feature;
+            feature->u.object.values[j].value = geo;
+        }
+    }
+    ret = calloc(1, json_measure(jdata));
+    json_serialize(ret, jdata);
+    return ret;
+}
+
 static const void *survey_create_tile(
         void *user, int order, int pix, void *data, int size,
         int *cost, int *transparency)
@@ -598,6 +866,15 @@ static const void *survey_create_tile(
     bool empty = false;
     image_t *tile;
 
+    if (is_geobin(data, size)) {
+        tile = image_create_from_geobin(data, size, &mask);
+        if (tile) {
+            *transparency = (~mask) & 15;
+            *cost = strlen(tile->attrs_json) + 1;
+        }
+        return tile;
+    }
+
     jdata = json_parse_ex(&settings, data, size, NULL);
     if (!jdata) return NULL;
 
@@ -612,6 +889,8 @@ static const void *survey_create_tile(
     tile = (void*)obj_create("geojson", NULL);
     if (!empty) {
         obj_call_json((obj_t*)tile, "data", jdata);
+        tile->attrs_json = geojson_attrs_json(jdata);
+        *cost = strlen(tile->attrs_json) + 1;
         if (g_survey_on_new_tile)
             g_survey_on_new_tile(tile, data);
     }
@@ -663,32 +942,51 @@ static int survey_init(obj_t *obj, json_value *args)
     return 0;
 }
 
+static void survey_del(obj_t *obj)
+{
+    survey_t *survey = (void*)obj;
+    geojson_filter_delete(survey->program);
+    obj_release((obj_t*)survey->allsky);
+    hips_delete(survey->hips);
+    free(survey->path);
+}
+
 static void survey_load_allsky(survey_t *survey)
 {
     char path[1024];
     void *data;
     int size, code;
     json_value *geojson;
+    json_settings settings = {.value_extra = json_builder_extra};
 
     if (survey->allsky_loaded) return;
+    // We need the properties to know the tiles format.
+    if (!hips_is_ready(survey->hips)) return;
     // Attempt to load the allsky geojson document if available.
-    snprintf(path, sizeof(path), "%s/Allsky.geojson", survey->path);
+    snprintf(path, sizeof(path), "%s/Allsky.%s", survey->path,
+             survey->hips->ext);
     data = asset_get_data2(path, ASSET_ACCEPT_404 | ASSET_USED_ONCE,
                            &size, &code);
     if (!code) return;
     survey->allsky_loaded = true;
     if (!data) return;
 
-    geojson = json_parse(data, size);
+    if (is_geobin(data, size)) {
+        survey->allsky = image_create_from_geobin(data, size, NULL);
+        return;
+    }
+
+    geojson = json_parse_ex(&settings, data, size, NULL);
     if (!geojson) {
         LOG_E("Cannot parse %s", path);
         return;
     }
     survey->allsky = (void*)obj_create("geojson", NULL);
     data_fn((obj_t*)survey->allsky, NULL, geojson);
+    survey->allsky->attrs_json = geojson_attrs_json(geojson);
     if (g_survey_on_new_tile)
         g_survey_on_new_tile(survey->allsky, data);
-    json_value_free(geojson);
+    json_builder_free(geojson);
 }
 
 static int survey_render(const obj_t *obj, const painter_t *painter)
@@ -705,7 +1003,8 @@ static int survey_render(const obj_t *obj, const painter_t *painter)
 
     survey_load_allsky((survey_t*)survey);
     if (survey->allsky) {
-        image_update_filter(survey->allsky, survey->filter, survey->filter_idx);
+        image_update_filter(survey->allsky, survey->filter, survey->program,
+                            survey->filter_idx);
         obj_render((obj_t*)survey->allsky, painter);
     }
 
@@ -724,10 +1023,11 @@ static int survey_render(const obj_t *obj, const painter_t *painter)
     return 0;
 }
 
+static int g_survey_filter_idx = 1;
+
 static json_value *survey_filter_fn(obj_t *obj, const attribute_t *attr,
                                     const json_value *args)
 {
-    static int filter_idx = 1;
     survey_t *survey = (void*)obj;
     if (!args) return NULL;
     if (args->type != json_integer) {
@@ -735,7 +1035,29 @@ static json_value *survey_filter_fn(obj_t *obj, const attribute_t *attr,
         return NULL;
     }
     survey->filter = (void*)(intptr_t)(args->u.integer);
-    survey->filter_idx = filter_idx++;
+    geojson_filter_delete(survey->program);
+    survey->program = NULL;
+    survey->filter_idx = g_survey_filter_idx++;
+    return NULL;
+}
+
+/*
+ * Set a native filter program (see geojson_filter.h), evaluated directly
+ * on the tiles features attributes instead of calling the filter function
+ * for each feature.  As with the filter function, only the visible tiles
+ * are updated, the others get updated when they become visible.
+ */
+static json_value *survey_filter_program_fn(
+        obj_t *obj, const attribute_t *attr, const json_value *args)
+{
+    survey_t *survey = (void*)obj;
+    geojson_filter_t *program;
+    if (!args) return NULL;
+    program = geojson_filter_create(args);
+    if (!program) return NULL;
+    geojson_filter_delete(survey->program);
+    survey->program = program;
+    survey->filter_idx = g_survey_filter_idx++;
     return NULL;
 }
 
@@ -771,11 +1093,79 @@ static obj_klass_t survey_klass = {
     .id             = "geojson-survey",
     .size           = sizeof(survey_t),
     .init           = survey_init,
+    .del            = survey_del,
     .render         = survey_render,
     .attributes = (attribute_t[]) {
         PROPERTY(filter, TYPE_FUNC, .fn = survey_filter_fn),
+        PROPERTY(filter_program, TYPE_JSON, .fn = survey_filter_program_fn),
         PROPERTY(z, TYPE_FLOAT, MEMBER(survey_t, z)),
         {}
     },
 };
 OBJ_REGISTER(survey_klass);
+
+/******** TESTS ***********************************************************/
+
+#if COMPILE_TESTS
+
+static void test_geobin(void)
+{
+    // One feature with a single triangle.
+    struct {
+        uint32_t header[8];
+        uint32_t counts[4];
+        float    vertices[3][3];
+        uint16_t indices[4];
+        char     props[4];
+    } tile = {
+        .header = {0, GEOBIN_VERSION, 15, 1, 3, 3, 4},
+        .counts = {3, 3, 0, 0},
+        .vertices = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}},
+        .indices = {0, 1, 2},
+        .props = "{}",
+    };
+    image_t *image;
+
+    memcpy(tile.header, GEOBIN_MAGIC, 4);
+    assert(is_geobin(&tile, sizeof(tile)));
+    image = image_create_from_geobin(&tile, sizeof(tile), NULL);
+    assert(image && image->features->meshes->triangles_count >= 3);
+    obj_release(&image->obj);
+
+    // Truncated tile.
+    assert(!image_create_from_geobin(&tile, sizeof(tile) - 4, NULL));
+    // Features counts not matching the header.
+    tile.counts[0] = 4;
+    assert(!image_create_from_geobin(&tile, sizeof(tile), NULL));
+    tile.counts[0] = 3;
+    tile.counts[1] = 6;
+    assert(!image_create_from_geobin(&tile, sizeof(tile), NULL));
+    tile.counts[1] = 3;
+    // Index out of the feature vertices.
+    tile.indices[2] = 3;
+    assert(!image_create_from_geobin(&tile, sizeof(tile), NULL));
+}
+TEST_REGISTER(NULL, test_geobin, TEST_AUTO);
+
+// Check that we don't keep the geometries of the json tiles.
+static void test_attrs_json(void)
+{
+    const char *data =
+        "{\"type\": \"FeatureCollection\", \"features\": [{"
+        "  \"type\": \"Feature\", \"properties\": {\"id\": 12},"
+        "  \"geometry\": {\"type\": \"Point\", \"coordinates\": [1, 2]}"
+        "}]}";
+    json_settings settings = {.value_extra = json_builder_extra};
+    json_value *jdata;
+    char *attrs;
+
+    jdata = json_parse_ex(&settings, data, strlen(data), NULL);
+    attrs = geojson_attrs_json(jdata);
+    assert(strstr(attrs, "\"id\""));
+    assert(!strstr(attrs, "coordinates"));
+    free(attrs);
+    json_builder_free(jdata);
+}
+TEST_REGISTER(NULL, test_attrs_json, TEST_AUTO);
+
+#endif
@@ -9,11 +9,20 @@
 
 #include "swe.h"
 
+// Size of the cells of the grid used to test the labels overlaps (px).
+#define GRID_CELL_SIZE 64
+
+// The labels bounds are only recomputed if they moved more than this
+// distance since the last time (px).
+#define BOUNDS_MOVE_THRESHOLD 0.05
 
 typedef struct label label_t;
 struct label
 {
     label_t *next, *prev;
+    UT_hash_handle hh;    // Hash by object, text and size.
+    char    *key;
+    int     keylen;
     obj_t   *obj;         // Optional object.
     char    *text;        // Original passed text.
     char    *render_text; // Processed text (can point to text).
@@ -32,13 +41,43 @@ struct label
     double  priority;     // Priority used in case of positioning conflicts.
                           // Higher value means higher priority.
     double  bounds[4];
+
+    // Values used for the last bounds computation, so that we only measure
+    // the text again if something changed.
+    struct {
+        bool    valid;
+        double  win_pos[2];
+        double  radius;
+        int     align;
+        int     effects;
+        double  pixel_scale;
+        int     fonts_gen;
+    } bounds_cache;
 };
 
 typedef struct labels {
     obj_t obj;
     label_t *labels;
+    label_t *labels_hash;
 } labels_t;
 
+/*
+ * Type: overlap_grid_t
+ * Screen grid of the labels already placed during the frame, so that we
+ * only test the overlaps with the labels that are close to each other.
+ */
+typedef struct grid_entry grid_entry_t;
+struct grid_entry {
+    grid_entry_t    *next;
+    const label_t   *label;
+};
+
+typedef struct {
+    int             w;
+    int             h;
+    grid_entry_t    **cells;
+} overlap_grid_t;
+
 static labels_t *g_labels = NULL;
 
 void labels_reset(void)
@@ -47,8 +86,10 @@ void labels_reset(void)
     DL_FOREACH_SAFE(g_labels->labels, label, tmp) {
         if (label->fader.target == false && label->fader.value == 0) {
             DL_DELETE(g_labels->labels, label);
+            HASH_DELETE(hh, g_labels->labels_hash, label);
             if (label->render_text != label->text) free(label->render_text);
             free(label->text);
+            free(label->key);
             obj_release(label->obj);
             free(label);
         } else {
@@ -58,16 +99,35 @@ void labels_reset(void)
     }
 }
 
-static label_t *label_get(label_t *list, const char *txt, double size,
-                          const obj_t *obj)
+/*
+ * Compute the hash key of a label: the concatenation of the object
+ * pointer, the size and the text.
+ *
+ * Return the size of the key.  If buf is NULL, only return the size.
+ */
+static int label_key(char *buf, const obj_t *obj, double size,
+                     const char *txt)
+{
+    int len = strlen(txt);
+    if (buf) {
+        memcpy(buf, &obj, sizeof(obj));
+        memcpy(buf + sizeof(obj), &size, sizeof(size));
+        memcpy(buf + sizeof(obj) + sizeof(size), txt, len);
+    }
+    return sizeof(obj) + sizeof(size) + len;
+}
+
+static label_t *label_get(const char *txt, double size, const obj_t *obj)
 {
     label_t *label;
-    DL_FOREACH(list, label) {
-        if (obj != label->obj) continue;
-        if (label->size == size && strcmp(txt, label->text) == 0)
-            return label;
-    }
-    return NULL;
+    char buf[256], *key;
+    int len = label_key(NULL, obj, size, txt);
+
+    key = (len <= sizeof(buf)) ? buf : malloc(len);
+    label_key(key, obj, size, txt);
+    HASH_FIND(hh, g_labels->labels_hash, key, len, label);
+    if (key != buf) free(key);
+    return label;
 }
 
 static void label_get_bounds(const painter_t *painter, const label_t *label,
@@ -92,6 +152,35 @@ static void label_get_bounds(const painter_t *painter, const label_t *label,
                       label->size, bounds);
 }
 
+// Update the label bounds, unless the label didn't move since the last
+// computation.
+static void label_update_bounds(const painter_t *painter, label_t *label)
+{
+    typeof(label->bounds_cache) *cache = &label->bounds_cache;
+
+    if (    cache->valid &&
+            fabs(cache->win_pos[0] - label->win_pos[0]) <
+                BOUNDS_MOVE_THRESHOLD &&
+            fabs(cache->win_pos[1] - label->win_pos[1]) <
+                BOUNDS_MOVE_THRESHOLD &&
+            cache->radius == label->radius &&
+            cache->align == label->align &&
+            cache->effects == label->effects &&
+            cache->pixel_scale == painter->pixel_scale &&
+            cache->fonts_gen == core->fonts_gen)
+        return;
+
+    label_get_bounds(painter, label, label->align, label->effects,
+                     label->bounds);
+    cache->valid = true;
+    vec2_copy(label->win_pos, cache->win_pos);
+    cache->radius = label->radius;
+    cache->align = label->align;
+    cache->effects = label->effects;
+    cache->pixel_scale = painter->pixel_scale;
+    cache->fonts_gen = core->fonts_gen;
+}
+
 // Compute the intersection of two bounding box.
 // If the boxes do not intersect, set out to 0 and return false.
 static bool bounds_intersection(const double a[4], const double b[4],
@@ -121,21 +210,56 @@ static double bounds_dist_point(const double rect[4], const double p[2])
     return sqrt(dx * dx + dy * dy);
 }
 
-static double test_label_overlaps(const label_t *label)
+// Get the range of the grid cells covered by some bounds.
+// Return false if the bounds are not valid.
+static bool grid_get_range(const overlap_grid_t *grid, const double b[4],
+                           int range[4])
+{
+    int i;
+    for (i = 0; i < 4; i++) {
+        if (isnan(b[i])) return false;
+        range[i] = clamp(floor(b[i] / GRID_CELL_SIZE), 0,
+                         (i % 2 ? grid->h : grid->w) - 1);
+    }
+    return true;
+}
+
+static void grid_add(overlap_grid_t *grid, const label_t *label)
 {
-    label_t *other;
+    int range[4], x, y;
+    grid_entry_t *entry;
+
+    if (!grid_get_range(grid, label->bounds, range)) return;
+    for (y = range[1]; y <= range[3]; y++)
+    for (x = range[0]; x <= range[2]; x++) {
+        entry = arena_alloc(core->frame_arena, sizeof(*entry));
+        entry->label = label;
+        LL_PREPEND(grid->cells[y * grid->w + x], entry);
+    }
+}
+
+// Return the maximum overlap of a label with the labels already in the
+// grid.
+static double test_label_overlaps(const overlap_grid_t *grid,
+                                  const label_t *label)
+{
+    const grid_entry_t *entry;
     double ret = 0, overlap;
     double inter[4];
+    int range[4], x, y;
 
     if (!(label->effects & TEXT_FLOAT)) return 0.0;
-    DL_FOREACH(g_labels->labels, other) {
-        if (other == label) break;
-        if (other->fader.target == false) continue;
-        if (!bounds_intersection(label->bounds, other->bounds, inter))
-            continue;
-        overlap = max(inter[2] - inter[0], inter[3] - inter[1]);
-        if (overlap > ret)
-            ret = overlap;
+    if (!grid_get_range(grid, label->bounds, range)) return 0.0;
+    for (y = range[1]; y <= range[3]; y++)
+    for (x = range[0]; x <= range[2]; x++) {
+        LL_FOREACH(grid->cells[y * grid->w + x], entry) {
+            if (!bounds_intersection(label->bounds, entry->label->bounds,
+                                     inter))
+                continue;
+            overlap = max(inter[2] - inter[0], inter[3] - inter[1]);
+            if (overlap > ret)
+                ret = overlap;
+        }
     }
     return ret;
 }
@@ -158,13 +282,23 @@ static int labels_render(const obj_t *obj, const painter_t *painter_)
     const double max_overlap = 8;
     painter_t painter = *painter_;
     bool use_depth;
+    overlap_grid_t grid;
+
+    // The labels are placed by priority, each one only tested against the
+    // labels with a higher priority that are still visible.
+    grid.w = max(1, ceil(painter.proj->window_size[0] / GRID_CELL_SIZE));
+    grid.h = max(1, ceil(painter.proj->window_size[1] / GRID_CELL_SIZE));
+    grid.cells = arena_calloc(core->frame_arena, grid.w * grid.h,
+                              sizeof(*grid.cells));
 
     DL_SORT(g_labels->labels, label_cmp);
     DL_FOREACH(g_labels->labels, label) {
 
         if (core->selection && core->hide_selection_label &&
-                label->obj == core->selection)
+                label->obj == core->selection) {
+            if (label->fader.target) grid_add(&grid, label);
             continue;
+        }
 
         vec4_copy(label->color, painter.color);
         painter.color[3] *= label->fader.value;
@@ -181,10 +315,10 @@ static int labels_render(const obj_t *obj, const painter_t *painter_)
             use_depth = true;
             painter.flags |= PAINTER_ENABLE_DEPTH;
         }
-        label_get_bounds(&painter, label, label->align, label->effects,
-                         label->bounds);
+        label_update_bounds(&painter, label);
         label->fader.target = label->active &&
-                                (test_label_overlaps(label) <= max_overlap);
+                        (test_label_overlaps(&grid, label) <= max_overlap);
+        if (label->fader.target) grid_add(&grid, label);
         win_pos[0] = label->bounds[0];
         win_pos[1] = label->bounds[1];
         paint_text(&painter, label->render_text, win_pos,
@@ -230,13 +364,18 @@ void labels_add_3d(const char *text, int frame, const double pos[3],
 
     if (!text || !*text) return;
 
-    label = label_get(g_labels->labels, text, size, obj);
+    label = label_get(text, size, obj);
     if (!label) {
         label = calloc(1, sizeof(*label));
         label->obj = obj_retain(obj);
         fader_init(&label->fader, false);
         label->render_text = label->text = strdup(text);
+        label->keylen = label_key(NULL, obj, size, text);
+        label->key = malloc(label->keylen);
+        label_key(label->key, obj, size, text);
         DL_APPEND(g_labels->labels, label);
+        HASH_ADD_KEYPTR(hh, g_labels->labels_hash, label->key, label->keylen,
+                        label);
     }
 
     if (frame == -1)
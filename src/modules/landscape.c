@@ -111,7 +111,7 @@ static double get_global_brightness(void)
  */
 static void render_fog(const painter_t *painter_, double alpha)
 {
-    int pix, order = 1, split = 2;
+    int i, nb, pix, *pixs, order = 1, split = 2;
     double theta, phi;
     painter_t painter = *painter_;
     uv_map_t map;
@@ -120,9 +120,11 @@ static void render_fog(const painter_t *painter_, double alpha)
     if (painter.color[3] == 0.0) return;
 
     painter.flags |= PAINTER_FOG_SHADER;
-    // Note: we could try to optimize further by doing a breath first
-    // iteration to skip level 0 tiles.
-    for (pix = 0; pix < 12 * 4; pix++) {
+    // Only iterate the tiles intersecting the viewport bounding cap.
+    nb = healpix_query_disc(
+            order, painter.clip_info[FRAME_OBSERVED].bounding_cap, &pixs);
+    for (i = 0; i < nb; i++) {
+        pix = pixs[i];
         healpix_pix2ang(1 << order, pix, &theta, &phi);
         // Skip tiles that will be totally transparent anyway.
         if (fabs(theta - M_PI / 2) > 20 * DD2R) continue;
@@ -131,6 +133,7 @@ static void render_fog(const painter_t *painter_, double alpha)
         uv_map_init_healpix(&map, order, pix, true, true);
         paint_quad(&painter, FRAME_OBSERVED, &map, split);
     }
+    free(pixs);
 }
 
 static int landscape_render(const obj_t *obj, const painter_t *painter_)
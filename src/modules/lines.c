@@ -18,8 +18,17 @@
  * split recursion need to compute for each step how many splits to make.
  *
  * We pre-compute those splits into the STEPS_DEG and STEPS_HOURS arrays.
+ *
+ * The positions of the quads corners and of the tessellated sides don't
+ * depend on the observer, so we keep them in a cache, in the line frame.
+ * At each frame we only have to convert them to the view frame and project
+ * them.
  */
 
+// Number of segments used to render each side of a quad.
+#define LINE_SPLIT 8
+#define QUADS_CACHE_SIZE (8 * (1 << 20))
+
 typedef struct
 {
     int     n;              // Number of step in the full circle.
@@ -166,6 +175,22 @@ struct line {
     double          color[4];
 };
 
+/*
+ * Type: grid_quad_t
+ * Cached geometry of a quad of the grid recursion, in the line frame.
+ *
+ * The sides are only computed once needed, for the quads at the grid
+ * resolution.
+ */
+typedef struct {
+    double  corners[4][3];
+    bool    has_sides[2];
+    // Left and bottom sides, tessellated into LINE_SPLIT segments.
+    double  sides[2][LINE_SPLIT + 1][3];
+} grid_quad_t;
+
+static cache_t *g_quads_cache = NULL;
+
 // Test if a shape in clipping coordinates is clipped or not.
 static bool is_clipped(const double pos[4][3], double clip[4][4])
 {
@@ -513,6 +538,68 @@ static void render_label(const double p[2], const double u[2],
                text_size, label_angle);
 }
 
+static int del_quad(void *data)
+{
+    free(data);
+    return 0;
+}
+
+/*
+ * Get the cached geometry of a quad of the recursion, or compute it.
+ *
+ * Parameters:
+ *   line   - The line.  The quads are cached separately for each line.
+ *   map    - The uv mapping of the line.
+ *   mat    - Transformation matrix from the full sphere uv to the quad uv.
+ *   splits - Size of the quad (see render_recursion).
+ *   pos    - Position of the quad (see render_recursion).
+ */
+static grid_quad_t *get_quad(const line_t *line, const uv_map_t *map,
+                             const double mat[3][3],
+                             const int splits[2], const int pos[2])
+{
+    int i;
+    grid_quad_t *quad;
+    double p[2];
+    const double uv[4][2] = {{0.0, 1.0}, {1.0, 1.0}, {0.0, 0.0}, {1.0, 0.0}};
+    struct {
+        const line_t *line;
+        int splits[2];
+        int pos[2];
+    } key = {line, {splits[0], splits[1]}, {pos[0], pos[1]}};
+
+    if (!g_quads_cache)
+        g_quads_cache = cache_create("lines", QUADS_CACHE_SIZE);
+    quad = cache_get(g_quads_cache, &key, sizeof(key));
+    if (quad) return quad;
+
+    quad = calloc(1, sizeof(*quad));
+    for (i = 0; i < 4; i++) {
+        mat3_mul_vec2(mat, uv[i], p);
+        spherical_project(map, p, quad->corners[i]);
+    }
+    cache_add(g_quads_cache, &key, sizeof(key), quad, sizeof(*quad),
+              del_quad);
+    return quad;
+}
+
+// Compute and cache the tessellation of a quad side if needed.
+static const double (*get_quad_side(grid_quad_t *quad, const uv_map_t *map,
+                                    int dir, const double line[2][4]))[3]
+{
+    int i;
+    double p[2];
+
+    if (!quad->has_sides[dir]) {
+        for (i = 0; i <= LINE_SPLIT; i++) {
+            vec2_mix(line[0], line[1], (double)i / LINE_SPLIT, p);
+            spherical_project(map, p, quad->sides[dir][i]);
+        }
+        quad->has_sides[dir] = true;
+    }
+    return quad->sides[dir];
+}
+
 /*
  * Render a grid/line, by splitting the sphere into parts until we reach
  * the resolution of the grid.
@@ -538,6 +625,7 @@ static void render_recursion(
     double pos_view[4][3], pos_clip[4][4];
     double uv[4][2] = {{0.0, 1.0}, {1.0, 1.0}, {0.0, 0.0}, {1.0, 0.0}};
     double mat[3][3] = MAT3_IDENTITY;
+    grid_quad_t *quad;
     uv_map_t map = {
         .map   = spherical_project,
         .user  = rot,
@@ -548,11 +636,10 @@ static void render_recursion(
     mat3_itranslate(mat, pos[0], pos[1]);
 
     // Compute quad corners in clipping space.
+    quad = get_quad(line, &map, mat, splits, pos);
     for (i = 0; i < 4; i++) {
-        mat3_mul_vec2(mat, uv[i], p);
-        spherical_project(&map, p, p);
-        convert_frame(painter->obs, line->frame, FRAME_VIEW, true, p, p);
-        vec3_copy(p, pos_view[i]);
+        convert_frame(painter->obs, line->frame, FRAME_VIEW, true,
+                      quad->corners[i], pos_view[i]);
         project_to_clip(painter->proj, pos_view[i], pos_clip[i]);
     }
     // If the quad is clipped we stop the recursion.
@@ -590,7 +677,9 @@ static void render_recursion(
                 (pos[1] == 0 || pos[1] == splits[1] - 1))
             continue;
 
-        paint_line(painter, line->frame, lines + dir * 2, &map, 8, 0);
+        paint_line_points(painter, line->frame, LINE_SPLIT + 1,
+                          get_quad_side(quad, &map, dir, lines + dir * 2),
+                          lines + dir * 2, &map, 0);
         if (!line->format) continue;
         if (check_borders(pos_view[0], pos_view[2 - dir], painter->proj,
                           p, u, v)) {
@@ -17,6 +17,8 @@
 #include <zlib.h>
 
 #define URL_MAX_SIZE 4096
+// Max number of tiles summaries we keep per survey.
+#define SUMMARIES_MAX_COUNT (1 << 16)
 
 static const double LABEL_SPACING = 4;
 
@@ -39,6 +41,23 @@ typedef struct {
     char    *sp_type;
 } star_t;
 
+/*
+ * Type: tile_summary_t
+ * Magnitude range and number of stars of a tile.
+ *
+ * We keep them for the last SUMMARIES_MAX_COUNT tiles we loaded, even
+ * after the tiles get removed from the cache, so that we don't have to
+ * load or decode again tiles that only contain stars too faint to be
+ * rendered.
+ */
+typedef struct tile_summary {
+    UT_hash_handle  hh;
+    uint64_t        nuniq;  // Healpix nuniq of the tile, used as key.
+    double          mag_min;
+    double          mag_max;
+    int             nb;
+} tile_summary_t;
+
 typedef struct survey survey_t;
 struct survey {
     stars_t *stars;
@@ -49,6 +68,7 @@ struct survey {
     double  min_vmag; // Don't render survey below this mag.
     double  max_vmag;
     bool    is_gaia;
+    tile_summary_t *summaries; // Summary of all the loaded tiles.
     survey_t *next, *prev;
 };
 
@@ -88,6 +108,11 @@ static void nuniq_to_pix(uint64_t nuniq, int *order, int *pix)
     *pix = nuniq - 4 * (1 << (2 * (*order)));
 }
 
+static uint64_t pix_to_nuniq(int order, int pix)
+{
+    return pix + 4 * (1ULL << (2 * order));
+}
+
 /*
  * Precompute values about the star position to make rendering faster.
  * Parameters:
@@ -605,6 +630,35 @@ static survey_t *get_survey(const stars_t *stars, const char *key)
     return NULL;
 }
 
+static tile_summary_t *get_summary(const survey_t *survey,
+                                   int order, int pix)
+{
+    tile_summary_t *summary;
+    uint64_t nuniq = pix_to_nuniq(order, pix);
+    HASH_FIND(hh, survey->summaries, &nuniq, sizeof(nuniq), summary);
+    return summary;
+}
+
+static void add_summary(survey_t *survey, int order, int pix,
+                        const tile_t *tile)
+{
+    tile_summary_t *summary;
+    if (get_summary(survey, order, pix)) return;
+    // The hash table keeps the insertion order, so this removes the
+    // oldest summary.
+    if (HASH_COUNT(survey->summaries) >= SUMMARIES_MAX_COUNT) {
+        summary = survey->summaries;
+        HASH_DEL(survey->summaries, summary);
+        free(summary);
+    }
+    summary = calloc(1, sizeof(*summary));
+    summary->nuniq = pix_to_nuniq(order, pix);
+    summary->mag_min = tile->mag_min;
+    summary->mag_max = tile->mag_max;
+    summary->nb = tile->nb;
+    HASH_ADD(hh, survey->summaries, nuniq, sizeof(summary->nuniq), summary);
+}
+
 /*
  * Function: get_tile
  * Load and return a tile.
@@ -631,45 +685,129 @@ static tile_t *get_tile(stars_t *stars, survey_t *survey, int order, int pix,
         return NULL;
     }
     tile = hips_get_tile(survey->hips, order, pix, flags, code);
+    if (tile) add_summary(survey, order, pix, tile);
     return tile;
 }
 
-static int render_visitor(stars_t *stars, const survey_t *survey,
+/*
+ * Type: render_tile_t
+ * A tile selected for rendering, with the range of its stars in the frame
+ * buffers.
+ */
+typedef struct render_tile render_tile_t;
+struct render_tile {
+    render_tile_t   *next, *prev;
+    const survey_t  *survey;
+    tile_t          *tile;
+    int             nb;     // Number of stars to render.
+    int             ofs;    // Offset of the stars in the frame buffers.
+};
+
+// Buffers of all the stars rendered in the frame.
+typedef struct {
+    const painter_t *painter;
+    const star_t    **stars;
+    double          (*pos)[3];
+    double          (*win)[2];
+    bool            *visible;
+} render_buffers_t;
+
+/*
+ * Select the tiles to render.  This only does the traversal, so that the
+ * stars of all the tiles can then be projected in parallel.
+ */
+static int select_visitor(stars_t *stars, const survey_t *survey,
                           int order, int pix,
-                          const painter_t *painter_,
+                          const painter_t *painter,
                           int *nb_tot, int *nb_loaded,
-                          double *illuminance)
+                          render_tile_t **tiles, int *nb_stars)
 {
-    painter_t painter = *painter_;
     tile_t *tile;
-    int i, n = 0, code;
-    star_t *s;
-    double p_win[4], size = 0, luminance = 0, vmag = -DBL_MAX;
-    double color[3];
-    double v[3];
-    double limit_mag = min(painter.stars_limit_mag, painter.hard_limit_mag);
-    bool selected;
+    const tile_summary_t *summary;
+    int nb, code;
+    render_tile_t *rtile;
+    double limit_mag = min(painter->stars_limit_mag, painter->hard_limit_mag);
 
     // Early exit if the tile is clipped.
-    if (painter_is_healpix_clipped(&painter, FRAME_ASTROM, order, pix))
+    if (painter_is_healpix_clipped(painter, FRAME_ASTROM, order, pix))
         return 0;
     if (order < survey->min_order) return 1;
 
     (*nb_tot)++;
+
+    // If we already know that all the stars of the tile are too faint,
+    // we don't need the tile at all.  We still load the empty tiles since
+    // we might need to go into their children.
+    summary = get_summary(survey, order, pix);
+    if (summary && summary->nb && summary->mag_min > limit_mag) {
+        (*nb_loaded)++;
+        return 0;
+    }
+
     tile = get_tile(stars, survey, order, pix, false, &code);
     if (code) (*nb_loaded)++;
 
     if (!tile) goto end;
     if (tile->mag_min > limit_mag) goto end;
 
-    point_t *points = malloc(tile->nb * sizeof(*points));
-    for (i = 0; i < tile->nb; i++) {
-        s = &tile->sources[i];
-        if (s->vmag > limit_mag) break;
+    // Stars are sorted by vmag, so we only need the first nb ones.
+    for (nb = 0; nb < tile->nb; nb++) {
+        if (tile->sources[nb].vmag > limit_mag) break;
+    }
+    rtile = arena_calloc(core->frame_arena, 1, sizeof(*rtile));
+    rtile->survey = survey;
+    rtile->tile = tile;
+    rtile->nb = nb;
+    rtile->ofs = *nb_stars;
+    *nb_stars += nb;
+    DL_APPEND(*tiles, rtile);
 
-        star_get_astrom(s, painter.obs, v);
-        if (!painter_project(&painter, FRAME_ASTROM, v, true, true, p_win))
-            continue;
+end:
+    // Test if we should go into higher order tiles.
+    if (!tile || (tile->mag_max > limit_mag))
+        return 0;
+    return 1;
+}
+
+/*
+ * Compute the astrometric and screen positions of a range of stars.
+ * Called by parallel_for, so this must be thread safe.
+ */
+static void project_stars(void *user, int start, int end)
+{
+    render_buffers_t *bufs = user;
+    const painter_t *painter = bufs->painter;
+    int i;
+
+    for (i = start; i < end; i++)
+        star_get_astrom(bufs->stars[i], painter->obs, bufs->pos[i]);
+    painter_project_n(painter, FRAME_ASTROM, end - start,
+                      bufs->pos + start, true, true,
+                      bufs->win + start, bufs->visible + start);
+}
+
+static void render_tile(stars_t *stars, const render_tile_t *rtile,
+                        const render_buffers_t *bufs,
+                        const painter_t *painter_, double *illuminance)
+{
+    painter_t painter = *painter_;
+    int i, n = 0;
+    star_t *s;
+    double p_win[4], size = 0, luminance = 0, vmag = -DBL_MAX;
+    double color[3];
+    const double (*pos)[3] = bufs->pos + rtile->ofs;
+    const double (*win)[2] = bufs->win + rtile->ofs;
+    const bool *visible = bufs->visible + rtile->ofs;
+    bool selected;
+    point_t *points;
+
+    // Temporary buffer, released at the end of the frame.
+    points = arena_alloc(core->frame_arena, rtile->nb * sizeof(*points));
+
+    for (i = 0; i < rtile->nb; i++) {
+        if (!visible[i]) continue;
+        s = &rtile->tile->sources[i];
+        vec2_copy(win[i], p_win);
 
         (*illuminance) += s->illuminance;
 
@@ -693,33 +831,34 @@ static int render_visitor(stars_t *stars, const survey_t *survey,
         };
         n++;
         selected = (&s->obj == core->selection);
-        if (selected || (stars->hints_visible && !survey->is_gaia))
-            star_render_name(&painter, s, FRAME_ASTROM, v, p_win, size, color);
+        if (selected || (stars->hints_visible && !rtile->survey->is_gaia))
+            star_render_name(&painter, s, FRAME_ASTROM, pos[i], p_win, size,
+                             color);
     }
     if (n > 0) {
         paint_2d_points(&painter, n, points);
     }
-    free(points);
-
-end:
-    // Test if we should go into higher order tiles.
-    if (!tile || (tile->mag_max > limit_mag))
-        return 0;
-    return 1;
 }
 
 
 static int stars_render(const obj_t *obj, const painter_t *painter_)
 {
     stars_t *stars = (stars_t*)obj;
-    int nb_tot = 0, nb_loaded = 0, order, pix, r;
+    int nb_tot = 0, nb_loaded = 0, nb_stars = 0, order, pix, r, i;
     double illuminance = 0; // Totall illuminance
     painter_t painter = *painter_;
     survey_t *survey;
     hips_iterator_t iter;
+    render_tile_t *tiles = NULL, *rtile;
+    render_buffers_t bufs = {.painter = &painter};
 
     if (!stars->visible) return 0;
 
+    // The rendering is done in three steps:
+    // 1. Select the tiles to render and load them.
+    // 2. Project all the stars, in parallel if possible.
+    // 3. Render the tiles in the traversal order, so that the result is the
+    //    same as if we rendered each tile directly.
     DL_FOREACH(stars->surveys, survey) {
         // Don't even traverse if the min vmag of the survey is higher than
         // the max visible vmag.
@@ -727,12 +866,28 @@ static int stars_render(const obj_t *obj, const painter_t *painter_)
             continue;
         hips_iter_init(&iter);
         while (hips_iter_next(&iter, &order, &pix)) {
-            r = render_visitor(stars, survey, order, pix, &painter,
-                               &nb_tot, &nb_loaded, &illuminance);
+            r = select_visitor(stars, survey, order, pix, &painter,
+                               &nb_tot, &nb_loaded, &tiles, &nb_stars);
             if (r == 1) hips_iter_push_children(&iter, order, pix);
         }
     }
 
+    bufs.stars = arena_alloc(core->frame_arena,
+                             nb_stars * sizeof(*bufs.stars));
+    bufs.pos = arena_alloc(core->frame_arena, nb_stars * sizeof(*bufs.pos));
+    bufs.win = arena_alloc(core->frame_arena, nb_stars * sizeof(*bufs.win));
+    bufs.visible = arena_alloc(core->frame_arena,
+                               nb_stars * sizeof(*bufs.visible));
+    DL_FOREACH(tiles, rtile) {
+        for (i = 0; i < rtile->nb; i++)
+            bufs.stars[rtile->ofs + i] = &rtile->tile->sources[i];
+    }
+    parallel_for(nb_stars, 4096, &bufs, project_stars);
+
+    DL_FOREACH(tiles, rtile) {
+        render_tile(stars, rtile, &bufs, &painter, &illuminance);
+    }
+
     /* Get the global stars luminance */
     double lum = core_illuminance_to_lum_apparent(illuminance, 0);
 
@@ -752,6 +907,7 @@ static int stars_list(const obj_t *obj,
 {
     int order, pix, i, r, code;
     tile_t *tile;
+    const tile_summary_t *summary;
     stars_t *stars = (void*)obj;
     hips_iterator_t iter;
     survey_t *survey = NULL;
@@ -772,6 +928,9 @@ static int stars_list(const obj_t *obj,
     if (!hint) {
         hips_iter_init(&iter);
         while (hips_iter_next(&iter, &order, &pix)) {
+            summary = get_summary(survey, order, pix);
+            if (summary && summary->nb && summary->mag_min >= max_mag)
+                continue;
             tile = get_tile(stars, survey, order, pix, false, &code);
             if (!tile || tile->mag_min >= max_mag) continue;
             for (i = 0; i < tile->nb; i++) {
@@ -1003,4 +1162,72 @@ static void test_create_from_json(void)
 }
 TEST_REGISTER(NULL, test_create_from_json, TEST_AUTO);
 
+static int g_test_created[12]; // Number of tiles created per pix.
+
+static const void *test_create_tile(
+        void *user, int order, int pix, void *data, int size,
+        int *cost, int *transparency)
+{
+    g_test_created[pix]++;
+    return calloc(1, sizeof(tile_t));
+}
+
+static int test_list_callback(void *user, obj_t *obj)
+{
+    return 0;
+}
+
+// Check that a tile whose summary says that all the stars are too faint is
+// skipped without getting the tile.
+static void test_summaries(void)
+{
+    static char urls[13][64];
+    const char *props =
+        "hips_order = 0\n"
+        "hips_order_min = 0\n"
+        "hips_tile_format = eph\n"
+        "type = stars\n";
+    hips_settings_t settings = {
+        .create_tile = test_create_tile,
+        .delete_tile = del_tile,
+    };
+    stars_t *stars = (void*)core_get_module("stars");
+    survey_t *survey;
+    tile_summary_t *summary, *tmp;
+    int i;
+
+    for (i = 0; i < 12; i++) {
+        snprintf(urls[i], sizeof(urls[i]),
+                 "asset://test-stars/Norder0/Dir0/Npix%d.eph", i);
+        asset_register(urls[i], "", 1, false);
+    }
+    snprintf(urls[12], sizeof(urls[12]), "asset://test-stars/properties");
+    asset_register(urls[12], props, strlen(props) + 1, false);
+
+    survey = calloc(1, sizeof(*survey));
+    snprintf(survey->key, sizeof(survey->key), "test");
+    snprintf(survey->url, sizeof(survey->url), "asset://test-stars");
+    settings.user = survey;
+    survey->hips = hips_create(survey->url, 0, &settings);
+    DL_APPEND(stars->surveys, survey);
+
+    add_summary(survey, 0, 0, &(tile_t){.mag_min = 10, .mag_max = 12,
+                                         .nb = 3});
+    // The tiles are loaded in a worker, so we need two passes to create
+    // them.
+    for (i = 0; i < 2; i++)
+        stars_list(&stars->obj, 5.0, 0, "test", NULL, test_list_callback);
+    assert(g_test_created[0] == 0);
+    assert(g_test_created[1] == 1);
+
+    DL_DELETE(stars->surveys, survey);
+    HASH_ITER(hh, survey->summaries, summary, tmp) {
+        HASH_DEL(survey->summaries, summary);
+        free(summary);
+    }
+    hips_delete(survey->hips);
+    free(survey);
+}
+TEST_REGISTER(NULL, test_summaries, TEST_AUTO);
+
 #endif
@@ -197,15 +197,12 @@ int obj_get_pos(obj_t *obj, observer_t *obs, int frame, double pos[4])
     return 0;
 }
 
-int obj_get_info(obj_t *obj, observer_t *obs, int info,
-                 void *out)
+// Same as obj_get_info, but assume the observer is already up to date.
+static int get_info(obj_t *obj, const observer_t *obs, int info, void *out)
 {
     double pvo[2][4], pos[3], ra, dec;
     int ret;
 
-    assert(obj);
-    observer_update(obs, true);
-
     if (obj->klass->get_info) {
         ret = obj->klass->get_info(obj, obs, info, out);
         if (!ret) return ret;
@@ -215,17 +212,17 @@ int obj_get_info(obj_t *obj, observer_t *obs, int info,
     // Some fallback values.
     switch (info) {
     case INFO_RADEC: // First component of the PVO info.
-        obj_get_info(obj, obs, INFO_PVO, pvo);
+        get_info(obj, obs, INFO_PVO, pvo);
         memcpy(out, pvo[0], sizeof(pvo[0]));
         return 0;
     case INFO_LHA:
-        obj_get_info(obj, obs, INFO_PVO, pvo);
+        get_info(obj, obs, INFO_PVO, pvo);
         convert_frame(obs, FRAME_ICRF, FRAME_CIRS, 0, pvo[0], pos);
         eraC2s(pos, &ra, &dec);
         *(double*)out = eraAnpm(obs->astrom.eral - ra);
         return 0;
     case INFO_DISTANCE:
-        obj_get_pvo(obj, obs, pvo);
+        get_info(obj, obs, INFO_PVO, pvo);
         *(double*)out = pvo[0][3] ? vec3_norm(pvo[0]) : NAN;
         return 0;
     default:
@@ -235,6 +232,72 @@ int obj_get_info(obj_t *obj, observer_t *obs, int info,
     return 1;
 }
 
+int obj_get_info(obj_t *obj, observer_t *obs, int info,
+                 void *out)
+{
+    assert(obj);
+    observer_update(obs, true);
+    return get_info(obj, obs, info, out);
+}
+
+EMSCRIPTEN_KEEPALIVE
+int obj_info_size(int info)
+{
+    switch (info % 16) {
+    case TYPE_FLOAT:
+    case TYPE_INT:
+    case TYPE_BOOL:
+        return 1;
+    case TYPE_V2:
+        return 2;
+    case TYPE_V3:
+        return 3;
+    case TYPE_V4:
+        return 4;
+    case TYPE_V4X2:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+EMSCRIPTEN_KEEPALIVE
+int obj_get_infos(int nb, obj_t **objs, const observer_t *obs,
+                  int nb_infos, const int *infos, double *out)
+{
+    int i, j, k, size, stride = 0;
+    union {
+        bool b;
+        int d;
+        double v[8];
+    } v;
+
+    for (j = 0; j < nb_infos; j++) {
+        if (obj_info_size(infos[j]) == 0)
+            LOG_W_ONCE("Info %s is not numeric", obj_info_str(infos[j]));
+        stride += obj_info_size(infos[j]);
+    }
+
+    assert(observer_is_uptodate(obs, true));
+    for (i = 0; i < nb; i++) {
+        for (j = 0; j < nb_infos; j++) {
+            size = obj_info_size(infos[j]);
+            if (!size) continue;
+            if (!objs[i] || get_info(objs[i], obs, infos[j], v.v)) {
+                for (k = 0; k < size; k++) out[k] = NAN;
+            } else if (infos[j] % 16 == TYPE_INT) {
+                out[0] = v.d;
+            } else if (infos[j] % 16 == TYPE_BOOL) {
+                out[0] = v.b;
+            } else {
+                memcpy(out, v.v, size * sizeof(double));
+            }
+            out += size;
+        }
+    }
+    return stride;
+}
+
 EMSCRIPTEN_KEEPALIVE
 char *obj_get_info_json(const obj_t *obj, observer_t *obs,
                         const char *info_str)
@@ -684,6 +747,7 @@ const char *obj_info_type_str(int type)
     return names[type];
 }
 
+EMSCRIPTEN_KEEPALIVE
 int obj_info_from_str(const char *str)
 {
 #define X(name, ...) if (strcasecmp(str, #name) == 0) return INFO_##name;
@@ -356,6 +356,37 @@ int obj_get_pos(obj_t *obj, observer_t *obs, int frame, double pos[S 4]);
  */
 int obj_get_info(obj_t *obj, observer_t *obs, int info, void *out);
 
+/*
+ * Function: obj_get_infos
+ * Compute several numeric infos for a list of objects in a single call.
+ *
+ * The observer must already be up to date.  The values are written one
+ * object after the other into a dense table of doubles, each row
+ * containing the infos in the given order, using obj_info_size values per
+ * info.  Unavailable infos are set to NAN.
+ *
+ * Parameters:
+ *   nb       - Number of objects.
+ *   objs     - Array of objects.
+ *   obs      - An observer.
+ *   nb_infos - Number of infos.
+ *   infos    - Array of info enum values (INFO_VMAG, INFO_RADEC, etc).
+ *   out      - Output table, of at least nb * row size doubles.
+ *
+ * Return:
+ *   The size of a row, in number of doubles.
+ */
+int obj_get_infos(int nb, obj_t **objs, const observer_t *obs,
+                  int nb_infos, const int *infos, double *out);
+
+/*
+ * Function: obj_info_size
+ * Return the number of doubles used to store a numeric info value
+ *
+ * Return zero for non numeric infos (strings, pointers).
+ */
+int obj_info_size(int info);
+
 /*
  * Function: obj_get_info_json
  * Same as obj_get_info, but the info as a string, and return the result
@@ -240,6 +240,7 @@ static void observer_update_full(observer_t *obs)
     correct_speed_of_light(obs->sun_pvo);
 }
 
+EMSCRIPTEN_KEEPALIVE
 void observer_update(observer_t *obs, bool fast)
 {
 
@@ -13,6 +13,9 @@
 
 #include <float.h>
 
+// Number of points painter_project_n processes together.
+#define PROJECT_BATCH_SIZE 256
+
 static bool g_debug = false;
 
 // Test if a shape in clipping coordinates is clipped or not.
@@ -344,6 +347,25 @@ split:
     return 0;
 }
 
+int paint_line_points(const painter_t *painter, int frame,
+                      int size, const double (*points)[3],
+                      double line[2][4], const uv_map_t *map, int flags)
+{
+    double (*view)[3], (*win)[3];
+
+    view = arena_alloc(core->frame_arena, size * sizeof(*view));
+    win = arena_alloc(core->frame_arena, size * sizeof(*win));
+    convert_frame_n(painter->obs, frame, FRAME_VIEW, true, size, points, view);
+    if ((painter->proj->flags & PROJ_HAS_DISCONTINUITY) &&
+        segment_intersects_discontinuity_line(view[0], view[size - 1]))
+    {
+        return paint_line(painter, frame, line, map, size - 1, flags);
+    }
+    project_to_win_n(painter->proj, size, view, win, NULL);
+    render_line(painter->rend, painter, view, win, size);
+    return 0;
+}
+
 /*
  * Function: paint_mesh
  * Render a 3d mesh
@@ -585,9 +607,24 @@ static bool painter_is_planet_quad_clipped(const painter_t *painter, int frame,
 bool painter_is_healpix_clipped(const painter_t *painter, int frame,
                                 int order, int pix)
 {
-    uv_map_t map;
-    uv_map_init_healpix(&map, order, pix, false, false);
-    return painter_is_quad_clipped(painter, frame, &map);
+    double cap[4], corners[4][3], p[4][4];
+    int i;
+
+    // Same as painter_is_quad_clipped, but using the precomputed healpix
+    // geometry.
+    healpix_get_geometry(order, pix, cap, corners);
+    if (painter_is_cap_clipped(painter, frame, cap))
+        return true;
+    if (order < 2)
+        return false;
+
+    convert_frame_n(painter->obs, frame, FRAME_VIEW, false, 4,
+                    corners, corners);
+    for (i = 0; i < 4; i++) {
+        project_to_clip(painter->proj, corners[i], p[i]);
+        assert(!isnan(p[i][0]));
+    }
+    return is_clipped(4, p);
 }
 
 bool painter_is_planet_healpix_clipped(const painter_t *painter,
@@ -847,11 +884,11 @@ void paint_3d_model(const painter_t *painter, const char *model,
 }
 
 
-void painter_project_ellipse(const painter_t *painter, int frame,
+void painter_get_ellipse_points(
         float ra, float de, float angle, float size_x, float size_y,
-        double win_pos[2], double win_size[2], double *win_angle)
+        double out[3][3])
 {
-    double p[4], c[4], a[4], b[4], mat[3][3];
+    double mat[3][3], tmp[3][3];
 
     assert(!isnan(ra));
     assert(!isnan(de));
@@ -865,57 +902,72 @@ void painter_project_ellipse(const painter_t *painter, int frame,
     }
 
     // 1. Center.
-    vec4_set(p, 1, 0, 0, 0);
     mat3_set_identity(mat);
     mat3_rz(ra, mat, mat);
     mat3_ry(-de, mat, mat);
-    mat3_mul_vec3(mat, p, p);
-    convert_frame(painter->obs, frame, FRAME_VIEW, true, p, p);
-    project_to_win(painter->proj, p, c);
+    mat3_mul_vec3(mat, VEC(1, 0, 0), out[0]);
 
     // Point ellipse.
     if (size_x == 0) {
-        vec2_copy(c, win_pos);
-        vec2_set(win_size, 0, 0);
-        *win_angle = 0;
+        vec3_set(out[1], 0, 0, 0);
+        vec3_set(out[2], 0, 0, 0);
         return;
     }
 
     // 2. Semi major.
-    vec4_set(p, 1, 0, 0, 0);
-    mat3_set_identity(mat);
-    mat3_rz(ra, mat, mat);
-    mat3_ry(-de, mat, mat);
     if (!isnan(angle)) mat3_rx(-angle, mat, mat);
     mat3_iscale(mat, 1.0, size_y / size_x, 1.0);
-    mat3_rz(size_x / 2.0, mat, mat);
-    mat3_mul_vec3(mat, p, p);
-    vec3_normalize(p, p);
-    convert_frame(painter->obs, frame, FRAME_VIEW, true, p, p);
-    project_to_win(painter->proj, p, a);
+    mat3_rz(size_x / 2.0, mat, tmp);
+    mat3_mul_vec3(tmp, VEC(1, 0, 0), out[1]);
+    vec3_normalize(out[1], out[1]);
 
     // 3. Semi minor.
-    vec4_set(p, 1, 0, 0, 0);
-    mat3_set_identity(mat);
-    mat3_rz(ra, mat, mat);
-    mat3_ry(-de, mat, mat);
-    if (!isnan(angle)) mat3_rx(-angle, mat, mat);
-    mat3_iscale(mat, 1.0, size_y / size_x, 1.0);
     mat3_rx(-M_PI / 2, mat, mat);
     mat3_rz(size_x / 2.0, mat, mat);
-    mat3_mul_vec3(mat, p, p);
-    vec3_normalize(p, p);
-    convert_frame(painter->obs, frame, FRAME_VIEW, true, p, p);
-    project_to_win(painter->proj, p, b);
+    mat3_mul_vec3(mat, VEC(1, 0, 0), out[2]);
+    vec3_normalize(out[2], out[2]);
+}
+
+void painter_project_ellipse_points(const painter_t *painter, int frame,
+        const double points[3][3], bool oriented,
+        double win_pos[2], double win_size[2], double *win_angle)
+{
+    double p[3], c[3], a[3], b[3];
 
+    convert_frame(painter->obs, frame, FRAME_VIEW, true, points[0], p);
+    project_to_win(painter->proj, p, c);
     vec2_copy(c, win_pos);
+
+    // Point ellipse.
+    if (vec3_norm2(points[1]) == 0) {
+        vec2_set(win_size, 0, 0);
+        *win_angle = 0;
+        return;
+    }
+
+    convert_frame(painter->obs, frame, FRAME_VIEW, true, points[1], p);
+    project_to_win(painter->proj, p, a);
+    convert_frame(painter->obs, frame, FRAME_VIEW, true, points[2], p);
+    project_to_win(painter->proj, p, b);
+
     vec2_sub(a, c, a);
     vec2_sub(b, c, b);
-    *win_angle = isnan(angle) ? 0 : atan2(a[1], a[0]);
+    *win_angle = oriented ? atan2(a[1], a[0]) : 0;
     win_size[0] = 2 * vec2_norm(a);
     win_size[1] = 2 * vec2_norm(b);
 }
 
+void painter_project_ellipse(const painter_t *painter, int frame,
+        float ra, float de, float angle, float size_x, float size_y,
+        double win_pos[2], double win_size[2], double *win_angle)
+{
+    double points[3][3];
+    painter_get_ellipse_points(ra, de, angle, size_x, size_y, points);
+    painter_project_ellipse_points(painter, frame, points,
+                                   !isnan(angle) || !isnan(size_y),
+                                   win_pos, win_size, win_angle);
+}
+
 /*
  * Check if a position in windows coordinates is visible or not.
  */
@@ -941,6 +993,42 @@ bool painter_project(const painter_t *painter, int frame,
     return is_visible_win(v, painter->proj->window_size);
 }
 
+int painter_project_n(const painter_t *painter, int frame, int n,
+                      const double (*pos)[3], bool at_inf, bool clip_first,
+                      double (*win_pos)[2], bool *visible)
+{
+    int i, start, nb, ret = 0;
+    int idx[PROJECT_BATCH_SIZE];
+    bool ok[PROJECT_BATCH_SIZE];
+    double v[PROJECT_BATCH_SIZE][3];
+
+    // Process the points by batches, so that we can keep the temporary
+    // buffers on the stack and be called from any thread.
+    for (start = 0; start < n; start += PROJECT_BATCH_SIZE) {
+        // Only keep the non clipped points, and process them in batch.
+        nb = 0;
+        for (i = start; i < n && i < start + PROJECT_BATCH_SIZE; i++) {
+            visible[i] = false;
+            if (clip_first && painter_is_point_clipped_fast(
+                        painter, frame, pos[i], at_inf))
+                continue;
+            vec3_copy(pos[i], v[nb]);
+            idx[nb++] = i;
+        }
+        convert_frame_n(painter->obs, frame, FRAME_VIEW, at_inf, nb, v, v);
+        project_to_win_n(painter->proj, nb, v, v, ok);
+
+        for (i = 0; i < nb; i++) {
+            if (!ok[i] || !is_visible_win(v[i], painter->proj->window_size))
+                continue;
+            vec2_copy(v[i], win_pos[idx[i]]);
+            visible[idx[i]] = true;
+            ret++;
+        }
+    }
+    return ret;
+}
+
 bool painter_unproject(const painter_t *painter, int frame,
                      const double win_pos[2], double pos[3]) {
     double p[4] = {win_pos[0], win_pos[1], 0};
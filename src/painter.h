@@ -170,9 +170,9 @@ struct painter
             //   Ay, By, Cy, Dy, Ey, ky,
             float p[12];
             float sun[3]; // Sun position.
-            // Callback to compute the luminosity at a given point.
-            float (*compute_lum)(void *user, const float pos[3]);
-            void *user;
+            // Luminance at each vertex of the quad grid, in the same order
+            // as the output of uv_map_grid.
+            const float *lum;
         } atm;
 
         // For line rendering only.
@@ -289,6 +289,29 @@ int paint_line(const painter_t *painter,
                double line[2][4], const uv_map_t *map,
                int split, int flags);
 
+/*
+ * Function: paint_line_points
+ * Render a line already tessellated into points at infinity.
+ *
+ * This gives the same result as <paint_line> with a positive split value,
+ * but the caller can cache the points, so that we only have to convert and
+ * project them.
+ *
+ * Parameters:
+ *   painter    - A painter instance.
+ *   frame      - Frame of the points.
+ *   size       - Number of points.
+ *   points     - The normalized points of the line.
+ *   line       - The parametric line the points come from, as passed to
+ *                <paint_line>.  Used if the line needs to be split on a
+ *                projection discontinuity.
+ *   map        - The line mapping function.
+ *   flags      - Flags passed to <paint_line> in the discontinuity case.
+ */
+int paint_line_points(const painter_t *painter, int frame,
+                      int size, const double (*points)[3],
+                      double line[2][4], const uv_map_t *map, int flags);
+
 /*
  * Function: paint_mesh
  * Render a 3d mesh
@@ -588,6 +611,41 @@ void painter_project_ellipse(const painter_t *painter, int frame,
         float ra, float de, float angle, float size_x, float size_y,
         double win_pos[2], double win_size[2], double *win_angle);
 
+/*
+ * Function: painter_get_ellipse_points
+ * Compute the 3D points used to project an ellipse defined on the sphere.
+ *
+ * The points don't depend on the observer, so they can be computed once
+ * for static objects, and then projected with
+ * <painter_project_ellipse_points>.
+ *
+ * Parameters:
+ *   ra, de, angle, size_x, size_y - Same as for <painter_project_ellipse>.
+ *   out    - Output center, semi major and semi minor axis points, as
+ *            normalized vectors.  The axis points are set to zero for
+ *            point ellipses.
+ */
+void painter_get_ellipse_points(
+        float ra, float de, float angle, float size_x, float size_y,
+        double out[3][3]);
+
+/*
+ * Function: painter_project_ellipse_points
+ * Project an ellipse from points computed with <painter_get_ellipse_points>.
+ *
+ * Parameters:
+ *   painter    - The painter.
+ *   frame      - The frame in which the points are defined.
+ *   points     - The ellipse points.
+ *   oriented   - If false, the returned win_angle is always zero.
+ *   win_pos    - The ellipse center in screen coordinates (px).
+ *   win_size   - The ellipse small and large sizes in screen coordinates (px).
+ *   win_angle  - The ellipse angle in screen coordinates (radian).
+ */
+void painter_project_ellipse_points(const painter_t *painter, int frame,
+        const double points[3][3], bool oriented,
+        double win_pos[2], double win_size[2], double *win_angle);
+
 /*
  * Function: painter_project
  * Project a point defined on the sphere to the screen.
@@ -608,6 +666,33 @@ void painter_project_ellipse(const painter_t *painter, int frame,
 bool painter_project(const painter_t *painter, int frame, const double pos[3],
                      bool at_inf, bool clip_first, double win_pos[2]);
 
+/*
+ * Function: painter_project_n
+ * Same as painter_project for an array of points.
+ *
+ * This is faster than calling painter_project for each point, since the
+ * frame conversion and the projection are done in batch.  It doesn't
+ * allocate any memory, and can be called from any thread.
+ *
+ * Parameters:
+ *   painter    - The painter.
+ *   frame      - The frame in which the points are defined.
+ *   n          - Number of points.
+ *   pos        - The points 3D coordinates.
+ *   at_inf     - true for fixed objects (far away from the solar system).
+ *                For such objects, pos is assumed to be normalized.
+ *   clip_first - If a point is identified as clipped, skip its projection.
+ *   win_pos    - The points positions in screen coordinates (px).
+ *   visible    - Set to false for the clipped points, true otherwise.  The
+ *                value of win_pos for the clipped points is undefined.
+ *
+ * Returns:
+ *   The number of visible points.
+ */
+int painter_project_n(const painter_t *painter, int frame, int n,
+                      const double (*pos)[3], bool at_inf, bool clip_first,
+                      double (*win_pos)[2], bool *visible);
+
 
 /*
  * Function: painter_unproject
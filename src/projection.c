@@ -73,6 +73,32 @@ bool project_to_win(const projection_t *proj, const double input[3],
     return true;
 }
 
+void project_to_win_n(const projection_t *proj, int n,
+                      const double (*in)[3], double (*out)[3], bool *ok)
+{
+    int i;
+    double p[4];
+    // The perspective projection is the identity, no need to call it.
+    bool identity = proj->klass->id == PROJ_PERSPECTIVE;
+
+    for (i = 0; i < n; i++) {
+        vec3_copy(in[i], p);
+        if (!identity) proj->klass->project(proj, p, p);
+        p[3] = 1.0;
+        mat4_mul_vec4(proj->mat, p, p);
+        if (ok) ok[i] = p[3] != 0.0;
+        if (!p[3]) {
+            // Still write a defined value for the callers not using ok.
+            vec3_set(out[i], 0, 0, 0);
+            continue;
+        }
+        vec3_mul(1.0 / p[3], p, p);
+        out[i][0] = (+p[0] + 1) / 2 * proj->window_size[0];
+        out[i][1] = (-p[1] + 1) / 2 * proj->window_size[1];
+        out[i][2] = (p[2] + 1) / 2;
+    }
+}
+
 bool project_to_win_xy(const projection_t *proj, const double input[3],
                        double out[2])
 {
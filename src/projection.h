@@ -137,6 +137,21 @@ void projection_init(projection_t *proj, int type, double fovy,
 bool project_to_win(const projection_t *proj, const double input[S 3],
                     double out[S 3]);
 
+/*
+ * Function: project_to_win_n
+ * Same as project_to_win for an array of points.
+ *
+ * Parameters:
+ *   proj   - A projection.
+ *   n      - Number of points.
+ *   in     - Input points in view coordinates.
+ *   out    - Output points in windows coordinates.  Can be the same as in.
+ *   ok     - Set to false for the points where the projection failed,
+ *            whose output is then set to zero.  Can be NULL.
+ */
+void project_to_win_n(const projection_t *proj, int n,
+                      const double (*in)[3], double (*out)[3], bool *ok);
+
 /*
  * Function: project_to_win_xy
  * Similar to project_to_win, but only returns the x and y coordinates.
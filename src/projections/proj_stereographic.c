@@ -47,7 +47,7 @@ static bool proj_stereographic_project(
     vec3_mul(1. / d, v, out);
     // Discountinuity case.
     if (out[2] == 1.0) {
-        memset(out, 0, 4 * sizeof(double));
+        vec3_set(out, 0, 0, 0);
         return false;
     }
     one_over_h = 1.0 / (0.5 * (1.0 - out[2]));
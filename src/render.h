@@ -79,4 +79,27 @@ void render_model_3d(renderer_t *rend, const painter_t *painter,
                      const double view_mat[4][4], const double proj_mat[4][4],
                      const double light_dir[3], json_value *args);
 
+/*
+ * Type: render_stats_t
+ * Statistics of the last rendered frame.
+ */
+typedef struct {
+    int calls;      // Number of render functions called.
+    int vertices;   // Number of vertices emitted.
+    int indices;    // Number of indices emitted.
+    int texts;      // Number of texts rendered.
+    int draw_calls; // Number of OpenGL draw calls.
+    int instances;  // Number of instances drawn with instanced rendering.
+} render_stats_t;
+
+/*
+ * Function: render_get_stats
+ * Get the statistics of the last frame.
+ *
+ * The null renderer of the headless builds only counts the calls,
+ * vertices, indices and texts.  The OpenGL renderer counts the vertices,
+ * indices, draw calls and instances actually sent to the GPU.
+ */
+void render_get_stats(const renderer_t *rend, render_stats_t *stats);
+
 #endif // RENDER_GL_H
@@ -7,6 +7,9 @@
  * repository.
  */
 
+// Headless builds use the null renderer instead (see render_null.c).
+#if !RENDER_NULL
+
 #include "render.h"
 #include "swe.h"
 
@@ -25,6 +28,7 @@
 #include <float.h>
 
 #define GRID_CACHE_SIZE (2 * (1 << 20))
+#define PLANET_PATCH_CACHE_SIZE (8 * (1 << 20))
 
 // Fix GL_PROGRAM_POINT_SIZE support on Mac.
 #ifdef __APPLE__
@@ -39,44 +43,56 @@ enum {
 // All the shader attribute locations.
 enum {
     ATTR_POS,
-    ATTR_MPOS,
     ATTR_TEX_POS,
-    ATTR_NORMAL,
-    ATTR_TANGENT,
     ATTR_COLOR,
     ATTR_SKY_POS,
     ATTR_LUMINANCE,
     ATTR_SIZE,
     ATTR_WPOS,
+    ATTR_CORNER,
+    ATTR_WPOS_AXES,
+    ATTR_TEX_AXES,
 };
 
 static const char *ATTR_NAMES[] = {
     [ATTR_POS]          = "a_pos",
-    [ATTR_MPOS]         = "a_mpos",
     [ATTR_TEX_POS]      = "a_tex_pos",
-    [ATTR_NORMAL]       = "a_normal",
-    [ATTR_TANGENT]      = "a_tangent",
     [ATTR_COLOR]        = "a_color",
     [ATTR_SKY_POS]      = "a_sky_pos",
     [ATTR_LUMINANCE]    = "a_luminance",
     [ATTR_SIZE]         = "a_size",
     [ATTR_WPOS]         = "a_wpos",
+    [ATTR_CORNER]       = "a_corner",
+    [ATTR_WPOS_AXES]    = "a_wpos_axes",
+    [ATTR_TEX_AXES]     = "a_tex_axes",
     NULL,
 };
 
-// We keep all the text textures in a cache so that we don't have to recreate
-// them each time.
-typedef struct tex_cache tex_cache_t;
-struct tex_cache {
-    tex_cache_t *next, *prev;
-    double      size;
-    char        *text;
-    int         effects;
-    bool        in_use;
-    int         xoff;
-    int         yoff;
-    double      color[3];
+// The texts rendered by the system backend are packed into a few shared
+// atlas textures, so that we can batch all the labels of a frame together.
+// The pages are filled by shelves, and once they are all full we clear the
+// least recently used one.  The texts that don't fit in the atlas get their
+// own texture, released once they are not rendered anymore.
+#define TEXT_ATLAS_SIZE 1024
+#define TEXT_ATLAS_MAX_PAGES 8
+
+typedef struct {
     texture_t   *tex;
+    int         shelf_x;    // Current shelf position and height.
+    int         shelf_y;
+    int         shelf_h;
+    int         last_used;  // Last frame the page was used.
+} text_page_t;
+
+typedef struct text_entry text_entry_t;
+struct text_entry {
+    UT_hash_handle  hh;
+    char            *key;
+    int             page;       // -1 if the text has its own texture.
+    int             x, y, w, h;
+    int             xoff, yoff;
+    texture_t       *tex;       // Standalone texture if not in the atlas.
+    int             last_used;  // Last frame the standalone texture was used.
 };
 
 enum {
@@ -96,6 +112,19 @@ enum {
     ITEM_GLTF,
 };
 
+/*
+ * Type: planet_patch_t
+ * Vertex and index GPU buffers of a planet healpix tile grid.
+ *
+ * The vertices are on the unit sphere, so the same patches can be used
+ * by all the planets.
+ */
+typedef struct {
+    GLuint  vertex_buffer;
+    GLuint  index_buffer;
+    int     nb_indices;
+} planet_patch_t;
+
 typedef struct item item_t;
 struct item
 {
@@ -125,6 +154,10 @@ struct item
             float contrast;
             texture_t *normalmap;
             texture_t *shadow_color_tex;
+            const planet_patch_t *patch; // If NULL we use the item buffers.
+            float model_view[16]; // Model to view (with fake scaling).
+            float model[16]; // Model to frame (without fake scaling).
+            float normal_mat[9]; // Model to frame normals.
             float mv[16];
             float sun[4]; // pos + radius.
             float light_emit[3];
@@ -232,23 +265,37 @@ static const gl_buf_info_t TEXTURE_BUF = {
 };
 
 static const gl_buf_info_t TEXTURE_2D_BUF = {
-    .size = 28,
+    .size = 32,
     .attrs = {
         [ATTR_POS]      = {GL_FLOAT, 3, false, 0},
         [ATTR_WPOS]     = {GL_FLOAT, 2, false, 12},
         [ATTR_TEX_POS]  = {GL_FLOAT, 2, false, 20},
+        [ATTR_COLOR]    = {GL_UNSIGNED_BYTE, 4, true, 28},
+    },
+};
+
+// Per instance attributes of the textures quads when we use instanced
+// rendering.  The quads are parallelograms given by their first corner and
+// two axes, both in window and texture coordinates.
+static const gl_buf_info_t TEXTURE_2D_INSTANCE_BUF = {
+    .size = 64,
+    .attrs = {
+        [ATTR_POS]          = {GL_FLOAT, 3, false, 0},
+        [ATTR_WPOS]         = {GL_FLOAT, 2, false, 12},
+        [ATTR_WPOS_AXES]    = {GL_FLOAT, 4, false, 20},
+        [ATTR_TEX_POS]      = {GL_FLOAT, 2, false, 36},
+        [ATTR_TEX_AXES]     = {GL_FLOAT, 4, false, 44},
+        [ATTR_COLOR]        = {GL_UNSIGNED_BYTE, 4, true, 60},
     },
 };
 
+// Planet vertices are in model space, the transformations are done in the
+// shader.
 static const gl_buf_info_t PLANET_BUF = {
-    .size = 60,
+    .size = 20,
     .attrs = {
         [ATTR_POS]      = {GL_FLOAT, 3, false, 0},
-        [ATTR_MPOS]     = {GL_FLOAT, 3, false, 12},
-        [ATTR_TEX_POS]  = {GL_FLOAT, 2, false, 24},
-        [ATTR_COLOR]    = {GL_UNSIGNED_BYTE, 4, true, 32},
-        [ATTR_NORMAL]   = {GL_FLOAT, 3, false, 36},
-        [ATTR_TANGENT]  = {GL_FLOAT, 3, false, 48},
+        [ATTR_TEX_POS]  = {GL_FLOAT, 2, false, 12},
     },
 };
 
@@ -280,8 +327,17 @@ struct renderer {
     double  depth_max;
 
     texture_t   *white_tex;
-    tex_cache_t *tex_cache;
+    int         frame;
+
+    // Atlas of the texts rendered by the system backend.
+    struct {
+        text_page_t     pages[TEXT_ATLAS_MAX_PAGES];
+        int             nb_pages;
+        text_entry_t    *entries;
+        int             nb_textures; // Number of standalone textures.
+    } text_atlas;
     NVGcontext *vg;
+    bool       vg_frame; // Set while a nanovg frame is in progress.
 
     // Nanovg fonts references for regular and bold.
     struct {
@@ -292,6 +348,15 @@ struct renderer {
 
     item_t  *items;
     cache_t *grid_cache;
+    cache_t *planet_patch_cache;
+
+#if GL_HAS_INSTANCING
+    // Static quad used for the instanced rendering of the textures.
+    GLuint  quad_vertex_buffer;
+    GLuint  quad_index_buffer;
+#endif
+
+    render_stats_t stats;
 
 };
 
@@ -363,23 +428,63 @@ static void window_to_ndc(renderer_t *rend,
     ndc[1] = 1 - (win[1] * rend->scale / rend->fb_size[1]) * 2;
 }
 
+// Release the standalone textures of the texts not rendered in the last
+// frame.
+static void text_atlas_release_unused(renderer_t *rend)
+{
+    text_entry_t *entry, *tmp;
+
+    if (!rend->text_atlas.nb_textures) return;
+    HASH_ITER(hh, rend->text_atlas.entries, entry, tmp) {
+        if (!entry->tex || entry->last_used >= rend->frame - 1) continue;
+        HASH_DEL(rend->text_atlas.entries, entry);
+        texture_release(entry->tex);
+        free(entry->key);
+        free(entry);
+        rend->text_atlas.nb_textures--;
+    }
+}
+
 void render_prepare(renderer_t *rend, const projection_t *proj,
                     double win_w, double win_h,
                     double scale, bool cull_flipped)
 {
-    tex_cache_t *ctex;
-
     rend->fb_size[0] = win_w * scale;
     rend->fb_size[1] = win_h * scale;
     rend->scale = scale;
     rend->cull_flipped = cull_flipped;
     rend->proj = *proj;
-
-    DL_FOREACH(rend->tex_cache, ctex)
-        ctex->in_use = false;
+    rend->frame++;
+    text_atlas_release_unused(rend);
 
     rend->depth_min = DBL_MAX;
     rend->depth_max = DBL_MIN;
+    memset(&rend->stats, 0, sizeof(rend->stats));
+}
+
+void render_get_stats(const renderer_t *rend, render_stats_t *stats)
+{
+    *stats = rend->stats;
+}
+
+/*
+ * Create a new item.  The items only live until the end of the frame, so
+ * they are allocated from the frame arena, as well as their buffers.
+ */
+static item_t *item_create(int type)
+{
+    item_t *item = arena_calloc(core->frame_arena, 1, sizeof(*item));
+    item->type = type;
+    return item;
+}
+
+static void item_buf_alloc(gl_buf_t *buf, const gl_buf_info_t *info,
+                           int capacity)
+{
+    memset(buf, 0, sizeof(*buf));
+    buf->info = info;
+    buf->data = arena_alloc(core->frame_arena, capacity * info->size);
+    buf->capacity = capacity;
 }
 
 /*
@@ -435,10 +540,9 @@ void render_points_2d(renderer_t *rend, const painter_t *painter,
         item = NULL;
 
     if (!item) {
-        item = calloc(1, sizeof(*item));
-        item->type = ITEM_POINTS;
+        item = item_create(ITEM_POINTS);
         item->flags = painter->flags;
-        gl_buf_alloc(&item->buf, &POINTS_BUF, MAX_POINTS);
+        item_buf_alloc(&item->buf, &POINTS_BUF, MAX_POINTS);
         vec4_to_float(painter->color, item->color);
         item->points.halo = painter->points_halo;
         DL_APPEND(rend->items, item);
@@ -484,10 +588,9 @@ void render_points_3d(renderer_t *rend, const painter_t *painter,
         item = NULL;
 
     if (!item) {
-        item = calloc(1, sizeof(*item));
-        item->type = ITEM_POINTS_3D;
+        item = item_create(ITEM_POINTS_3D);
         item->flags = painter->flags;
-        gl_buf_alloc(&item->buf, &POINTS_3D_BUF, MAX_POINTS);
+        item_buf_alloc(&item->buf, &POINTS_3D_BUF, MAX_POINTS);
         vec4_to_float(painter->color, item->color);
         item->points.halo = painter->points_halo;
         DL_APPEND(rend->items, item);
@@ -513,6 +616,12 @@ void render_points_3d(renderer_t *rend, const painter_t *painter,
     }
 }
 
+static int del_grid(void *data)
+{
+    free(data);
+    return 0;
+}
+
 /*
  * Function: get_grid
  * Compute an uv_map grid, and cache it if possible.
@@ -535,7 +644,7 @@ static const double (*get_grid(renderer_t *rend,
     *should_delete = !can_cache;
     if (can_cache) {
         if (!rend->grid_cache)
-            rend->grid_cache = cache_create(GRID_CACHE_SIZE);
+            rend->grid_cache = cache_create("grids", GRID_CACHE_SIZE);
         grid = cache_get(rend->grid_cache, &key, sizeof(key));
         if (grid)
             return grid;
@@ -546,32 +655,109 @@ static const double (*get_grid(renderer_t *rend,
 
     if (can_cache) {
         cache_add(rend->grid_cache, &key, sizeof(key),
-                  grid, sizeof(*grid) * n * n, NULL);
+                  grid, sizeof(*grid) * n * n, del_grid);
     }
 
     return grid;
 }
 
-static void compute_tangent(const double uv[2], const uv_map_t *map,
-                            double out[3])
+/*
+ * Fill the buffers with the grid of an uv map, in model space (without the
+ * map transformation).  The buffers must have room for (grid_size + 1)^2
+ * vertices and grid_size^2 * 6 indices.
+ *
+ * Return the bounding radius of the vertices.
+ */
+static double planet_grid(const uv_map_t *map_, int grid_size,
+                          gl_buf_t *buf, gl_buf_t *indices)
 {
-    // XXX: this is what the algo should look like, except the normal map
-    // texture we use (for the Moon) doesn't follow the healpix projection.
-    /*
-    double uv1[2], uv2[2], p1[4], p2[4], tangent[3];
-    const double delta = 0.1;
-    vec2_copy(uv, uv1);
-    vec2_copy(uv, uv2);
-    uv2[0] += delta;
-    unproject(tex_proj, uv1, p1);
-    unproject(tex_proj, uv2, p2);
-    vec3_sub(p2, p1, tangent);
-    vec3_normalize(tangent, out);
-    */
-
-    double p[4] = {0}, n[3];
-    uv_map(map, uv, p, n);
-    vec3_cross(VEC(0, 0, 1), n, out);
+    int n = grid_size + 1, i, j, k;
+    double p[4], uv[2], radius = 0;
+    uv_map_t map = *map_;
+
+    // Positions of the triangles in the quads.
+    const int INDICES[6][2] = { {0, 0}, {0, 1}, {1, 0},
+                                {1, 1}, {1, 0}, {0, 1} };
+
+    map.transf = NULL;
+    for (i = 0; i < n; i++)
+    for (j = 0; j < n; j++) {
+        vec2_set(uv, (double)j / grid_size, (double)i / grid_size);
+        uv_map(&map, uv, p, NULL);
+        assert(p[3] == 1.0); // Planet can never be at infinity.
+        radius = max(radius, vec3_norm(p));
+        gl_buf_3f(buf, -1, ATTR_POS, VEC3_SPLIT(p));
+        gl_buf_2f(buf, -1, ATTR_TEX_POS, uv[0], uv[1]);
+        gl_buf_next(buf);
+    }
+
+    for (i = 0; i < grid_size; i++)
+    for (j = 0; j < grid_size; j++) {
+        for (k = 0; k < 6; k++) {
+            gl_buf_1i(indices, -1, 0,
+                      (INDICES[k][1] + i) * n + (INDICES[k][0] + j));
+            gl_buf_next(indices);
+        }
+    }
+    return radius;
+}
+
+static int del_planet_patch(void *data)
+{
+    planet_patch_t *patch = data;
+    GL(glDeleteBuffers(1, &patch->vertex_buffer));
+    GL(glDeleteBuffers(1, &patch->index_buffer));
+    free(patch);
+    return 0;
+}
+
+/*
+ * Function: get_planet_patch
+ * Return the GPU buffers of a planet healpix tile, and cache them.
+ */
+static const planet_patch_t *get_planet_patch(renderer_t *rend,
+                                              const uv_map_t *map, int split)
+{
+    planet_patch_t *patch;
+    gl_buf_t buf, indices;
+    int cost;
+    struct {
+        int order;
+        int pix;
+        int split;
+        int swapped;
+    } key = { map->order, map->pix, split, map->swapped };
+    _Static_assert(sizeof(key) == 16, "");
+
+    if (!rend->planet_patch_cache) {
+        rend->planet_patch_cache = cache_create("planet_patches",
+                                                PLANET_PATCH_CACHE_SIZE);
+    }
+    patch = cache_get(rend->planet_patch_cache, &key, sizeof(key));
+    if (patch) return patch;
+
+    gl_buf_alloc(&buf, &PLANET_BUF, (split + 1) * (split + 1));
+    gl_buf_alloc(&indices, &INDICES_BUF, split * split * 6);
+    planet_grid(map, split, &buf, &indices);
+    patch = calloc(1, sizeof(*patch));
+    patch->nb_indices = indices.nb;
+
+    GL(glGenBuffers(1, &patch->index_buffer));
+    GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, patch->index_buffer));
+    GL(glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                    indices.nb * indices.info->size,
+                    indices.data, GL_STATIC_DRAW));
+    GL(glGenBuffers(1, &patch->vertex_buffer));
+    GL(glBindBuffer(GL_ARRAY_BUFFER, patch->vertex_buffer));
+    GL(glBufferData(GL_ARRAY_BUFFER, buf.nb * buf.info->size,
+                    buf.data, GL_STATIC_DRAW));
+
+    cost = buf.nb * buf.info->size + indices.nb * indices.info->size;
+    gl_buf_release(&buf);
+    gl_buf_release(&indices);
+    cache_add(rend->planet_patch_cache, &key, sizeof(key), patch, cost,
+              del_planet_patch);
+    return patch;
 }
 
 static void quad_planet(
@@ -582,19 +768,13 @@ static void quad_planet(
                  const uv_map_t      *map)
 {
     item_t *item;
-    int n, i, j, k;
-    double p[4], mpos[4], normal[4] = {0}, tangent[4] = {0}, mv[4][4], depth;
-
-    // Positions of the triangles in the quads.
-    const int INDICES[6][2] = { {0, 0}, {0, 1}, {1, 0},
-                                {1, 1}, {1, 0}, {0, 1} };
-    n = grid_size + 1;
+    int i;
+    double mv[4][4], model[4][4], model_view[4][4], normal_mat[3][3];
+    double p1[3], p2[3], c[3], depth, radius, scale = 0;
 
     assert(painter->flags & PAINTER_ENABLE_DEPTH);
-    item = calloc(1, sizeof(*item));
-    item->type = ITEM_PLANET;
-    gl_buf_alloc(&item->buf, &PLANET_BUF, n * n * 4);
-    gl_buf_alloc(&item->indices, &INDICES_BUF, n * n * 6);
+    assert(map->transf);
+    item = item_create(ITEM_PLANET);
     vec4_to_float(painter->color, item->color);
     item->flags = painter->flags;
     item->planet.shadow_color_tex = painter->planet.shadow_color_tex;
@@ -617,6 +797,51 @@ static void quad_planet(
         mat3_to_mat4(painter->obs->ri2v, mv);
     mat4_to_float(mv, item->planet.mv);
 
+    // Healpix tiles only depend on the unit sphere geometry, so we keep
+    // them on the GPU.  Other shapes (the rings) are recomputed each frame.
+    if (map->type == UV_MAP_HEALPIX) {
+        item->planet.patch = get_planet_patch(rend, map, grid_size);
+        radius = 1.0;
+    } else {
+        item_buf_alloc(&item->buf, &PLANET_BUF,
+                       (grid_size + 1) * (grid_size + 1));
+        item_buf_alloc(&item->indices, &INDICES_BUF,
+                       grid_size * grid_size * 6);
+        radius = planet_grid(map, grid_size, &item->buf, &item->indices);
+    }
+
+    // Model to frame matrix, without the fake scaling.
+    mat4_copy(*map->transf, model);
+    for (i = 0; i < 3; i++) {
+        scale = max(scale, vec3_norm(model[i]));
+        vec3_mul(1.0 / painter->planet.scale, model[i], model[i]);
+    }
+    mat4_to_float(model, item->planet.model);
+    for (i = 0; i < 3; i++) vec3_copy((*map->transf)[i], normal_mat[i]);
+    mat3_to_float(normal_mat, item->planet.normal_mat);
+
+    // Model to view matrix.  Since the conversion to the view frame is not
+    // linear when we have refraction, we use its linear approximation
+    // around the planet center.
+    vec3_copy((*map->transf)[3], c);
+    mat4_set_identity(model_view);
+    convert_frame(painter->obs, frame, FRAME_VIEW, false, c,
+                  model_view[3]);
+    for (i = 0; i < 3; i++) {
+        vec3_add(c, (*map->transf)[i], p1);
+        vec3_sub(c, (*map->transf)[i], p2);
+        convert_frame(painter->obs, frame, FRAME_VIEW, false, p1, p1);
+        convert_frame(painter->obs, frame, FRAME_VIEW, false, p2, p2);
+        vec3_sub(p1, p2, model_view[i]);
+        vec3_mul(0.5, model_view[i], model_view[i]);
+    }
+    mat4_to_float(model_view, item->planet.model_view);
+
+    // Depth range from the bounding sphere.
+    depth = proj_get_depth(painter->proj, model_view[3]);
+    rend->depth_min = min(rend->depth_min, depth - radius * scale);
+    rend->depth_max = max(rend->depth_max, depth + radius * scale);
+
     // Set material
     if (painter->planet.light_emit)
         item->planet.material = 1; // Generic
@@ -639,49 +864,6 @@ static void quad_planet(
     assert(item->tex->w == item->tex->tex_w &&
            item->tex->h == item->tex->tex_h);
 
-    for (i = 0; i < n; i++)
-    for (j = 0; j < n; j++) {
-        vec3_set(p, (double)j / grid_size, (double)i / grid_size, 1.0);
-        gl_buf_2f(&item->buf, -1, ATTR_TEX_POS, p[0], p[1]);
-        if (item->planet.normalmap) {
-            compute_tangent(p, map, tangent);
-            gl_buf_3f(&item->buf, -1, ATTR_TANGENT, VEC3_SPLIT(tangent));
-        }
-
-        vec3_set(p, (double)j / grid_size, (double)i / grid_size, 1.0);
-        uv_map(map, p, p, normal);
-        assert(p[3] == 1.0); // Planet can never be at infinity.
-
-        gl_buf_3f(&item->buf, -1, ATTR_NORMAL, VEC3_SPLIT(normal));
-
-        // Model position (without scaling applied).
-        vec4_copy(p, mpos);
-        assert(map->transf);
-        vec3_sub(mpos, (*map->transf)[3], mpos);
-        vec3_mul(1.0 / painter->planet.scale, mpos, mpos);
-        vec3_add(mpos, (*map->transf)[3], mpos);
-        gl_buf_3f(&item->buf, -1, ATTR_MPOS, VEC3_SPLIT(mpos));
-
-        // Rendering position (with scaling applied).
-        convert_framev4(painter->obs, frame, FRAME_VIEW, p, p);
-
-        depth = proj_get_depth(painter->proj, p);
-        rend->depth_min = min(rend->depth_min, depth);
-        rend->depth_max = max(rend->depth_max, depth);
-
-        gl_buf_3f(&item->buf, -1, ATTR_POS, VEC3_SPLIT(p));
-        gl_buf_4i(&item->buf, -1, ATTR_COLOR, 255, 255, 255, 255);
-        gl_buf_next(&item->buf);
-    }
-
-    for (i = 0; i < grid_size; i++)
-    for (j = 0; j < grid_size; j++) {
-        for (k = 0; k < 6; k++) {
-            gl_buf_1i(&item->indices, -1, 0,
-                      (INDICES[k][1] + i) * n + (INDICES[k][0] + j));
-            gl_buf_next(&item->indices);
-        }
-    }
     DL_APPEND(rend->items, item);
 }
 
@@ -693,7 +875,6 @@ void render_quad(renderer_t *rend, const painter_t *painter,
     const int INDICES[6][2] = {
         {0, 0}, {0, 1}, {1, 0}, {1, 1}, {1, 0}, {0, 1} };
     double p[4], tex_pos[2], ndc_p[4];
-    float lum;
     const double (*grid)[4] = NULL;
     bool should_delete_grid;
     texture_t *tex = painter->textures[PAINTER_TEX_COLOR].tex;
@@ -713,27 +894,24 @@ void render_quad(renderer_t *rend, const painter_t *painter,
                 memcmp(item->atm.sun, painter->atm.sun, sizeof(item->atm.sun))))
             item = NULL;
         if (!item) {
-            item = calloc(1, sizeof(*item));
-            item->type = ITEM_ATMOSPHERE;
-            gl_buf_alloc(&item->buf, &ATMOSPHERE_BUF, 256);
-            gl_buf_alloc(&item->indices, &INDICES_BUF, 256 * 6);
+            item = item_create(ITEM_ATMOSPHERE);
+            item_buf_alloc(&item->buf, &ATMOSPHERE_BUF, 256);
+            item_buf_alloc(&item->indices, &INDICES_BUF, 256 * 6);
             memcpy(item->atm.p, painter->atm.p, sizeof(item->atm.p));
             memcpy(item->atm.sun, painter->atm.sun, sizeof(item->atm.sun));
         }
     } else if (painter->flags & PAINTER_FOG_SHADER) {
         item = get_item(rend, ITEM_FOG, n * n, grid_size * grid_size * 6, tex);
         if (!item) {
-            item = calloc(1, sizeof(*item));
-            item->type = ITEM_FOG;
+            item = item_create(ITEM_FOG);
             vec4_copy(painter->color, item->color);
-            gl_buf_alloc(&item->buf, &FOG_BUF, 256);
-            gl_buf_alloc(&item->indices, &INDICES_BUF, 256 * 6);
+            item_buf_alloc(&item->buf, &FOG_BUF, 256);
+            item_buf_alloc(&item->indices, &INDICES_BUF, 256 * 6);
         }
     } else {
-        item = calloc(1, sizeof(*item));
-        item->type = ITEM_TEXTURE;
-        gl_buf_alloc(&item->buf, &TEXTURE_BUF, n * n);
-        gl_buf_alloc(&item->indices, &INDICES_BUF, n * n * 6);
+        item = item_create(ITEM_TEXTURE);
+        item_buf_alloc(&item->buf, &TEXTURE_BUF, n * n);
+        item_buf_alloc(&item->indices, &INDICES_BUF, n * n * 6);
     }
 
     ofs = item->buf.nb;
@@ -754,13 +932,12 @@ void render_quad(renderer_t *rend, const painter_t *painter,
         vec4_set(p, VEC4_SPLIT(grid[i * n + j]));
         convert_framev4(painter->obs, frame, FRAME_VIEW, p, ndc_p);
         gl_buf_3f(&item->buf, -1, ATTR_POS, VEC3_SPLIT(ndc_p));
-        // For atmosphere shader, in the first pass we do not compute the
-        // luminance yet, only if the point is visible.
+        // For atmosphere shader, the luminance of the grid vertices is
+        // precomputed by the atmosphere module.
         if (painter->flags & PAINTER_ATMOSPHERE_SHADER) {
             gl_buf_3f(&item->buf, -1, ATTR_SKY_POS, VEC3_SPLIT(p));
-            lum = painter->atm.compute_lum(painter->atm.user,
-                    (float[3]){p[0], p[1], p[2]});
-            gl_buf_1f(&item->buf, -1, ATTR_LUMINANCE, lum);
+            gl_buf_1f(&item->buf, -1, ATTR_LUMINANCE,
+                      painter->atm.lum[i * n + j]);
         }
         if (painter->flags & PAINTER_FOG_SHADER) {
             gl_buf_3f(&item->buf, -1, ATTR_SKY_POS, VEC3_SPLIT(p));
@@ -781,28 +958,49 @@ void render_quad(renderer_t *rend, const painter_t *painter,
     DL_APPEND(rend->items, item);
 }
 
+/*
+ * Function: texture_2d
+ * Render a 2d textured quad.
+ *
+ * Parameters:
+ *   color        - Color of the batch item.  Quads with different colors
+ *                  are never batched together.
+ *   vertex_color - Optional color of this quad only, multiplied with the
+ *                  item color.
+ */
 static void texture_2d(renderer_t *rend, texture_t *tex,
                        double uv[4][2], double win_pos[4][2],
                        const double view_pos[3],
-                       const double color_[4], int flags)
+                       const double color_[4], const double vertex_color[4],
+                       int flags)
 {
     int i, ofs;
     item_t *item;
     const int16_t INDICES[6] = {0, 1, 2, 3, 2, 1 };
     double depth;
     float color[4];
+    uint8_t vcolor[4] = {255, 255, 255, 255};
 
     assert((bool)view_pos == (bool)(flags & PAINTER_ENABLE_DEPTH));
     vec4_to_float(color_, color);
-    item = get_item(rend, ITEM_TEXTURE_2D, 4, 6, tex);
+    if (vertex_color) {
+        for (i = 0; i < 4; i++)
+            vcolor[i] = clamp(vertex_color[i], 0.0, 1.0) * 255;
+    }
+    item = get_item(rend, ITEM_TEXTURE_2D,
+                    GL_HAS_INSTANCING ? 1 : 4, GL_HAS_INSTANCING ? 0 : 6, tex);
     if (item && memcmp(item->color, color, sizeof(color))) item = NULL;
+    if (item && item->flags != flags) item = NULL;
 
     if (!item) {
-        item = calloc(1, sizeof(*item));
-        item->type = ITEM_TEXTURE_2D;
+        item = item_create(ITEM_TEXTURE_2D);
         item->flags = flags;
-        gl_buf_alloc(&item->buf, &TEXTURE_2D_BUF, 64 * 4);
-        gl_buf_alloc(&item->indices, &INDICES_BUF, 64 * 6);
+        if (GL_HAS_INSTANCING) {
+            item_buf_alloc(&item->buf, &TEXTURE_2D_INSTANCE_BUF, 256);
+        } else {
+            item_buf_alloc(&item->buf, &TEXTURE_2D_BUF, 64 * 4);
+            item_buf_alloc(&item->indices, &INDICES_BUF, 64 * 6);
+        }
         item->tex = tex;
         item->tex->ref++;
         memcpy(item->color, color, sizeof(color));
@@ -815,12 +1013,29 @@ static void texture_2d(renderer_t *rend, texture_t *tex,
         rend->depth_max = max(rend->depth_max, depth);
     }
 
+    if (GL_HAS_INSTANCING) {
+        if (view_pos)
+            gl_buf_3f(&item->buf, -1, ATTR_POS, VEC3_SPLIT(view_pos));
+        gl_buf_2f(&item->buf, -1, ATTR_WPOS, win_pos[0][0], win_pos[0][1]);
+        gl_buf_4f(&item->buf, -1, ATTR_WPOS_AXES,
+                  win_pos[1][0] - win_pos[0][0], win_pos[1][1] - win_pos[0][1],
+                  win_pos[2][0] - win_pos[0][0], win_pos[2][1] - win_pos[0][1]);
+        gl_buf_2f(&item->buf, -1, ATTR_TEX_POS, uv[0][0], uv[0][1]);
+        gl_buf_4f(&item->buf, -1, ATTR_TEX_AXES,
+                  uv[1][0] - uv[0][0], uv[1][1] - uv[0][1],
+                  uv[2][0] - uv[0][0], uv[2][1] - uv[0][1]);
+        gl_buf_4i(&item->buf, -1, ATTR_COLOR, VEC4_SPLIT(vcolor));
+        gl_buf_next(&item->buf);
+        return;
+    }
+
     ofs = item->buf.nb;
     for (i = 0; i < 4; i++) {
         gl_buf_2f(&item->buf, -1, ATTR_WPOS, win_pos[i][0], win_pos[i][1]);
         if (view_pos)
             gl_buf_3f(&item->buf, -1, ATTR_POS, VEC3_SPLIT(view_pos));
         gl_buf_2f(&item->buf, -1, ATTR_TEX_POS, uv[i][0], uv[i][1]);
+        gl_buf_4i(&item->buf, -1, ATTR_COLOR, VEC4_SPLIT(vcolor));
         gl_buf_next(&item->buf);
     }
     for (i = 0; i < 6; i++) {
@@ -844,7 +1059,7 @@ void render_texture(renderer_t *rend, const texture_t  *tex,
         verts[i][0] = pos[0] + verts[i][0];
         verts[i][1] = pos[1] + verts[i][1];
     }
-    texture_2d(rend, tex, uv, verts, NULL, color, 0);
+    texture_2d(rend, tex, uv, verts, NULL, color, NULL, 0);
 }
 
 static uint8_t img_get(const uint8_t *img, int w, int h, int x, int y)
@@ -900,6 +1115,134 @@ static void text_shadow_effect(const uint8_t *src, uint8_t *dst,
     }
 }
 
+// Clear an atlas page and remove all its entries.
+static void text_atlas_clear_page(renderer_t *rend, int page)
+{
+    text_entry_t *entry, *tmp;
+    text_page_t *p = &rend->text_atlas.pages[page];
+    uint8_t *zero;
+
+    // Reset the texture to transparent pixels, otherwise the gaps between
+    // the new entries would still contain the old ones, that the linear
+    // filtering would bleed into the new texts.
+    zero = calloc(TEXT_ATLAS_SIZE * TEXT_ATLAS_SIZE, 4);
+    texture_set_data(p->tex, zero, TEXT_ATLAS_SIZE, TEXT_ATLAS_SIZE, 4);
+    free(zero);
+
+    HASH_ITER(hh, rend->text_atlas.entries, entry, tmp) {
+        if (entry->page != page) continue;
+        HASH_DEL(rend->text_atlas.entries, entry);
+        free(entry->key);
+        free(entry);
+    }
+    p->shelf_x = p->shelf_y = p->shelf_h = 0;
+}
+
+// Try to reserve a w x h region in an atlas page.
+static bool text_page_alloc(text_page_t *p, int w, int h, int *x, int *y)
+{
+    // One pixel gap between the entries, so that the linear filtering
+    // doesn't bleed from the neighbours.
+    w += 1;
+    h += 1;
+    if (p->shelf_x + w > TEXT_ATLAS_SIZE) {
+        p->shelf_x = 0;
+        p->shelf_y += p->shelf_h;
+        p->shelf_h = 0;
+    }
+    if (p->shelf_y + h > TEXT_ATLAS_SIZE) return false;
+    *x = p->shelf_x;
+    *y = p->shelf_y;
+    p->shelf_x += w;
+    p->shelf_h = max(p->shelf_h, h);
+    return true;
+}
+
+// Find a place for a new text image in the atlas.
+// Return the page index, or -1 if all the pages are full and already used
+// in the current frame.
+static int text_atlas_alloc(renderer_t *rend, int w, int h, int *x, int *y)
+{
+    int i, lru = -1;
+    text_page_t *p;
+
+    if (w + 1 > TEXT_ATLAS_SIZE || h + 1 > TEXT_ATLAS_SIZE) return -1;
+    for (i = 0; i < rend->text_atlas.nb_pages; i++) {
+        p = &rend->text_atlas.pages[i];
+        if (text_page_alloc(p, w, h, x, y)) return i;
+        if (p->last_used != rend->frame &&
+                (lru == -1 ||
+                 p->last_used < rend->text_atlas.pages[lru].last_used))
+            lru = i;
+    }
+    if (rend->text_atlas.nb_pages < TEXT_ATLAS_MAX_PAGES) {
+        i = rend->text_atlas.nb_pages++;
+        rend->text_atlas.pages[i].tex =
+            texture_create(TEXT_ATLAS_SIZE, TEXT_ATLAS_SIZE, 4);
+    } else if (lru != -1) {
+        i = lru;
+    } else {
+        return -1;
+    }
+    text_atlas_clear_page(rend, i);
+    text_page_alloc(&rend->text_atlas.pages[i], w, h, x, y);
+    return i;
+}
+
+// Get the atlas entry of a text, rendering it if needed.
+static text_entry_t *text_atlas_get(renderer_t *rend, const char *text,
+                                    int effects, double size)
+{
+    char *key;
+    int w, h, x, y, xoff, yoff, page;
+    uint8_t *img, *img_rgba;
+    text_entry_t *entry;
+    const double white[3] = {1, 1, 1};
+
+    asprintf(&key, "%d:%g:%s", effects, size, text);
+    HASH_FIND_STR(rend->text_atlas.entries, key, entry);
+    if (entry) {
+        free(key);
+        return entry;
+    }
+
+    img = (void*)sys_render_text(text, size * rend->scale, effects, &w, &h,
+                                 &xoff, &yoff);
+    // Shadow effect, into a texture with one pixel extra border.  We
+    // render it in white, since the final color is applied per vertex.
+    w += 2;
+    h += 2;
+    img_rgba = malloc(w * h * 4);
+    text_shadow_effect(img, img_rgba, w, h, white);
+    free(img);
+
+    entry = calloc(1, sizeof(*entry));
+    page = text_atlas_alloc(rend, w, h, &x, &y);
+    if (page != -1) {
+        texture_set_sub_data(rend->text_atlas.pages[page].tex, img_rgba,
+                             x, y, w, h, 4);
+    } else {
+        // Too large for the atlas, or all the pages are in use.
+        entry->tex = texture_from_data(img_rgba, w, h, 4, 0, 0, w, h, 0);
+        entry->last_used = rend->frame;
+        x = y = 0;
+        rend->text_atlas.nb_textures++;
+    }
+    free(img_rgba);
+
+    entry->key = key;
+    entry->page = page;
+    entry->x = x;
+    entry->y = y;
+    entry->w = w;
+    entry->h = h;
+    entry->xoff = xoff;
+    entry->yoff = yoff;
+    HASH_ADD_KEYPTR(hh, rend->text_atlas.entries, entry->key,
+                    strlen(entry->key), entry);
+    return entry;
+}
+
 // Render text using a system bakend generated texture.
 static void text_using_texture(renderer_t *rend,
                                const painter_t *painter,
@@ -912,50 +1255,22 @@ static void text_using_texture(renderer_t *rend,
     double uv[4][2], verts[4][2];
     double s[2], ofs[2] = {0, 0}, bounds[4];
     const double scale = rend->scale;
-    uint8_t *img, *img_rgba;
-    int i, w, h, xoff, yoff, flags;
-    tex_cache_t *ctex;
+    int i, flags, tex_w, tex_h;
+    text_entry_t *entry;
     texture_t *tex;
     assert(color);
 
-    DL_FOREACH(rend->tex_cache, ctex) {
-        if (ctex->size == size && ctex->effects == effects &&
-                strcmp(ctex->text, text) == 0 &&
-                memcmp(ctex->color, color, sizeof(ctex->color)) == 0) break;
-    }
-
-    if (!ctex) {
-        img = (void*)sys_render_text(text, size * scale, effects, &w, &h,
-                                     &xoff, &yoff);
-        // Shadow effect, into a texture with one pixel extra border.
-        w += 2;
-        h += 2;
-        img_rgba = malloc(w * h * 4);
-        text_shadow_effect(img, img_rgba, w, h, color);
-        free(img);
-        ctex = calloc(1, sizeof(*ctex));
-        ctex->size = size;
-        ctex->effects = effects;
-        ctex->xoff = xoff;
-        ctex->yoff = yoff;
-        ctex->text = strdup(text);
-        ctex->tex = texture_from_data(img_rgba, w, h, 4, 0, 0, w, h, 0);
-        vec3_copy(color, ctex->color);
-        free(img_rgba);
-        DL_APPEND(rend->tex_cache, ctex);
-    }
-
-    ctex->in_use = true;
+    entry = text_atlas_get(rend, text, effects, size);
 
     // Compute bounds taking alignment into account.
-    s[0] = ctex->tex->w / scale;
-    s[1] = ctex->tex->h / scale;
+    s[0] = entry->w / scale;
+    s[1] = entry->h / scale;
     if (align & ALIGN_LEFT)     ofs[0] = +s[0] / 2;
     if (align & ALIGN_RIGHT)    ofs[0] = -s[0] / 2;
     if (align & ALIGN_TOP)      ofs[1] = +s[1] / 2;
     if (align & ALIGN_BOTTOM)   ofs[1] = -s[1] / 2;
-    bounds[0] = win_pos[0] - s[0] / 2 + ofs[0] + ctex->xoff / scale;
-    bounds[1] = win_pos[1] - s[1] / 2 + ofs[1] + ctex->yoff / scale;
+    bounds[0] = win_pos[0] - s[0] / 2 + ofs[0] + entry->xoff / scale;
+    bounds[1] = win_pos[1] - s[1] / 2 + ofs[1] + entry->yoff / scale;
 
     // Round the position to the nearest pixel.  We add a small delta to
     // fix a bug when we are exactly in between two pixels, which can happen
@@ -970,17 +1285,26 @@ static void text_using_texture(renderer_t *rend,
         memcpy(out_bounds, bounds, sizeof(bounds));
         return;
     }
-    tex = ctex->tex;
+    if (entry->tex) {
+        tex = entry->tex;
+        tex_w = tex->tex_w;
+        tex_h = tex->tex_h;
+        entry->last_used = rend->frame;
+    } else {
+        tex = rend->text_atlas.pages[entry->page].tex;
+        tex_w = tex_h = TEXT_ATLAS_SIZE;
+        rend->text_atlas.pages[entry->page].last_used = rend->frame;
+    }
 
     /*
      * Render the texture, being careful to do the rotation centered on
      * the anchor point.
      */
     for (i = 0; i < 4; i++) {
-        uv[i][0] = ((i % 2) * tex->w) / (double)tex->tex_w;
-        uv[i][1] = ((i / 2) * tex->h) / (double)tex->tex_h;
-        verts[i][0] = (i % 2 - 0.5) * tex->w / scale;
-        verts[i][1] = (0.5 - i / 2) * tex->h / scale;
+        uv[i][0] = (entry->x + (i % 2) * entry->w) / (double)tex_w;
+        uv[i][1] = (entry->y + (i / 2) * entry->h) / (double)tex_h;
+        verts[i][0] = (i % 2 - 0.5) * entry->w / scale;
+        verts[i][1] = (0.5 - i / 2) * entry->h / scale;
         verts[i][0] += ofs[0];
         verts[i][1] += ofs[1];
         vec2_rotate(angle, verts[i], verts[i]);
@@ -991,7 +1315,8 @@ static void text_using_texture(renderer_t *rend,
     }
 
     flags = painter->flags;
-    texture_2d(rend, tex, uv, verts, view_pos, VEC(1, 1, 1, color[3]), flags);
+    texture_2d(rend, tex, uv, verts, view_pos, VEC(1, 1, 1, 1),
+               color, flags);
 }
 
 // Render text using nanovg.
@@ -1012,8 +1337,7 @@ static void text_using_nanovg(renderer_t *rend,
     }
 
     if (!bounds) {
-        item = calloc(1, sizeof(*item));
-        item->type = ITEM_TEXT;
+        item = item_create(ITEM_TEXT);
         item->flags = painter->flags;
         vec4_to_float(color, item->color);
         item->color[0] = clamp(item->color[0], 0.0, 1.0);
@@ -1112,6 +1436,8 @@ static void item_points_render(renderer_t *rend, const item_t *item)
     gl_buf_enable(&item->buf);
     GL(glDrawArrays(GL_POINTS, 0, item->buf.nb));
     gl_buf_disable(&item->buf);
+    rend->stats.draw_calls++;
+    rend->stats.vertices += item->buf.nb;
 
     GL(glDeleteBuffers(1, &array_buffer));
     GL(glDisable(GL_DEPTH_TEST));
@@ -1161,12 +1487,15 @@ static void item_points_3d_render(renderer_t *rend, const item_t *item)
     gl_buf_enable(&item->buf);
     GL(glDrawArrays(GL_POINTS, 0, item->buf.nb));
     gl_buf_disable(&item->buf);
+    rend->stats.draw_calls++;
+    rend->stats.vertices += item->buf.nb;
 
     GL(glDeleteBuffers(1, &array_buffer));
     GL(glDisable(GL_DEPTH_TEST));
 }
 
-static void draw_buffer(const gl_buf_t *buf, const gl_buf_t *indices,
+static void draw_buffer(renderer_t *rend,
+                        const gl_buf_t *buf, const gl_buf_t *indices,
                         GLuint gl_mode)
 {
     GLuint  array_buffer;
@@ -1185,12 +1514,72 @@ static void draw_buffer(const gl_buf_t *buf, const gl_buf_t *indices,
 
     gl_buf_enable(buf);
     GL(glDrawElements(gl_mode, indices->nb, GL_UNSIGNED_SHORT, 0));
+    rend->stats.draw_calls++;
+    rend->stats.vertices += buf->nb;
+    rend->stats.indices += indices->nb;
     gl_buf_disable(buf);
 
     GL(glDeleteBuffers(1, &array_buffer));
     GL(glDeleteBuffers(1, &index_buffer));
 }
 
+#if GL_HAS_INSTANCING
+/*
+ * Draw a buffer of per instance attributes, using a static quad of four
+ * vertices for each instance.  The quad corners are passed to the shader
+ * in the a_corner attribute.
+ */
+static void draw_instanced_quads(renderer_t *rend, const gl_buf_t *buf)
+{
+    GLuint instance_buffer;
+    const float CORNERS[4][2] = {{0, 0}, {1, 0}, {0, 1}, {1, 1}};
+    const uint16_t INDICES[6] = {0, 1, 2, 3, 2, 1};
+
+    if (!rend->quad_vertex_buffer) {
+        GL(glGenBuffers(1, &rend->quad_vertex_buffer));
+        GL(glBindBuffer(GL_ARRAY_BUFFER, rend->quad_vertex_buffer));
+        GL(glBufferData(GL_ARRAY_BUFFER, sizeof(CORNERS), CORNERS,
+                        GL_STATIC_DRAW));
+        GL(glGenBuffers(1, &rend->quad_index_buffer));
+        GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, rend->quad_index_buffer));
+        GL(glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(INDICES), INDICES,
+                        GL_STATIC_DRAW));
+    }
+
+    GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, rend->quad_index_buffer));
+    GL(glBindBuffer(GL_ARRAY_BUFFER, rend->quad_vertex_buffer));
+    GL(glEnableVertexAttribArray(ATTR_CORNER));
+    GL(glVertexAttribPointer(ATTR_CORNER, 2, GL_FLOAT, false, 0, 0));
+
+    GL(glGenBuffers(1, &instance_buffer));
+    GL(glBindBuffer(GL_ARRAY_BUFFER, instance_buffer));
+    GL(glBufferData(GL_ARRAY_BUFFER, buf->nb * buf->info->size,
+                    buf->data, GL_DYNAMIC_DRAW));
+    gl_buf_enable(buf);
+    gl_buf_set_divisor(buf, 1);
+    GL(glDrawElementsInstanced(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0,
+                               buf->nb));
+    gl_buf_set_divisor(buf, 0);
+    gl_buf_disable(buf);
+    GL(glDisableVertexAttribArray(ATTR_CORNER));
+    GL(glDeleteBuffers(1, &instance_buffer));
+
+    rend->stats.draw_calls++;
+    rend->stats.instances += buf->nb;
+}
+#endif
+
+static void draw_planet_patch(renderer_t *rend, const planet_patch_t *patch)
+{
+    const gl_buf_t buf = {.info = &PLANET_BUF};
+    GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, patch->index_buffer));
+    GL(glBindBuffer(GL_ARRAY_BUFFER, patch->vertex_buffer));
+    gl_buf_enable(&buf);
+    GL(glDrawElements(GL_TRIANGLES, patch->nb_indices, GL_UNSIGNED_SHORT, 0));
+    gl_buf_disable(&buf);
+    rend->stats.draw_calls++;
+}
+
 static void item_mesh_render(renderer_t *rend, const item_t *item)
 {
     // XXX: almost the same as item_lines_render.
@@ -1239,7 +1628,7 @@ static void item_mesh_render(renderer_t *rend, const item_t *item)
     mat4_to_float(proj.mat, matf);
     gl_update_uniform(shader, "u_proj_mat", matf);
 
-    draw_buffer(&item->buf, &item->indices, gl_mode);
+    draw_buffer(rend, &item->buf, &item->indices, gl_mode);
 
     if (item->mesh.use_stencil) {
         GL(glDisable(GL_STENCIL_TEST));
@@ -1288,15 +1677,30 @@ static void item_lines_render(renderer_t *rend, const item_t *item)
     mat4_to_float(proj.mat, matf);
     gl_update_uniform(shader, "u_proj_mat", matf);
 
-    draw_buffer(&item->buf, &item->indices, GL_TRIANGLES);
+    draw_buffer(rend, &item->buf, &item->indices, GL_TRIANGLES);
     GL(glDisable(GL_DEPTH_TEST));
 }
 
+static bool is_vg_item(const item_t *item)
+{
+    return item && (item->type == ITEM_VG_ELLIPSE ||
+                     item->type == ITEM_VG_RECT ||
+                     item->type == ITEM_VG_LINE);
+}
+
+/*
+ * Consecutive vg items (like the DSO symbols) are all rendered in the same
+ * nanovg frame, so that their geometry is uploaded and drawn in a single
+ * flush instead of one per shape.
+ */
 static void item_vg_render(renderer_t *rend, const item_t *item)
 {
     double a, da;
-    nvgBeginFrame(rend->vg, rend->fb_size[0] / rend->scale,
-                            rend->fb_size[1] / rend->scale, rend->scale);
+    if (!rend->vg_frame) {
+        nvgBeginFrame(rend->vg, rend->fb_size[0] / rend->scale,
+                                rend->fb_size[1] / rend->scale, rend->scale);
+        rend->vg_frame = true;
+    }
     nvgSave(rend->vg);
     nvgTranslate(rend->vg, item->vg.pos[0], item->vg.pos[1]);
     nvgRotate(rend->vg, item->vg.angle);
@@ -1332,7 +1736,9 @@ static void item_vg_render(renderer_t *rend, const item_t *item)
     nvgStrokeWidth(rend->vg, item->vg.stroke_width);
     nvgStroke(rend->vg);
     nvgRestore(rend->vg);
+    if (is_vg_item(item->next)) return;
     nvgEndFrame(rend->vg);
+    rend->vg_frame = false;
 
     // Reset colormask to its original value.
     GL(glColorMask(true, true, true, false));
@@ -1405,7 +1811,7 @@ static void item_fog_render(renderer_t *rend, const item_t *item)
     gl_update_uniform(shader, "u_proj_mat", matf);
     gl_update_uniform(shader, "u_color", item->color);
 
-    draw_buffer(&item->buf, &item->indices, GL_TRIANGLES);
+    draw_buffer(rend, &item->buf, &item->indices, GL_TRIANGLES);
     GL(glCullFace(GL_BACK));
 }
 
@@ -1452,7 +1858,7 @@ static void item_atmosphere_render(renderer_t *rend, const item_t *item)
     mat4_to_float(proj.mat, matf);
     gl_update_uniform(shader, "u_proj_mat", matf);
 
-    draw_buffer(&item->buf, &item->indices, GL_TRIANGLES);
+    draw_buffer(rend, &item->buf, &item->indices, GL_TRIANGLES);
     GL(glCullFace(GL_BACK));
 }
 
@@ -1504,7 +1910,7 @@ static void item_texture_render(renderer_t *rend, const item_t *item)
     mat4_to_float(proj.mat, matf);
     gl_update_uniform(shader, "u_proj_mat", matf);
 
-    draw_buffer(&item->buf, &item->indices, GL_TRIANGLES);
+    draw_buffer(rend, &item->buf, &item->indices, GL_TRIANGLES);
     GL(glCullFace(GL_BACK));
 }
 
@@ -1519,6 +1925,7 @@ static void item_texture_2d_render(renderer_t *rend, const item_t *item)
         {"TEXTURE_LUMINANCE", item->tex->format == GL_LUMINANCE &&
                               !(item->flags & PAINTER_ADD)},
         {"HAS_VIEW_POS", (bool)(item->flags & PAINTER_ENABLE_DEPTH)},
+        {"INSTANCED", GL_HAS_INSTANCING},
         {"PROJ", rend->proj.klass->id},
         {}
     };
@@ -1540,7 +1947,11 @@ static void item_texture_2d_render(renderer_t *rend, const item_t *item)
     proj = rend_get_proj(rend, item->flags);
     mat4_to_float(proj.mat, matf);
     gl_update_uniform(shader, "u_proj_mat", matf);
-    draw_buffer(&item->buf, &item->indices, GL_TRIANGLES);
+#if GL_HAS_INSTANCING
+    draw_instanced_quads(rend, &item->buf);
+#else
+    draw_buffer(rend, &item->buf, &item->indices, GL_TRIANGLES);
+#endif
     GL(glDisable(GL_DEPTH_TEST));
 }
 
@@ -1603,6 +2014,9 @@ static void item_planet_render(renderer_t *rend, const item_t *item)
     gl_update_uniform(shader, "u_material", item->planet.material);
     gl_update_uniform(shader, "u_is_moon", is_moon ? 1 : 0);
     gl_update_uniform(shader, "u_mv", item->planet.mv);
+    gl_update_uniform(shader, "u_model_view", item->planet.model_view);
+    gl_update_uniform(shader, "u_model", item->planet.model);
+    gl_update_uniform(shader, "u_normal_mat", item->planet.normal_mat);
     gl_update_uniform(shader, "u_shadow_spheres_nb",
                       item->planet.shadow_spheres_nb);
     gl_update_uniform(shader, "u_shadow_spheres", item->planet.shadow_spheres);
@@ -1614,7 +2028,11 @@ static void item_planet_render(renderer_t *rend, const item_t *item)
     mat4_to_float(rend->proj.mat, matf);
     gl_update_uniform(shader, "u_proj_mat", matf);
 
-    draw_buffer(&item->buf, &item->indices, GL_TRIANGLES);
+    if (item->planet.patch) {
+        draw_planet_patch(rend, item->planet.patch);
+    } else {
+        draw_buffer(rend, &item->buf, &item->indices, GL_TRIANGLES);
+    }
     GL(glCullFace(GL_BACK));
     GL(glDepthMask(GL_FALSE));
     GL(glDisable(GL_DEPTH_TEST));
@@ -1727,9 +2145,6 @@ static void rend_flush(renderer_t *rend)
             texture_release(item->planet.normalmap);
         if (item->type == ITEM_GLTF)
             json_builder_free(item->gltf.args);
-        gl_buf_release(&item->buf);
-        gl_buf_release(&item->indices);
-        free(item);
     }
     // Reset to default OpenGL settings.
     GL(glDepthMask(GL_TRUE));
@@ -1778,11 +2193,10 @@ void render_line(renderer_t *rend, const painter_t *painter,
         item = NULL;
 
     if (!item) {
-        item = calloc(1, sizeof(*item));
-        item->type = ITEM_LINES;
+        item = item_create(ITEM_LINES);
         item->flags = painter->flags;
-        gl_buf_alloc(&item->buf, &LINES_BUF, SIZE);
-        gl_buf_alloc(&item->indices, &INDICES_BUF, SIZE);
+        item_buf_alloc(&item->buf, &LINES_BUF, SIZE);
+        item_buf_alloc(&item->indices, &INDICES_BUF, SIZE);
         item->lines.width = painter->lines.width;
         item->lines.glow = painter->lines.glow;
         item->lines.dash_length = painter->lines.dash_length;
@@ -1841,13 +2255,12 @@ void render_mesh(renderer_t *rend, const painter_t *painter,
     if (item && item->mesh.stroke_width != painter->lines.width) item = NULL;
 
     if (!item) {
-        item = calloc(1, sizeof(*item));
-        item->type = ITEM_MESH;
+        item = item_create(ITEM_MESH);
         item->mesh.mode = mode;
         item->mesh.stroke_width = painter->lines.width;
         item->mesh.use_stencil = use_stencil;
-        gl_buf_alloc(&item->buf, &MESH_BUF, max(verts_count, 1024));
-        gl_buf_alloc(&item->indices, &INDICES_BUF, max(indices_count, 1024));
+        item_buf_alloc(&item->buf, &MESH_BUF, max(verts_count, 1024));
+        item_buf_alloc(&item->indices, &INDICES_BUF, max(indices_count, 1024));
         DL_APPEND(rend->items, item);
     }
 
@@ -1875,8 +2288,7 @@ void render_ellipse_2d(renderer_t *rend, const painter_t *painter,
                        double angle, double dashes)
 {
     item_t *item;
-    item = calloc(1, sizeof(*item));
-    item->type = ITEM_VG_ELLIPSE;
+    item = item_create(ITEM_VG_ELLIPSE);
     vec2_to_float(pos, item->vg.pos);
     vec2_to_float(size, item->vg.size);
     vec4_to_float(painter->color, item->color);
@@ -1891,8 +2303,7 @@ void render_rect_2d(renderer_t *rend, const painter_t *painter,
                     double angle)
 {
     item_t *item;
-    item = calloc(1, sizeof(*item));
-    item->type = ITEM_VG_RECT;
+    item = item_create(ITEM_VG_RECT);
     vec2_to_float(pos, item->vg.pos);
     vec2_to_float(size, item->vg.size);
     vec4_to_float(painter->color, item->color);
@@ -1905,8 +2316,7 @@ void render_line_2d(renderer_t *rend, const painter_t *painter,
                     const double p1[2], const double p2[2])
 {
     item_t *item;
-    item = calloc(1, sizeof(*item));
-    item->type = ITEM_VG_LINE;
+    item = item_create(ITEM_VG_LINE);
     vec2_to_float(p1, item->vg.pos);
     vec2_to_float(p2, item->vg.pos2);
     vec4_to_float(painter->color, item->color);
@@ -1964,8 +2374,7 @@ void render_model_3d(renderer_t *rend, const painter_t *painter,
     item_t *item;
     double depth_range[2];
 
-    item = calloc(1, sizeof(*item));
-    item->type = ITEM_GLTF;
+    item = item_create(ITEM_GLTF);
     item->gltf.model = model;
     item->flags = painter->flags;
     mat4_copy(model_mat, item->gltf.model_mat);
@@ -2017,6 +2426,7 @@ void core_add_font(renderer_t *rend, const char *name,
     }
 
     id = nvgCreateFontMem(rend->vg, name, data, size, 0);
+    core->fonts_gen++;
     if (!rend->fonts[font].id || rend->fonts[font].is_default_font) {
         rend->fonts[font].id = id;
         rend->fonts[font].scale = scale;
@@ -2064,3 +2474,5 @@ renderer_t* render_create(void)
 
     return rend;
 }
+
+#endif // !RENDER_NULL
@@ -0,0 +1,168 @@
+/* Stellarium Web Engine - Copyright (c) 2021 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+/*
+ * Null renderer, used instead of render_gl.c in headless builds.
+ *
+ * Nothing is drawn, but we still do the CPU work that doesn't depend on
+ * OpenGL (quads vertices projection, lines meshes), and record how many
+ * calls, vertices and indices each frame produced, so that the engine can
+ * be benchmarked on machines without a GPU.
+ */
+
+#if RENDER_NULL
+
+#include "render.h"
+#include "swe.h"
+
+#include "line_mesh.h"
+
+struct renderer {
+    projection_t    proj;
+    double          scale;
+    render_stats_t  stats;
+};
+
+renderer_t* render_create(void)
+{
+    return calloc(1, sizeof(renderer_t));
+}
+
+void render_prepare(renderer_t *rend, const projection_t *proj,
+                    double win_w, double win_h,
+                    double scale, bool cull_flipped)
+{
+    rend->proj = *proj;
+    rend->scale = scale;
+    memset(&rend->stats, 0, sizeof(rend->stats));
+}
+
+void render_finish(renderer_t *rend)
+{
+}
+
+void render_get_stats(const renderer_t *rend, render_stats_t *stats)
+{
+    *stats = rend->stats;
+}
+
+static void record(renderer_t *rend, int vertices, int indices)
+{
+    rend->stats.calls++;
+    rend->stats.vertices += vertices;
+    rend->stats.indices += indices;
+}
+
+void render_points_2d(renderer_t *rend, const painter_t *painter,
+                      int n, const point_t *points)
+{
+    record(rend, n, 0);
+}
+
+void render_points_3d(renderer_t *rend, const painter_t *painter,
+                      int n, const point_3d_t *points)
+{
+    record(rend, n, 0);
+}
+
+void render_quad(renderer_t *rend, const painter_t *painter,
+                 int frame, int grid_size, const uv_map_t *map)
+{
+    int i, j, n = grid_size + 1;
+    double p[4];
+
+    for (i = 0; i < n; i++)
+    for (j = 0; j < n; j++) {
+        uv_map(map, VEC((double)j / grid_size, (double)i / grid_size),
+               p, NULL);
+        convert_framev4(painter->obs, frame, FRAME_VIEW, p, p);
+    }
+    record(rend, n * n, grid_size * grid_size * 6);
+}
+
+void render_texture(renderer_t *rend, const texture_t  *tex,
+                    double uv[4][2], const double pos[2], double size,
+                    const double color[4], double angle)
+{
+    record(rend, 4, 6);
+}
+
+void render_text(renderer_t *rend, const painter_t *painter,
+                 const char *text, const double win_pos[2],
+                 const double view_pos[3],
+                 int align, int effects, double size,
+                 const double color[4], double angle,
+                 double bounds[4])
+{
+    double w, h;
+
+    if (!bounds) {
+        rend->stats.texts++;
+        record(rend, 4, 6);
+        return;
+    }
+    // Approximate the text size from its number of characters.
+    w = u8_len(text) * size * 0.6;
+    h = size;
+    bounds[0] = win_pos[0] - w / 2;
+    bounds[1] = win_pos[1] - h / 2;
+    if (align & ALIGN_LEFT)     bounds[0] = win_pos[0];
+    if (align & ALIGN_RIGHT)    bounds[0] = win_pos[0] - w;
+    if (align & ALIGN_TOP)      bounds[1] = win_pos[1];
+    if (align & ALIGN_BOTTOM)   bounds[1] = win_pos[1] - h;
+    bounds[2] = bounds[0] + w;
+    bounds[3] = bounds[1] + h;
+}
+
+void render_line(renderer_t *rend, const painter_t *painter,
+                 const double (*line)[3], const double (*win)[3], int size)
+{
+    line_mesh_t *mesh;
+    mesh = line_to_mesh(line, win, size, 10);
+    record(rend, mesh->verts_count, mesh->indices_count);
+    line_mesh_delete(mesh);
+}
+
+void render_mesh(renderer_t *rend, const painter_t *painter,
+                 int frame, int mode, int verts_count,
+                 const double verts[][3], int indices_count,
+                 const uint16_t indices[], bool use_stencil)
+{
+    record(rend, verts_count, indices_count);
+}
+
+void render_ellipse_2d(renderer_t *rend, const painter_t *painter,
+                       const double pos[2], const double size[2],
+                       double angle, double dashes)
+{
+    record(rend, 0, 0);
+}
+
+void render_rect_2d(renderer_t *rend, const painter_t *painter,
+                    const double pos[2], const double size[2],
+                    double angle)
+{
+    record(rend, 0, 0);
+}
+
+void render_line_2d(renderer_t *rend, const painter_t *painter,
+                    const double p1[2], const double p2[2])
+{
+    record(rend, 0, 0);
+}
+
+void render_model_3d(renderer_t *rend, const painter_t *painter,
+                     const char *model, const double model_mat[4][4],
+                     const double view_mat[4][4], const double proj_mat[4][4],
+                     const double light_dir[3], json_value *args)
+{
+    record(rend, 0, 0);
+}
+
+#endif // RENDER_NULL
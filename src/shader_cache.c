@@ -7,6 +7,9 @@
  * repository.
  */
 
+// Headless builds use the null renderer instead (see render_null.c).
+#if !RENDER_NULL
+
 #include "shader_cache.h"
 
 #define MAX_NB_SHADERS 32
@@ -99,3 +102,5 @@ gl_shader_t *shader_get(const char *name, const shader_define_t *defines,
     if (on_created) on_created(s->shader);
     return s->shader;
 }
+
+#endif // !RENDER_NULL
@@ -33,6 +33,7 @@
 #include "log.h"
 #include "tests.h"
 
+#include "utils/arena.h"
 #include "utils/cache.h"
 #include "utils/color.h"
 #include "utils/fader.h"
@@ -49,6 +50,7 @@
 #include "algos/algos.h"
 #include "args.h"
 #include "assets.h"
+#include "bench.h"
 #include "constants.h"
 
 #ifdef __EMSCRIPTEN__
@@ -28,6 +28,9 @@
 // The global system instance.
 sys_callbacks_t sys_callbacks = {};
 
+// If set, value returned by sys_get_unix_time.
+static double g_fixed_time = 0;
+
 void sys_log(const char *msg)
 {
     if (sys_callbacks.log) {
@@ -38,9 +41,15 @@ void sys_log(const char *msg)
     }
 }
 
+void sys_set_fixed_time(double t)
+{
+    g_fixed_time = t;
+}
+
 double sys_get_unix_time(void)
 {
     struct timeval tv;
+    if (g_fixed_time) return g_fixed_time;
     gettimeofday(&tv, NULL);
     return tv.tv_sec + tv.tv_usec / 1000. / 1000.;
 }
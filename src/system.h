@@ -26,6 +26,15 @@ void sys_log(const char *msg);
  */
 double sys_get_unix_time(void);
 
+/*
+ * Function: sys_set_fixed_time
+ * Make <sys_get_unix_time> return a fixed value.
+ *
+ * Used by the benchmarks so that the animations are reproducible.  Set to
+ * zero to use the real time again.
+ */
+void sys_set_fixed_time(double t);
+
 /*
  * Function: sys_get_utc_offset
  * Return the local time UTC offset in seconds
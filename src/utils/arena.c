@@ -0,0 +1,155 @@
+/* Stellarium Web Engine - Copyright (c) 2021 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+#include "arena.h"
+#include "utlist.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tests.h"
+
+// All the allocations are aligned to this value.
+#define ALIGN 16
+
+typedef struct block block_t;
+struct block {
+    block_t *next, *prev;
+    size_t  size;
+    size_t  used;
+    // Align the data that follows the header.
+    _Alignas(ALIGN) char data[];
+};
+
+struct arena {
+    block_t         *blocks;    // The last one is the current block.
+    arena_stats_t   stats;      // Stats since the last reset.
+    arena_stats_t   last;       // Stats before the last reset.
+};
+
+static block_t *block_create(arena_t *arena, size_t size)
+{
+    block_t *block = malloc(sizeof(*block) + size);
+    block->size = size;
+    block->used = 0;
+    DL_APPEND(arena->blocks, block);
+    arena->stats.mallocs++;
+    arena->stats.capacity += size;
+    return block;
+}
+
+arena_t *arena_create(int size)
+{
+    arena_t *arena = calloc(1, sizeof(*arena));
+    block_create(arena, size);
+    arena->stats.mallocs = 0;
+    return arena;
+}
+
+void arena_delete(arena_t *arena)
+{
+    block_t *block, *tmp;
+    if (!arena) return;
+    DL_FOREACH_SAFE(arena->blocks, block, tmp) {
+        DL_DELETE(arena->blocks, block);
+        free(block);
+    }
+    free(arena);
+}
+
+void *arena_alloc(arena_t *arena, size_t size)
+{
+    block_t *block = arena->blocks->prev;
+    void *ret;
+
+    size = (size + ALIGN - 1) & ~(size_t)(ALIGN - 1);
+    if (block->used + size > block->size) {
+        // Grow geometrically, so that the number of blocks stays small
+        // until the next reset merges them.
+        block = block_create(arena, size > block->size * 2 ?
+                                    size : block->size * 2);
+    }
+    ret = block->data + block->used;
+    block->used += size;
+    arena->stats.allocs++;
+    arena->stats.size += size;
+    return ret;
+}
+
+void *arena_calloc(arena_t *arena, size_t n, size_t size)
+{
+    void *ret = arena_alloc(arena, n * size);
+    memset(ret, 0, n * size);
+    return ret;
+}
+
+void arena_reset(arena_t *arena)
+{
+    block_t *block, *tmp;
+    size_t capacity = 0;
+
+    arena->last = arena->stats;
+    memset(&arena->stats, 0, sizeof(arena->stats));
+
+    if (arena->blocks->next) {
+        DL_FOREACH_SAFE(arena->blocks, block, tmp) {
+            capacity += block->size;
+            DL_DELETE(arena->blocks, block);
+            free(block);
+        }
+        block_create(arena, capacity);
+        arena->stats.mallocs = 0;
+    }
+    arena->blocks->used = 0;
+    arena->stats.capacity = arena->blocks->size;
+}
+
+void arena_get_stats(const arena_t *arena, arena_stats_t *stats)
+{
+    *stats = arena->last;
+}
+
+#if COMPILE_TESTS
+
+static void test_arena(void)
+{
+    arena_t *arena;
+    arena_stats_t stats;
+    char *a, *b;
+    int i;
+
+    arena = arena_create(64);
+    a = arena_alloc(arena, 1);
+    b = arena_calloc(arena, 10, 10);
+    assert(((uintptr_t)a % ALIGN) == 0 && ((uintptr_t)b % ALIGN) == 0);
+    for (i = 0; i < 100; i++) assert(b[i] == 0);
+    memset(b, 1, 100);
+    arena_reset(arena);
+    arena_get_stats(arena, &stats);
+    assert(stats.allocs == 2);
+    assert(stats.mallocs == 1);
+    assert(stats.capacity >= 64 + 112);
+
+    // After the reset all the allocations fit in a single block.
+    for (i = 0; i < 2; i++) {
+        arena_alloc(arena, 1);
+        arena_alloc(arena, 100);
+        arena_reset(arena);
+    }
+    arena_get_stats(arena, &stats);
+    assert(stats.allocs == 2);
+    assert(stats.mallocs == 0);
+    arena_delete(arena);
+}
+
+TEST_REGISTER(NULL, test_arena, TEST_AUTO);
+
+#endif
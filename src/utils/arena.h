@@ -0,0 +1,91 @@
+/* Stellarium Web Engine - Copyright (c) 2021 - Noctua Software Ltd
+ *
+ * This program is licensed under the terms of the GNU AGPL v3, or
+ * alternatively under a commercial licence.
+ *
+ * The terms of the AGPL v3 license can be found in the main directory of this
+ * repository.
+ */
+
+/*
+ * File: arena.h
+ *
+ * Bump allocator for short lived temporary data.
+ *
+ * All the allocations of an arena are released together with <arena_reset>.
+ * This is used for the data that only lives during a frame, so that we
+ * don't go through malloc/free for each of them.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Type: arena_t
+ * Opaque arena allocator.
+ */
+typedef struct arena arena_t;
+
+/*
+ * Function: arena_create
+ * Create a new arena.
+ *
+ * Parameters:
+ *   size - Initial size of the arena in bytes.  The arena grows as needed.
+ */
+arena_t *arena_create(int size);
+
+/*
+ * Function: arena_delete
+ * Delete an arena and all its allocations.
+ */
+void arena_delete(arena_t *arena);
+
+/*
+ * Function: arena_alloc
+ * Allocate memory from an arena.
+ *
+ * The memory is not initialized, and stays valid until the next call to
+ * <arena_reset>.
+ */
+void *arena_alloc(arena_t *arena, size_t size);
+
+/*
+ * Function: arena_calloc
+ * Same as arena_alloc, but the memory is set to zero.
+ */
+void *arena_calloc(arena_t *arena, size_t n, size_t size);
+
+/*
+ * Function: arena_reset
+ * Release all the allocations of an arena.
+ *
+ * If the arena had to grow since the last reset, its memory is merged into
+ * a single block large enough for all the allocations, so that in the
+ * steady state we don't call malloc at all.
+ */
+void arena_reset(arena_t *arena);
+
+/*
+ * Type: arena_stats_t
+ * Statistics of an arena between two resets.
+ */
+typedef struct {
+    int     allocs;     // Number of allocations.
+    int     mallocs;    // Number of blocks we had to allocate with malloc.
+    int64_t size;       // Total size of the allocations.
+    int64_t capacity;   // Total size of the arena blocks.
+} arena_stats_t;
+
+/*
+ * Function: arena_get_stats
+ * Get the statistics of the arena before the last reset.
+ *
+ * For the frame arena, this gives the allocations of the last frame.
+ */
+void arena_get_stats(const arena_t *arena, arena_stats_t *stats);
+
+#endif // ARENA_H
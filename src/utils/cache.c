@@ -9,58 +9,124 @@
 
 #include "cache.h"
 #include "uthash.h"
+#include "utlist.h"
+
 #include <assert.h>
+#include <stdbool.h>
+
+#include "tests.h"
 
 typedef struct item item_t;
 struct item {
     UT_hash_handle  hh;
     char            key[256];
+    int             keylen;
     void            *data;
     int             cost;
     uint64_t        last_used;
+    uint64_t        frame;      // Last frame the item was used.
     int             (*delfunc)(void *data);
 };
 
 struct cache {
+    cache_t *next, *prev; // All the caches list.
+    const char *name;
     item_t *items;
-    uint64_t clock;
     int size;
     int max_size;
 };
 
-cache_t *cache_create(int size)
+static cache_stats_t g_stats = {};
+
+// Global state shared by all the caches.  The clock is global so that we
+// can compare the items of different caches when we need to free memory.
+static struct {
+    cache_t     *caches;
+    uint64_t    clock;
+    uint64_t    frame;
+    int64_t     budget;     // Max total cost of all the caches, 0 for none.
+} g = {.frame = 1};
+
+cache_t *cache_create(const char *name, int size)
 {
     cache_t *cache = calloc(1, sizeof(*cache));
+    cache->name = name;
     cache->max_size = size;
+    DL_APPEND(g.caches, cache);
     return cache;
 }
 
+static void item_delete(cache_t *cache, item_t *item)
+{
+    HASH_DEL(cache->items, item);
+    cache->size -= item->cost;
+    g_stats.size -= item->cost;
+    free(item);
+}
+
 static void cleanup(cache_t *cache)
 {
     item_t *item, *tmp;
     HASH_ITER(hh, cache->items, item, tmp) {
+        // Never remove the items used during the current frame.
+        if (item->frame == g.frame) continue;
         if (item->delfunc && item->delfunc(item->data) == CACHE_KEEP)
             continue;
-        HASH_DEL(cache->items, item);
-        assert(item != cache->items);
-        cache->size -= item->cost;
-        free(item);
+        item_delete(cache, item);
         if (cache->size < cache->max_size) return;
     }
 }
 
+void cache_trim(int64_t target)
+{
+    cache_t *cache, *best_cache = NULL;
+    item_t *item, *best;
+    int nb_kept = 0, nb_items = 0;
+
+    DL_FOREACH(g.caches, cache) nb_items += HASH_COUNT(cache->items);
+
+    // Since the items are sorted by last use in each cache, we only have to
+    // compare the first removable item of each of them.
+    while (g_stats.size > target) {
+        best = NULL;
+        DL_FOREACH(g.caches, cache) {
+            for (item = cache->items; item; item = item->hh.next) {
+                if (item->frame != g.frame) break;
+            }
+            if (item && (!best || item->last_used < best->last_used)) {
+                best = item;
+                best_cache = cache;
+            }
+        }
+        if (!best) return;
+        if (best->delfunc && best->delfunc(best->data) == CACHE_KEEP) {
+            // Consider the item as used, so that we try the others first.
+            best->last_used = g.clock++;
+            HASH_DEL(best_cache->items, best);
+            HASH_ADD(hh, best_cache->items, key, best->keylen, best);
+            if (++nb_kept > nb_items) return;
+            continue;
+        }
+        item_delete(best_cache, best);
+    }
+}
+
 void cache_add(cache_t *cache, const void *key, int len, void *data,
                int cost, int (*delfunc)(void *data))
 {
     item_t *item;
     assert(len <= sizeof(item->key));
     cache->size += cost;
+    g_stats.size += cost;
     if (cache->size >= cache->max_size) cleanup(cache);
+    if (g.budget && g_stats.size >= g.budget) cache_trim(g.budget);
     item = calloc(1, sizeof(*item));
     memcpy(item->key, key, len);
+    item->keylen = len;
     item->data = data;
     item->cost = cost;
-    item->last_used = cache->clock++;
+    item->last_used = g.clock++;
+    item->frame = g.frame;
     item->delfunc = delfunc;
     HASH_ADD(hh, cache->items, key, len, item);
 }
@@ -69,8 +135,13 @@ void *cache_get(cache_t *cache, const void *key, int keylen)
 {
     item_t *item;
     HASH_FIND(hh, cache->items, key, keylen, item);
-    if (!item) return NULL;
-    item->last_used = cache->clock++;
+    if (!item) {
+        g_stats.misses++;
+        return NULL;
+    }
+    g_stats.hits++;
+    item->last_used = g.clock++;
+    item->frame = g.frame;
     // Reinsert item on top of the hash list so that it stays sorted.
     HASH_DEL(cache->items, item);
     HASH_ADD(hh, cache->items, key, keylen, item);
@@ -82,10 +153,12 @@ void cache_set_cost(cache_t *cache, const void *key, int keylen, int cost)
     item_t *item;
     HASH_FIND(hh, cache->items, key, keylen, item);
     if (!item) return;
+    g_stats.size += cost - item->cost;
     cache->size -= item->cost;
     item->cost = cost;
     cache->size += cost;
     if (cache->size >= cache->max_size) cleanup(cache);
+    if (g.budget && g_stats.size >= g.budget) cache_trim(g.budget);
 }
 
 /*
@@ -96,3 +169,78 @@ int cache_get_current_size(const cache_t *cache)
 {
     return cache->size;
 }
+
+void cache_get_stats(cache_stats_t *stats)
+{
+    *stats = g_stats;
+}
+
+void cache_new_frame(void)
+{
+    g.frame++;
+}
+
+void cache_set_budget(int64_t budget)
+{
+    g.budget = budget;
+    if (g.budget && g_stats.size >= g.budget) cache_trim(g.budget);
+}
+
+int64_t cache_get_budget(void)
+{
+    return g.budget;
+}
+
+void cache_get_usage(void *user,
+                     void (*f)(void *user, const char *name,
+                               int64_t size, int64_t max_size))
+{
+    cache_t *cache;
+    DL_FOREACH(g.caches, cache) {
+        f(user, cache->name, cache->size, cache->max_size);
+    }
+}
+
+#if COMPILE_TESTS
+
+static int test_del(void *data)
+{
+    (*(int*)data)++;
+    return 0;
+}
+
+static void test_cache(void)
+{
+    cache_t *c1, *c2;
+    int nb_del = 0;
+    cache_stats_t stats;
+
+    cache_new_frame();
+    cache_trim(0);
+    c1 = cache_create("test1", 1000);
+    c2 = cache_create("test2", 1000);
+    cache_add(c1, "a", 1, &nb_del, 100, test_del);
+    cache_add(c2, "b", 1, &nb_del, 100, test_del);
+    cache_add(c1, "c", 1, &nb_del, 100, test_del);
+
+    // Removing items across caches, but never the ones used in the
+    // current frame.
+    cache_new_frame();
+    assert(cache_get(c1, "a", 1));
+    cache_set_budget(250);
+    assert(nb_del == 1);
+    assert(cache_get(c1, "a", 1));
+    assert(!cache_get(c2, "b", 1));
+    assert(cache_get(c1, "c", 1));
+
+    cache_set_budget(0);
+    cache_new_frame();
+    cache_trim(0);
+    cache_get_stats(&stats);
+    assert(stats.size == 0);
+    assert(nb_del == 3);
+}
+
+TEST_REGISTER(NULL, test_cache, TEST_AUTO);
+
+#endif
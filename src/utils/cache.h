@@ -13,6 +13,8 @@
  * Utils to store values in cache.
  */
 
+#include <stdint.h>
+
 /*
  * Enum: CACHE_KEEP
  * The cache delete function callback can return this value to tell the
@@ -30,14 +32,19 @@ typedef struct cache cache_t;
  * Function: cache_create
  * Create a new cache with a given max size.
  *
+ * All the caches are registered globally, so that they can share a common
+ * memory budget (see <cache_set_budget>).
+ *
  * Parameters:
+ *   name - Name of the cache, used to report the memory usage.
  *   size - Maximum cache size.  The unit can be anything, as long as it
  *          stays consistent with the cost argument given in cache_add.
+ *          For the global budget to make sense, it should be in bytes.
  *
  * Return:
  *   A new cache object.
  */
-cache_t *cache_create(int size);
+cache_t *cache_create(const char *name, int size);
 
 /*
  * Function: cache_add
@@ -79,3 +86,69 @@ void cache_set_cost(cache_t *cache, const void *key, int keylen, int cost);
  */
 int cache_get_current_size(const cache_t *cache);
 
+/*
+ * Type: cache_stats_t
+ * Global statistics of all the caches.
+ */
+typedef struct {
+    int64_t hits;
+    int64_t misses;
+    int64_t size;   // Total cost of all the cached items.
+} cache_stats_t;
+
+/*
+ * Function: cache_get_stats
+ * Get the global statistics of all the caches.
+ */
+void cache_get_stats(cache_stats_t *stats);
+
+/*
+ * Function: cache_new_frame
+ * Notify the caches that we start rendering a new frame.
+ *
+ * The items used during the current frame are never removed from the
+ * caches, so that we don't release data still in use.
+ */
+void cache_new_frame(void);
+
+/*
+ * Function: cache_set_budget
+ * Set the maximum total cost of all the caches.
+ *
+ * When the total cost of all the caches gets over the budget, the least
+ * recently used items of all the caches are removed, whatever the cache
+ * they belong to.
+ *
+ * Parameters:
+ *   budget - The global budget, or zero to only use the caches own sizes.
+ */
+void cache_set_budget(int64_t budget);
+
+/*
+ * Function: cache_get_budget
+ * Return the value set with <cache_set_budget>.
+ */
+int64_t cache_get_budget(void);
+
+/*
+ * Function: cache_trim
+ * Remove the least recently used items of all the caches until their total
+ * cost is lower than a given value.
+ *
+ * This can be used to release memory when the system is running low.  The
+ * items used during the current frame are not removed, so the final size
+ * can stay above the target.
+ */
+void cache_trim(int64_t target);
+
+/*
+ * Function: cache_get_usage
+ * Iterate the current size of all the caches.
+ *
+ * Parameters:
+ *   user   - Data passed to the callback.
+ *   f      - Callback called for each cache.
+ */
+void cache_get_usage(void *user,
+                     void (*f)(void *user, const char *name,
+                               int64_t size, int64_t max_size));
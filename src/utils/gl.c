@@ -7,6 +7,9 @@
  * repository.
  */
 
+// Headless builds use the null renderer instead (see render_null.c).
+#if !RENDER_NULL
+
 #include "gl.h"
 
 #include <assert.h>
@@ -292,6 +295,22 @@ void gl_buf_disable(const gl_buf_t *buf)
     }
 }
 
+#if GL_HAS_INSTANCING
+void gl_buf_set_divisor(const gl_buf_t *buf, int divisor)
+{
+    int i, tot = 0;
+    const gl_buf_info_t *info = buf->info;
+    const __typeof__(*buf->info->attrs) *a;
+    for (i = 0; ; i++) {
+        a = &info->attrs[i];
+        if (!a->size) continue;
+        GL(glVertexAttribDivisor(i, divisor));
+        tot += a->size * gl_size_for_type(a->type);
+        if (tot == info->size) break;
+    }
+}
+#endif
+
 bool gl_has_uniform(gl_shader_t *shader, const char *name)
 {
     gl_uniform_t *uni;
@@ -344,3 +363,5 @@ void gl_update_uniform(gl_shader_t *shader, const char *name, ...)
     }
     va_end(args);
 }
+
+#endif // !RENDER_NULL
@@ -45,7 +45,28 @@
 #   endif
 #endif
 
-#if DEBUG
+/*
+ * Instanced rendering is only used for the web build: WebGL2 supports it
+ * natively, and on WebGL1 emscripten emulates it with the
+ * ANGLE_instanced_arrays extension.  It can also be forced from the build
+ * flags for desktop GL versions that support it.
+ */
+#ifndef GL_HAS_INSTANCING
+#   if defined(__EMSCRIPTEN__)
+#       define GL_HAS_INSTANCING 1
+#   else
+#       define GL_HAS_INSTANCING 0
+#   endif
+#endif
+#if GL_HAS_INSTANCING && defined(GLES2)
+#   define glDrawElementsInstanced glDrawElementsInstancedANGLE
+#   define glVertexAttribDivisor glVertexAttribDivisorANGLE
+#endif
+
+#if RENDER_NULL
+// Headless build with the null renderer: we never call OpenGL.
+#  define GL(line) do {} while(0)
+#elif DEBUG
 #  define GL(line) do {                                 \
        line;                                            \
        if (gl_check_errors(__FILE__, __LINE__))         \
@@ -145,6 +166,18 @@ void gl_buf_enable(const gl_buf_t *buf);
  */
 void gl_buf_disable(const gl_buf_t *buf);
 
+#if GL_HAS_INSTANCING
+/*
+ * Function: gl_buf_set_divisor
+ * Set the instancing divisor of all the attributes of a buffer.
+ *
+ * Must be called after <gl_buf_enable>.  Use a divisor of 1 for the
+ * buffers with per instance attributes, and reset it to 0 after the draw
+ * call.
+ */
+void gl_buf_set_divisor(const gl_buf_t *buf, int divisor);
+#endif
+
 /*
  * Struct: gl_uniform_t
  * Used internally in gl_shader_t
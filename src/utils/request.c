@@ -397,6 +397,7 @@ void request_make_fresh(request_t *req)
 #ifdef REQUEST_DUMMY
 
 #include "request.h"
+#include <stdbool.h>
 #include <stdlib.h>
 
 struct request
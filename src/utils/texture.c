@@ -11,6 +11,7 @@
 #include "gl.h"
 
 #include <assert.h>
+#include <limits.h>
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
@@ -21,7 +22,22 @@ static struct {
                      int *w, int *h, int *bpp);
 } g_callback = {};
 
-static inline bool is_pow2(int n) {return (n & (n - 1)) == 0;}
+// Released textures that can be reused for a new texture of the same size.
+#define POOL_MAX_SIZE 16
+static struct {
+    int nb;
+    struct {
+        uint32_t id;
+        int tex_w, tex_h, format, flags, size;
+    } items[POOL_MAX_SIZE];
+} g_pool = {};
+
+// Amount of data we can still upload in the current frame.
+static struct {
+    int remaining;
+    bool used;
+} g_upload_budget = {INT_MAX};
+
 static inline int next_pow2(int x) {return pow(2, ceil(log(x) / log(2)));}
 
 
@@ -46,26 +62,37 @@ void texture_set_load_callback(void *user,
     g_callback.load = load;
 }
 
-void texture_set_data(texture_t *tex, const void *data, int w, int h, int bpp)
+static void gen_texture_id(texture_t *tex)
 {
-    uint8_t *buff0 = NULL;
-    int data_type = GL_UNSIGNED_BYTE;
-    assert(tex->id);
+#if RENDER_NULL
+    // No GL in headless builds, we only need the ids to be unique.
+    static uint32_t last_id = 0;
+    tex->id = ++last_id;
+#else
+    GL(glGenTextures(1, &tex->id));
+#endif
+}
 
-    tex->w = w;
-    tex->h = h;
-    tex->tex_w = next_pow2(w);
-    tex->tex_h = next_pow2(h);
-    tex->format = (int[]){
+static int bpp_to_format(int bpp)
+{
+    return (int[]){
         0, GL_LUMINANCE, GL_LUMINANCE_ALPHA, GL_RGB, GL_RGBA
     }[bpp];
-    assert(tex->format);
+}
+
+void texture_set_data(texture_t *tex, const void *data, int w, int h, int bpp)
+{
+    const uint8_t *src = data;
+    uint8_t *col;
+    int i, n, tex_w, tex_h, format;
+    bool uploaded = false;
+    assert(tex->id);
+
+    tex_w = next_pow2(w);
+    tex_h = next_pow2(h);
+    format = bpp_to_format(bpp);
+    assert(format);
 
-    if (!is_pow2(w) || !is_pow2(h)) {
-        buff0 = calloc(bpp, tex->tex_w * tex->tex_h);
-        blit(data, w, h, bpp, buff0, tex->tex_w, tex->tex_h, 0, 0, w, h);
-        data = buff0;
-    }
     GL(glActiveTexture(GL_TEXTURE0));
     GL(glBindTexture(GL_TEXTURE_2D, tex->id));
     GL(glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
@@ -73,14 +100,104 @@ void texture_set_data(texture_t *tex, const void *data, int w, int h, int bpp)
             (tex->flags & TF_MIPMAP)? GL_LINEAR_MIPMAP_NEAREST : GL_LINEAR));
     GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
     GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
-    GL(glTexImage2D(GL_TEXTURE_2D, 0, tex->format, tex->tex_w, tex->tex_h,
-                0, tex->format, data_type, data));
-    free(buff0);
+    GL(glPixelStorei(GL_UNPACK_ALIGNMENT, 1));
+
+    // Only allocate the storage if the texture doesn't have one of the
+    // right size already (eg: recycled from the pool).
+    if (!tex->size || tex->tex_w != tex_w || tex->tex_h != tex_h ||
+            tex->format != format) {
+        uploaded = (w == tex_w && h == tex_h);
+        GL(glTexImage2D(GL_TEXTURE_2D, 0, format, tex_w, tex_h,
+                    0, format, GL_UNSIGNED_BYTE, uploaded ? data : NULL));
+        tex->size = tex_w * tex_h * bpp;
+        if (tex->flags & TF_MIPMAP) tex->size = tex->size * 4 / 3;
+    }
+
+    if (!uploaded) {
+        GL(glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h,
+                           format, GL_UNSIGNED_BYTE, data));
+        // For non power of two images, copy the last row and column into
+        // the padding, so that the linear filter doesn't use undefined
+        // values at the edges.
+        if (h < tex_h) {
+            GL(glTexSubImage2D(GL_TEXTURE_2D, 0, 0, h, w, 1, format,
+                               GL_UNSIGNED_BYTE, src + (h - 1) * w * bpp));
+        }
+        // The column also covers the corner texel if there is a padding row.
+        if (w < tex_w) {
+            n = (h < tex_h) ? h + 1 : h;
+            col = malloc(n * bpp);
+            for (i = 0; i < n; i++) {
+                memcpy(col + i * bpp,
+                       src + ((i < h ? i : h - 1) * w + w - 1) * bpp, bpp);
+            }
+            GL(glTexSubImage2D(GL_TEXTURE_2D, 0, w, 0, 1, n, format,
+                               GL_UNSIGNED_BYTE, col));
+            free(col);
+        }
+    }
+    GL(glPixelStorei(GL_UNPACK_ALIGNMENT, 4));
+
+    tex->w = w;
+    tex->h = h;
+    tex->tex_w = tex_w;
+    tex->tex_h = tex_h;
+    tex->format = format;
 
     if (tex->flags & TF_MIPMAP)
         GL(glGenerateMipmap(GL_TEXTURE_2D));
 }
 
+void texture_set_sub_data(texture_t *tex, const void *data,
+                          int x, int y, int w, int h, int bpp)
+{
+    assert(tex->id && tex->size);
+    assert(tex->format == bpp_to_format(bpp));
+    assert(x + w <= tex->tex_w && y + h <= tex->tex_h);
+
+    GL(glActiveTexture(GL_TEXTURE0));
+    GL(glBindTexture(GL_TEXTURE_2D, tex->id));
+    GL(glPixelStorei(GL_UNPACK_ALIGNMENT, 1));
+    GL(glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, tex->format,
+                       GL_UNSIGNED_BYTE, data));
+    GL(glPixelStorei(GL_UNPACK_ALIGNMENT, 4));
+    if (tex->flags & TF_MIPMAP)
+        GL(glGenerateMipmap(GL_TEXTURE_2D));
+}
+
+// Try to get a texture of the given size from the pool.
+static void pool_get(texture_t *tex, int w, int h, int bpp)
+{
+    int i;
+    for (i = 0; i < g_pool.nb; i++) {
+        if (    g_pool.items[i].tex_w == next_pow2(w) &&
+                g_pool.items[i].tex_h == next_pow2(h) &&
+                g_pool.items[i].format == bpp_to_format(bpp) &&
+                g_pool.items[i].flags == tex->flags) break;
+    }
+    if (i == g_pool.nb) return;
+    tex->id = g_pool.items[i].id;
+    tex->tex_w = g_pool.items[i].tex_w;
+    tex->tex_h = g_pool.items[i].tex_h;
+    tex->format = g_pool.items[i].format;
+    tex->size = g_pool.items[i].size;
+    g_pool.items[i] = g_pool.items[--g_pool.nb];
+}
+
+// Try to put a released texture into the pool.
+static bool pool_put(const texture_t *tex)
+{
+    if (g_pool.nb >= POOL_MAX_SIZE) return false;
+    g_pool.items[g_pool.nb].id = tex->id;
+    g_pool.items[g_pool.nb].tex_w = tex->tex_w;
+    g_pool.items[g_pool.nb].tex_h = tex->tex_h;
+    g_pool.items[g_pool.nb].format = tex->format;
+    g_pool.items[g_pool.nb].flags = tex->flags;
+    g_pool.items[g_pool.nb].size = tex->size;
+    g_pool.nb++;
+    return true;
+}
+
 texture_t *texture_create(int w, int h, int bpp)
 {
     texture_t *tex;
@@ -91,7 +208,7 @@ texture_t *texture_create(int w, int h, int bpp)
     tex->w = w;
     tex->h = h;
     tex->format = (int[]){0, 0, 0, GL_RGB, GL_RGBA}[bpp];
-    GL(glGenTextures(1, &tex->id));
+    gen_texture_id(tex);
     return tex;
 }
 
@@ -101,7 +218,8 @@ void texture_release(texture_t *tex)
     tex->ref--;
     if (tex->ref) return;
     free(tex->url);
-    if (tex->id) GL(glDeleteTextures(1, &tex->id));
+    if (tex->id && !((tex->flags & TF_POOL) && tex->size && pool_put(tex)))
+        GL(glDeleteTextures(1, &tex->id));
     free(tex);
 }
 
@@ -115,7 +233,8 @@ texture_t *texture_from_data(const void *data, int img_w, int img_h, int bpp,
     tex = calloc(1, sizeof(*tex));
     tex->ref = 1;
     tex->flags = flags;
-    GL(glGenTextures(1, &tex->id));
+    if (flags & TF_POOL) pool_get(tex, w, h, bpp);
+    if (!tex->id) gen_texture_id(tex);
 
     if (x != 0 || y != 0 || w != img_w || h != img_h) {
         img = calloc(w * h, bpp);
@@ -149,8 +268,24 @@ bool texture_load(texture_t *tex, int *code)
     assert(g_callback.load);
     img = g_callback.load(g_callback.user, tex->url, code, &w, &h, &bpp);
     if (!img) return false;
-    GL(glGenTextures(1, &tex->id));
+    gen_texture_id(tex);
     texture_set_data(tex, img, w, h, bpp);
     free(img);
     return true;
 }
+
+void texture_upload_budget_reset(int size)
+{
+    g_upload_budget.remaining = size;
+    g_upload_budget.used = false;
+}
+
+bool texture_upload_budget_take(int size)
+{
+    if (g_upload_budget.used && size > g_upload_budget.remaining)
+        return false;
+    g_upload_budget.remaining -= size;
+    if (g_upload_budget.remaining < 0) g_upload_budget.remaining = 0;
+    g_upload_budget.used = true;
+    return true;
+}
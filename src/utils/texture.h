@@ -12,7 +12,10 @@
 
 enum {
     TF_MIPMAP           = 1 << 0,
-    TF_LAZY_LOAD        = 1 << 1
+    TF_LAZY_LOAD        = 1 << 1,
+    // Recycle the OpenGL texture for new textures of the same size once
+    // released, so that the data can be uploaded without reallocation.
+    TF_POOL             = 1 << 2,
 };
 
 /*
@@ -35,6 +38,8 @@ enum {
  *   format - OpenGL format.
  *   flags  - Configuration bit flags
  *   url    - For async texture: url source of the image.
+ *   size   - Size of the texture data on the GPU in bytes, or zero if the
+ *            data has not been allocated yet.
  */
 typedef struct texture {
     uint32_t        id;
@@ -43,6 +48,7 @@ typedef struct texture {
     int             format;
     int             flags;
     char            *url;
+    int             size;
 } texture_t;
 
 /*
@@ -69,4 +75,35 @@ texture_t *texture_from_data(const void *data, int img_w, int img_h, int bpp,
 texture_t *texture_from_url(const char *url, int flags);
 bool texture_load(texture_t *tex, int *code);
 void texture_set_data(texture_t *tex, const void *data, int w, int h, int bpp);
+
+/*
+ * Function: texture_set_sub_data
+ * Update a region of a texture.
+ *
+ * The texture storage must already have been set with <texture_set_data>.
+ */
+void texture_set_sub_data(texture_t *tex, const void *data,
+                          int x, int y, int w, int h, int bpp);
+
 void texture_release(texture_t *tex);
+
+/*
+ * Function: texture_upload_budget_reset
+ * Set the amount of data we can upload to the GPU for the current frame.
+ *
+ * Should be called at the beginning of each frame.
+ */
+void texture_upload_budget_reset(int size);
+
+/*
+ * Function: texture_upload_budget_take
+ * Check if we can upload some data to the GPU in the current frame.
+ *
+ * If this returns true, the size is removed from the frame budget.  The
+ * first request of a frame is always accepted, so that large textures
+ * still get uploaded eventually.
+ *
+ * Parameters:
+ *   size - Size in bytes of the data we want to upload.
+ */
+bool texture_upload_budget_take(int size);
@@ -8,6 +8,7 @@
  */
 
 #include "worker.h"
+#include <assert.h>
 #include <string.h>
 
 #ifndef HAVE_PTHREAD
@@ -32,3 +33,136 @@ bool worker_is_running(worker_t *w)
 }
 
 #endif
+
+#if PARALLEL_FOR
+
+#include <pthread.h>
+#include <unistd.h>
+
+#define MAX_THREADS 8
+
+// Thread pool used by parallel_for.  The main thread also processes the
+// chunks, so we only need nb_threads - 1 extra threads.
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t  start_cond;
+    pthread_cond_t  done_cond;
+    int             nb_threads;
+    int             generation; // Incremented for each new job.
+    int             nb_busy;    // Number of threads still in the job.
+
+    // The current job.
+    int             n;
+    int             chunk_size;
+    int             next;       // Start of the next chunk to process.
+    void            *user;
+    void            (*f)(void *user, int start, int end);
+} g_pool = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .start_cond = PTHREAD_COND_INITIALIZER,
+    .done_cond = PTHREAD_COND_INITIALIZER,
+};
+
+// Process the chunks of the current job until there are none left.
+// Must be called with the mutex locked.
+static void run_chunks(void)
+{
+    int start, end;
+    while (g_pool.next < g_pool.n) {
+        start = g_pool.next;
+        end = start + g_pool.chunk_size;
+        if (end > g_pool.n) end = g_pool.n;
+        g_pool.next = end;
+        pthread_mutex_unlock(&g_pool.mutex);
+        g_pool.f(g_pool.user, start, end);
+        pthread_mutex_lock(&g_pool.mutex);
+    }
+}
+
+static void *thread_func(void *arg)
+{
+    int generation = 0;
+    pthread_mutex_lock(&g_pool.mutex);
+    while (true) {
+        while (g_pool.generation == generation)
+            pthread_cond_wait(&g_pool.start_cond, &g_pool.mutex);
+        generation = g_pool.generation;
+        run_chunks();
+        if (--g_pool.nb_busy == 0)
+            pthread_cond_signal(&g_pool.done_cond);
+    }
+    return NULL;
+}
+
+static void pool_init(void)
+{
+    int i;
+    long nb_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    pthread_t thread;
+
+    g_pool.nb_threads = 1;
+    if (nb_cpus > MAX_THREADS) nb_cpus = MAX_THREADS;
+    for (i = 1; i < nb_cpus; i++) {
+        if (pthread_create(&thread, NULL, thread_func, NULL)) break;
+        pthread_detach(thread);
+        g_pool.nb_threads++;
+    }
+}
+
+void parallel_for(int n, int chunk_size, void *user,
+                  void (*f)(void *user, int start, int end))
+{
+    assert(chunk_size > 0);
+    if (!g_pool.nb_threads) pool_init();
+    if (n <= chunk_size || g_pool.nb_threads == 1) {
+        if (n > 0) f(user, 0, n);
+        return;
+    }
+    pthread_mutex_lock(&g_pool.mutex);
+    assert(g_pool.nb_busy == 0);
+    g_pool.n = n;
+    g_pool.chunk_size = chunk_size;
+    g_pool.next = 0;
+    g_pool.user = user;
+    g_pool.f = f;
+    g_pool.nb_busy = g_pool.nb_threads - 1;
+    g_pool.generation++;
+    pthread_cond_broadcast(&g_pool.start_cond);
+    run_chunks();
+    // Wait for all the threads to be done with the job, so that none of
+    // them still uses it after we return.
+    while (g_pool.nb_busy)
+        pthread_cond_wait(&g_pool.done_cond, &g_pool.mutex);
+    pthread_mutex_unlock(&g_pool.mutex);
+}
+
+#else
+
+void parallel_for(int n, int chunk_size, void *user,
+                  void (*f)(void *user, int start, int end))
+{
+    if (n > 0) f(user, 0, n);
+}
+
+#endif
+
+#if COMPILE_TESTS
+
+#include "tests.h"
+
+static void test_parallel_for_func(void *user, int start, int end)
+{
+    int i, *values = user;
+    for (i = start; i < end; i++) values[i] = i * 2;
+}
+
+static void test_parallel_for(void)
+{
+    int i, values[10000] = {};
+    parallel_for(10000, 100, values, test_parallel_for_func);
+    for (i = 0; i < 10000; i++) assert(values[i] == i * 2);
+}
+
+TEST_REGISTER(NULL, test_parallel_for, TEST_AUTO);
+
+#endif
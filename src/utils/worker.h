@@ -59,4 +59,28 @@ int worker_iter(worker_t *worker);
  */
 bool worker_is_running(worker_t *worker);
 
+/*
+ * Function: parallel_for
+ * Call a function over a range of indices split into chunks, with the
+ * chunks processed in parallel if possible.
+ *
+ * The function returns once all the chunks have been processed.  Each
+ * chunk must only write to its own part of the output, and must not call
+ * any function that is not thread safe (no cache, painter or texture
+ * functions for example).
+ *
+ * Threads are only used if the code is compiled with PARALLEL_FOR set
+ * (the native builds), otherwise we directly call the function on the
+ * whole range.  This must only be called from the main thread.
+ *
+ * Parameters:
+ *   n          - Size of the range.
+ *   chunk_size - Number of indices processed in each call to f.
+ *   user       - User data passed to f.
+ *   f          - Function called for each chunk with the indices
+ *                start (included) to end (excluded).
+ */
+void parallel_for(int n, int chunk_size, void *user,
+                  void (*f)(void *user, int start, int end));
+
 #endif // WORKER_H
@@ -18,6 +18,7 @@ import zlib
 
 ROOT = "data"
 SOURCES = [
+    "bench/",
     "font/",
     "planets.ini",
     "shaders/",